@@ -0,0 +1,105 @@
+#ifndef COMMANDENCODER_H
+#define COMMANDENCODER_H
+
+#include <vector>
+#include "tserial.h"
+
+/*************************************************************************************
+* CommandEncoder.h contains the functions that spell out commands to the robot. They
+* write each frame straight into the Tserial's output buffer (see
+* Tserial::reserveFrame), so sending a command costs no allocation and no copy:
+*
+* - void SendTicks(Tserial& Port, char Joint, char Direction, unsigned int Ticks):
+*      Sends "<Joint><Direction><Ticks>\n\r", adding Ticks to the joint's register.
+* - void SendCommand(Tserial& Port, char Joint, char Op):
+*      Sends "<Joint><Op>\n\r": '?' for the register query, 'X' to stop.
+* - int EncodeTicks(char* Out, char Joint, char Direction, unsigned int Ticks):
+* - int EncodeCommand(char* Out, char Joint, char Op):
+*      Write the same frames into Out, which must have room for MAX_FRAME
+*      characters, and return their length. No null is written.
+*
+* - PortBatch(Tserial* Port), PortBatch(const std::vector<Tserial*>& Ports):
+*      Holds a batch open on Port, or on each of Ports, for as long as it lives
+*      (see Tserial::beginBatch), so the frames sent meanwhile go out in one write
+*      per port. The batch ends however the scope is left, so a Stop sent just
+*      before a StalledMovementException still reaches the robot.
+*
+* Any tick count an unsigned int can hold fits in a frame. Keeping each frame
+* within the register's limit is up to the caller, which sends a long move as
+* several groups.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	// A joint, a direction, up to 10 digits and the newline pair.
+	const int MAX_FRAME = 14;
+
+	inline int EncodeTicks(char* Out, char Joint, char Direction, unsigned int Ticks)
+	{
+		char Digits[10];
+		int  Count  = 0;
+		int  Length = 0;
+
+		do
+		{
+			Digits[Count++] = char('0' + Ticks % 10);
+			Ticks /= 10;
+		}
+		while (Ticks > 0);
+
+		Out[Length++] = Joint;
+		Out[Length++] = Direction;
+		while (Count > 0)
+			Out[Length++] = Digits[--Count];
+		Out[Length++] = 0x0A;
+		Out[Length++] = 0x0D;
+		return Length;
+	}
+
+	inline int EncodeCommand(char* Out, char Joint, char Op)
+	{
+		Out[0] = Joint;
+		Out[1] = Op;
+		Out[2] = 0x0A;
+		Out[3] = 0x0D;
+		return 4;
+	}
+
+	inline void SendTicks(Tserial& Port, char Joint, char Direction, unsigned int Ticks)
+	{
+		Port.commitFrame(EncodeTicks(Port.reserveFrame(MAX_FRAME), Joint, Direction, Ticks));
+	}
+
+	inline void SendCommand(Tserial& Port, char Joint, char Op)
+	{
+		Port.commitFrame(EncodeCommand(Port.reserveFrame(MAX_FRAME), Joint, Op));
+	}
+
+	class PortBatch
+	{
+		public:
+			explicit PortBatch(Tserial* Port) : One(Port), Ports(&this->One), Count(1)
+			{
+				this->One->beginBatch();
+			}
+
+			explicit PortBatch(const std::vector<Tserial*>& Ports) : One(0), Ports(Ports.data()), Count(Ports.size())
+			{
+				for (size_t p = 0; p < this->Count; p++)
+					this->Ports[p]->beginBatch();
+			}
+
+			~PortBatch()
+			{
+				for (size_t p = 0; p < this->Count; p++)
+					this->Ports[p]->endBatch();
+			}
+		private:
+			PortBatch(const PortBatch&);
+			PortBatch& operator=(const PortBatch&);
+
+			Tserial*        One;
+			Tserial* const* Ports;
+			size_t          Count;
+	};
+}
+#endif
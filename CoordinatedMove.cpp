@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include "CoordinatedMove.h"
+#include "MoveExceptions.h"
+#include "MotionTrace.h"
+#include "CommandEncoder.h"
+
+namespace TLeyson_Robot
+{
+	/********************************************************************
+	*                   CoordinatedMove::Add
+	* Works out how far the joint has to go, the same way Move does, and
+	* checks the angle against the joint's boundaries before anything is
+	* sent, so a bad pose never leaves the arm half moved. A joint that
+	* is already part of the move gets the new angle in place of its old.
+	* Postcondition: The joint is part of the next Execute, once.
+	* Throws:        BoundaryViolationException.
+	********************************************************************/
+	void CoordinatedMove::Add(JointMove* Joint, double AngularPosition)
+	{
+		if ( !(AngularPosition > Joint->LowerBound && AngularPosition < Joint->UpperBound) )
+			throw BoundaryViolationException();
+
+		Leg Part;
+		Part.Joint           = Joint;
+		Part.Target          = AngularPosition;
+		Part.DesiredPosition = Joint->Round(Joint->ConvertToTicks(AngularPosition));
+		Part.TotalTicks      = Part.DesiredPosition - Joint->HomeDeviation;
+		Part.Direction       = Part.TotalTicks > 0 ? '+' : '-';
+		Part.Replenish       = Joint->Replenish;
+		Part.Sent            = 0;
+
+		char QueryString[] = {Joint->JointToMove, '?', 0x0A, 0x0D, '\0'};
+		for (int k = 0; k < 5; k++)
+			Part.QueryString[k] = QueryString[k];
+
+		for (size_t j = 0; j < this->Legs.size(); j++)
+			if (this->Legs[j].Joint == Joint)
+			{
+				this->Legs[j] = Part;
+				return;
+			}
+		this->Legs.push_back(Part);
+	}
+
+	/********************************************************************
+	*                   CoordinatedMove::TicksInRound
+	* Spreads a joint's ticks over the rounds so that the shares differ
+	* by at most one tick and add up exactly to the total.
+	********************************************************************/
+	int CoordinatedMove::TicksInRound(const Leg& Part, int Round, int Rounds) const
+	{
+		long long Ticks = abs(Part.TotalTicks);
+		return int((Round + 1) * Ticks / Rounds - Round * Ticks / Rounds);
+	}
+
+	void CoordinatedMove::SendTicks(Leg& Part, int Ticks)
+	{
+		TLeyson_Robot::SendTicks(*(Part.Joint->ComPort), Part.Joint->JointToMove, Part.Direction, (unsigned int) Ticks);
+		Trace(teCOMMAND, Part.Joint->JointToMove, Ticks);
+		Part.Joint->Sent(Part.Direction, (unsigned int) Ticks, MonotonicSeconds());
+		Part.Sent += Ticks;
+	}
+
+	/********************************************************************
+	*                   CoordinatedMove::Unwind
+	* A joint stalled partway through Execute. Each joint's position is
+	* set to the ticks it was actually sent, less whatever the stalled
+	* joint's Stop threw away, so the next move starts from where the
+	* joints will be; the legs are dropped, so nothing is sent again.
+	********************************************************************/
+	void CoordinatedMove::Unwind(const StalledMovementException& Stall)
+	{
+		for (size_t i = 0; i < this->Legs.size(); i++)
+		{
+			Leg&       Part  = this->Legs[i];
+			JointMove& Joint = *Part.Joint;
+			int        Moved = Part.Sent;
+			if (Joint.JointToMove == Stall.Joint && Stall.Register > 0)
+				Moved -= std::min(Moved, Stall.Register);
+			Joint.HomeDeviation  += Part.Direction == '+' ? Moved : -Moved;
+			Joint.CurrentPosition = Joint.HomeDeviation * Joint.Resolution;
+		}
+		this->Legs.clear();
+	}
+
+	/********************************************************************
+	*                   CoordinatedMove::Execute
+	* Streams every joint's ticks in rounds. A joint whose register has
+	* not drained to its replenish level is skipped and revisited, so a
+	* slow joint never holds up the others within a round. Joints in
+	* PREDICTIVE mode are fed on the drain model's schedule, with a
+	* register query every CORRECTION_INTERVAL groups, exactly as in
+	* JointMove::Move. The queries due in one pass are sent together
+	* and their replies read afterwards.
+	* Precondition:  Every joint added is connected to the robot.
+	* Postcondition: Every joint is at the angle it was added with.
+	********************************************************************/
+	int CoordinatedMove::Execute(void)
+	{
+		// Hold every port involved for the whole move, always locking them
+		// in the same order so two coordinated moves cannot deadlock.
+		std::vector<Tserial*> Ports;
+		for (size_t i = 0; i < this->Legs.size(); i++)
+			Ports.push_back(this->Legs[i].Joint->ComPort);
+		std::sort(Ports.begin(), Ports.end());
+		Ports.erase(std::unique(Ports.begin(), Ports.end()), Ports.end());
+		std::vector< std::unique_ptr< std::lock_guard<std::mutex> > > PortsHeld;
+		for (size_t i = 0; i < Ports.size(); i++)
+			PortsHeld.emplace_back(new std::lock_guard<std::mutex>(PortWorker::Lock(Ports[i])));
+
+		// Enough rounds that no joint is sent more than its own group size
+		// at once.
+		int Rounds = 0;
+		for (size_t i = 0; i < this->Legs.size(); i++)
+		{
+			int Group  = int(this->Legs[i].Joint->GroupSize);
+			int Needed = (abs(this->Legs[i].TotalTicks) + Group - 1) / Group;
+			if (Needed > Rounds)
+				Rounds = Needed;
+		}
+
+		// A joint sending a third of a group each round gets a third of its
+		// replenish level, so every register is topped up at the same point
+		// in its group.
+		for (size_t i = 0; i < this->Legs.size(); i++)
+		{
+			Leg&       Part  = this->Legs[i];
+			JointMove& Joint = *Part.Joint;
+			Part.Replenish = Rounds ? int(Joint.Replenish * (long long) abs(Part.TotalTicks)
+			                              / ((long long) Rounds * Joint.GroupSize)) : 0;
+			if (Part.Replenish < 1)
+				Part.Replenish = 1;
+			Joint.GroupsSinceQuery = JointMove::CORRECTION_INTERVAL;
+		}
+
+		std::vector<char> Waiting(this->Legs.size());
+		std::vector<char> Asked(this->Legs.size());
+		try
+		{
+			for (int Round = 0; Round < Rounds; Round++)
+			{
+				int Outstanding = 0;
+				{
+					PortBatch Batch(Ports);
+					for (size_t i = 0; i < this->Legs.size(); i++)
+					{
+						Waiting[i] = this->TicksInRound(this->Legs[i], Round, Rounds) > 0;
+						// Like the odd group in Move, the first round goes straight out.
+						if (Waiting[i] && Round == 0)
+						{
+							this->SendTicks(this->Legs[i], this->TicksInRound(this->Legs[i], Round, Rounds));
+							Waiting[i] = false;
+						}
+						Outstanding += Waiting[i];
+					}
+				}
+
+				while (Outstanding > 0)
+				{
+					double Now      = MonotonicSeconds();
+					double Earliest = Now + 0.010;
+
+					// The groups released in one pass go out in one write per port,
+					// and a stall still sends its Stop.
+					{
+						PortBatch Batch(Ports);
+
+						// Every register this pass has to read is asked for before
+						// any reply is waited on, so the queries share the line's
+						// round trip instead of taking one each.
+						for (size_t i = 0; i < this->Legs.size(); i++)
+						{
+							JointMove& Joint = *this->Legs[i].Joint;
+							Asked[i] = Waiting[i] && !(Joint.FlowMode == PREDICTIVE && Joint.Drain.Calibrated()
+							                           && Joint.GroupsSinceQuery + 1 < JointMove::CORRECTION_INTERVAL);
+							if (Asked[i])
+								Joint.AskRegister(this->Legs[i].QueryString);
+						}
+
+						for (size_t i = 0; i < this->Legs.size(); i++)
+						{
+							if (!Waiting[i])
+								continue;
+
+							Leg&       Part       = this->Legs[i];
+							JointMove& Joint      = *Part.Joint;
+							bool       Predictive = Joint.FlowMode == PREDICTIVE && Joint.Drain.Calibrated();
+							bool       Ready;
+
+							if (!Asked[i])
+							{
+								// Asked of TimeToReach rather than Predict, so that waking
+								// at the time it gave always finds the joint ready.
+								Ready = Joint.Drain.TimeToReach(Part.Replenish, Now) <= Now;
+								if (Ready)
+									Joint.GroupsSinceQuery++;
+							}
+							else
+							{
+								Ready = Joint.CollectRegister() <= Part.Replenish;
+								Joint.GroupsSinceQuery = 0;
+								Now = MonotonicSeconds();
+							}
+
+							if (Ready)
+							{
+								this->SendTicks(Part, this->TicksInRound(Part, Round, Rounds));
+								Waiting[i] = false;
+								Outstanding--;
+							}
+							else if (Predictive)
+							{
+								double Due = Joint.Drain.TimeToReach(Part.Replenish, Now);
+								if (Due < Earliest)
+									Earliest = Due;
+							}
+						}
+					}
+					if (Outstanding > 0)
+						SwitchPoller::SleepUntil(Ports, Earliest);
+				}
+			}
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			this->Unwind(Stall);
+			throw;
+		}
+
+		for (size_t i = 0; i < this->Legs.size(); i++)
+		{
+			this->Legs[i].Joint->HomeDeviation   = this->Legs[i].DesiredPosition;
+			this->Legs[i].Joint->CurrentPosition = this->Legs[i].Target;
+		}
+		this->Legs.clear();
+		return 0;
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef COORDINATEDMOVE_H
+#define COORDINATEDMOVE_H
+
+#include <vector>
+#include "JointMoveProto.h"
+
+/*************************************************************************************
+* CoordinatedMove.h contains class CoordinatedMove, which moves several joints at
+* once by interleaving their tick groups on the wire:
+*
+* - void Add(JointMove* Joint, double AngularPosition):
+*      Adds a joint and the angle it should reach. Adding a joint again replaces
+*      the angle it was added with, so each joint is streamed once.
+*      Throws:        BoundaryViolationException, if the angle violates one of the
+*                     joint's boundaries.
+* - int Execute(void):
+*      Precondition:  Every joint added is connected to the robot.
+*      Postcondition: Every joint will have moved to its angle. The move is sent
+*                     in rounds; in each round every joint gets its share of ticks
+*                     as soon as its own register has drained far enough, and the
+*                     next round starts when all of them have. The joint that
+*                     needs the most groups of its own GroupSize sets the number
+*                     of rounds; the others get proportionally smaller shares,
+*                     so all of them finish together. The list of joints is
+*                     emptied afterwards, so the object can be reused.
+*      Throws:        StalledMovementException, if one of the joints stalls (see
+*                     JointMove::Move); that joint is stopped and the rest finish
+*                     the ticks already sent to them. Each joint's position is
+*                     then where those ticks take it, and the list of joints is
+*                     emptied, as after a move that finished.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	class CoordinatedMove
+	{
+		public:
+			CoordinatedMove(void) { }
+
+			void Add    (JointMove* Joint, double AngularPosition);
+			int  Execute(void);
+
+			int  ViewJointCount(void) const { return int(this->Legs.size()); }
+		private:
+			struct Leg
+			{
+				JointMove* Joint;
+				double     Target;
+				// Target position from home, and the ticks needed to get there.
+				int        DesiredPosition;
+				int        TotalTicks;
+				char       Direction;
+				// Replenish level scaled to this joint's share of a round.
+				int        Replenish;
+				char       QueryString[5];
+				// Ticks sent so far by Execute.
+				int        Sent;
+			};
+
+			std::vector<Leg> Legs;
+
+			int  TicksInRound(const Leg& Part, int Round, int Rounds) const;
+			void SendTicks   (Leg& Part, int Ticks);
+			void Unwind      (const StalledMovementException& Stall);
+	};
+}
+#endif
@@ -0,0 +1,370 @@
+#ifndef FIXEDJOINTMOVE_H
+#define FIXEDJOINTMOVE_H
+
+#include <cmath>
+#include <stdlib.h>
+#include "JointMoveProto.h"
+#include "MotionTrace.h"
+
+/*************************************************************************************
+* FixedJointMove.h contains Fixed::JointMove<joint J, class Profile>, a JointMove for
+* an arm whose joints are known when the program is built. Profile is a class with
+* the joint's settings as compile-time constants:
+*
+*     struct Elbow
+*     {
+*         static constexpr double       Resolution   = 0.00209439510239;
+*         static constexpr double       LowerBound   = -5 * PI/12;
+*         static constexpr double       UpperBound   =  5 * PI/12;
+*         static constexpr double       HomePosition = 0;
+*         static constexpr unsigned int GroupSize    = 50;
+*         static constexpr unsigned int Replenish    = 15;
+*     };
+*     Fixed::JointMove<D, Elbow> djoint(&com);
+*
+* Move, SetFlowControl, PublishTo and the View functions behave exactly as
+* JointMove's, watchdog, StalledMovementException and estimate included. Home
+* keeps the simpler search JointMove had before HomeAll, stepping forward until
+* the switch closes, but under the same watchdog.
+* The difference is where the work is done: ticks per radian and the switch mask
+* are worked out by the compiler, and every command the joint can send (each
+* possible odd group, the full group, the query, the homing step and the stop) is
+* spelled out in a table of ready-made frames, so a Move does one multiplication
+* and then only copies bytes to the port. The settings are checked by the
+* compiler as RobotConfig checks them at run time, and the bounds against
+* RobotConfig::TICK_LIMIT, which JointMove checks on every move.
+*
+* Needs C++14 or later, for the loops in the constexpr functions that build the
+* frames.
+*
+* Use TLeyson_Robot::JointMove when the settings come from a file.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	namespace Fixed
+	{
+		// One command to the robot and its length, without a null.
+		struct Frame
+		{
+			char Text[12];
+			int  Length;
+		};
+
+		// "<Joint><Op><Ticks>\n\r", or "<Joint><Op>\n\r" if Ticks is 0.
+		constexpr Frame MakeFrame(char Joint, char Op, unsigned int Ticks)
+		{
+			Frame  Made = {{0}, 0};
+			char   Digits[10] = {0};
+			int    Count = 0;
+
+			Made.Text[Made.Length++] = Joint;
+			Made.Text[Made.Length++] = Op;
+			for (; Ticks > 0; Ticks /= 10)
+				Digits[Count++] = char('0' + Ticks % 10);
+			while (Count > 0)
+				Made.Text[Made.Length++] = Digits[--Count];
+			Made.Text[Made.Length++] = 0x0A;
+			Made.Text[Made.Length++] = 0x0D;
+			return Made;
+		}
+
+		// The frames for every tick count from 0 to Largest in one direction.
+		template <char Joint, char Op, unsigned int Largest>
+		struct FrameTable
+		{
+			Frame Frames[Largest + 1];
+
+			constexpr FrameTable() : Frames()
+			{
+				for (unsigned int k = 0; k <= Largest; k++)
+					this->Frames[k] = MakeFrame(Joint, Op, k);
+			}
+		};
+
+		template <joint J, class Profile>
+		class JointMove
+		{
+			static_assert(J >= A && J <= H, "joint must be A through H");
+			static_assert(Profile::Resolution > 0, "resolution must be positive");
+			static_assert(Profile::LowerBound < Profile::UpperBound, "bounds are reversed");
+			static_assert(Profile::HomePosition >= Profile::LowerBound
+			           && Profile::HomePosition <= Profile::UpperBound, "home is out of bounds");
+			static_assert(Profile::Replenish < Profile::GroupSize, "replenish must be below the group size");
+			static_assert(Profile::GroupSize + Profile::Replenish <= RobotConfig::REGISTER_LIMIT,
+			              "group and replenish level overflow what the register can report");
+			// Move's rounding can't go past TICK_LIMIT, as JointMove::Round
+			// would throw, since every angle it takes is inside the bounds.
+			static_assert(Profile::LowerBound / Profile::Resolution >= -RobotConfig::TICK_LIMIT
+			           && Profile::UpperBound / Profile::Resolution <= RobotConfig::TICK_LIMIT,
+			              "bounds are further from home than the controller can be sent");
+
+			public:
+				static constexpr char         Letter         = char(J);
+				static constexpr double       TicksPerRadian = 1 / Profile::Resolution;
+				static constexpr char         SwitchMask     = J >= C ? char(1 << (J - C)) : 0;
+				static constexpr unsigned int GroupSize      = Profile::GroupSize;
+				static constexpr unsigned int Replenish      = Profile::Replenish;
+
+				explicit JointMove(Tserial* Port, bool LimitSwitch = true);
+
+				int  Move(double AngularPosition);
+				int  Home(void);
+				void SetFlowControl(flow_control Mode) { this->FlowMode = Mode; }
+
+				char   ViewJoint          (void) const { return Letter; }
+				double ViewUpperBound     (void) const { return Profile::UpperBound; }
+				double ViewLowerBound     (void) const { return Profile::LowerBound; }
+				double ViewCurrentPosition(void) const { return this->CurrentPosition; }
+				flow_control ViewFlowControl(void) const { return this->FlowMode; }
+				unsigned int ViewStarvations(void) const { return this->Starvations; }
+				JointEstimate ViewEstimate(void) const { return this->State.Estimate(MonotonicSeconds()); }
+				void PublishTo(JointStateBoard& Board) { this->State.Attach(Board.Slot(Letter)); }
+			private:
+				typedef FrameTable<Letter, '+', GroupSize> ForwardTable;
+				typedef FrameTable<Letter, '-', GroupSize> BackwardTable;
+
+				static constexpr ForwardTable  Forward  = ForwardTable();
+				static constexpr BackwardTable Backward = BackwardTable();
+				static constexpr Frame Query    = MakeFrame(Letter, '?', 0);
+				static constexpr Frame HomeStep = MakeFrame(Letter, '+', 20);
+				static constexpr Frame Stop     = MakeFrame(Letter, 'X', 0);
+
+				static const unsigned int CORRECTION_INTERVAL = 4;
+				static const unsigned int POLL_INTERVAL       = 10;
+				static const int          REPLY_TIMEOUT       = 1000;
+
+				Tserial*     ComPort;
+				int          HomeDeviation;
+				double       CurrentPosition;
+				flow_control FlowMode;
+				DrainModel   Drain;
+				StateEstimator State;
+				unsigned int GroupsSinceQuery;
+				unsigned int Starvations;
+
+				void Send          (const Frame& Command);
+				void Sent          (int Ticks);
+				void Halt          (void);
+				char CheckSwitch   (void);
+				int  QueryRegister (void);
+				void AwaitReplenish(bool Refilling);
+		};
+
+#if __cplusplus < 201703L
+		// Before C++17 a static constexpr member is only declared in the class,
+		// and the frames are bound to references, so they need defining here.
+		template <joint J, class Profile> constexpr char         JointMove<J, Profile>::Letter;
+		template <joint J, class Profile> constexpr double       JointMove<J, Profile>::TicksPerRadian;
+		template <joint J, class Profile> constexpr char         JointMove<J, Profile>::SwitchMask;
+		template <joint J, class Profile> constexpr unsigned int JointMove<J, Profile>::GroupSize;
+		template <joint J, class Profile> constexpr unsigned int JointMove<J, Profile>::Replenish;
+		template <joint J, class Profile> constexpr typename JointMove<J, Profile>::ForwardTable  JointMove<J, Profile>::Forward;
+		template <joint J, class Profile> constexpr typename JointMove<J, Profile>::BackwardTable JointMove<J, Profile>::Backward;
+		template <joint J, class Profile> constexpr Frame        JointMove<J, Profile>::Query;
+		template <joint J, class Profile> constexpr Frame        JointMove<J, Profile>::HomeStep;
+		template <joint J, class Profile> constexpr Frame        JointMove<J, Profile>::Stop;
+#endif
+
+		template <joint J, class Profile>
+		JointMove<J, Profile>::JointMove(Tserial* Port, bool LimitSwitch)
+		{
+			this->ComPort          = Port;
+			this->HomeDeviation    = 0;
+			this->CurrentPosition  = Profile::HomePosition;
+			this->FlowMode         = POLLED;
+			this->GroupsSinceQuery = 0;
+			this->Starvations      = 0;
+			this->State.Configure(Profile::Resolution, Profile::HomePosition);
+			if (Port->getTimeout() == 0)
+				Port->setTimeout(REPLY_TIMEOUT);
+
+			if (LimitSwitch && SwitchMask)
+				this->Home();
+		}
+
+		template <joint J, class Profile>
+		void JointMove<J, Profile>::Send(const Frame& Command)
+		{
+			this->ComPort->sendArray(const_cast<char*>(Command.Text), Command.Length);
+		}
+
+		// As JointMove::Sent; Ticks is negative for '-'.
+		template <joint J, class Profile>
+		void JointMove<J, Profile>::Sent(int Ticks)
+		{
+			double Now = MonotonicSeconds();
+			this->Drain.Sent(abs(Ticks), Now);
+			this->State.Sent(Ticks, this->Drain, Now);
+		}
+
+		// As JointMove::Stop.
+		template <joint J, class Profile>
+		void JointMove<J, Profile>::Halt(void)
+		{
+			this->Send(Stop);
+			this->State.Stopped(this->Drain, MonotonicSeconds());
+			this->Drain.Reset();
+		}
+
+		// As JointMove::CheckSwitch, which stops the joint if the robot
+		// doesn't answer.
+		template <joint J, class Profile>
+		char JointMove<J, Profile>::CheckSwitch(void)
+		{
+			double      Asked    = MonotonicSeconds();
+			SwitchState Switches = SwitchPoller::For(this->ComPort).Read();
+			if (Switches.Failed)
+			{
+				Trace(teSTALLED, Letter, -1);
+				this->Halt();
+				throw StalledMovementException(Letter, -1, MonotonicSeconds() - Asked,
+				                               this->ComPort->getTimeout() / 1000.0);
+			}
+			return Switches.Bits & SwitchMask;
+		}
+
+		// As JointMove::QueryRegister, watchdog included.
+		template <joint J, class Profile>
+		int JointMove<J, Profile>::QueryRegister(void)
+		{
+			double Asked = MonotonicSeconds();
+			Trace(teQUERY, Letter, '?');
+			int RegisterValue = abs(this->ComPort->query(const_cast<char*>(Query.Text), Query.Length)) - 32;
+			double Answered = MonotonicSeconds();
+			if (this->ComPort->timedOut())
+			{
+				Trace(teSTALLED, Letter, -1);
+				this->Halt();
+				throw StalledMovementException(Letter, -1, Answered - Asked, this->ComPort->getTimeout() / 1000.0);
+			}
+			Trace(teRESPONSE, Letter, RegisterValue);
+			TraceLatency(Letter, tmQUERY_ROUND_TRIP, Answered - Asked);
+			this->Drain.Observe(RegisterValue, (Asked + Answered) / 2);
+			this->State.Observed(this->Drain, (Asked + Answered) / 2);
+			if (this->Drain.Stalled())
+			{
+				double Stuck = this->Drain.StuckFor();
+				double Limit = this->Drain.StallLimit();
+				Trace(teSTALLED, Letter, RegisterValue);
+				this->Halt();
+				throw StalledMovementException(Letter, RegisterValue, Stuck, Limit);
+			}
+			return RegisterValue;
+		}
+
+		// As JointMove::AwaitReplenish.
+		template <joint J, class Profile>
+		void JointMove<J, Profile>::AwaitReplenish(bool Refilling)
+		{
+			bool   Predictive = this->FlowMode == PREDICTIVE && this->Drain.Calibrated();
+			double Entered    = MonotonicSeconds();
+
+			if (Predictive && ++this->GroupsSinceQuery < CORRECTION_INTERVAL)
+			{
+				Trace(teSLEEP_BEGIN, Letter);
+				SwitchPoller::SleepUntil(this->ComPort, this->Drain.TimeToReach(Replenish, Entered));
+				Trace(teSLEEP_END, Letter);
+				TraceLatency(Letter, tmTIME_TO_REPLENISH, MonotonicSeconds() - Entered);
+				return;
+			}
+			this->GroupsSinceQuery = 0;
+
+			int RegisterValue = this->QueryRegister();
+			if (Refilling && RegisterValue == 0)
+			{
+				Trace(teSTARVED, Letter, 0);
+				this->Starvations++;
+			}
+			while (RegisterValue > int(Replenish))
+			{
+				Trace(teSLEEP_BEGIN, Letter);
+				double Wake = Predictive ? this->Drain.TimeToReach(Replenish, MonotonicSeconds())
+				                         : MonotonicSeconds() + POLL_INTERVAL / 1000.0;
+				SwitchPoller::SleepUntil(this->ComPort, Wake);
+				Trace(teSLEEP_END, Letter);
+				RegisterValue = this->QueryRegister();
+			}
+			TraceLatency(Letter, tmTIME_TO_REPLENISH, MonotonicSeconds() - Entered);
+		}
+
+		/********************************************************************
+		*                   Fixed::JointMove::Move
+		* As JointMove::Move. The group arithmetic divides by a constant,
+		* which the compiler turns into a multiplication, and every frame
+		* sent comes straight out of a table.
+		* Throws:        BoundaryViolationException.
+		********************************************************************/
+		template <joint J, class Profile>
+		int JointMove<J, Profile>::Move(double AngularPosition)
+		{
+			if ( !(AngularPosition > Profile::LowerBound && AngularPosition < Profile::UpperBound) )
+				throw BoundaryViolationException();
+			else if (this->CurrentPosition == AngularPosition)
+				return 0;
+
+			std::lock_guard<std::mutex> PortHeld(PortWorker::Lock(this->ComPort));
+			double Started = MonotonicSeconds();
+
+			// Rounded half away from zero, as JointMove::Round does.
+			int DesiredPosition = int(std::lround(AngularPosition * TicksPerRadian));
+			int TotalTicks      = DesiredPosition - this->HomeDeviation;
+
+			int          Sign   = AngularPosition > this->CurrentPosition ? 1 : -1;
+			const Frame* Frames = Sign > 0 ? Forward.Frames : Backward.Frames;
+			unsigned int Ticks       = (unsigned int) abs(TotalTicks);
+			unsigned int WholeGroups = Ticks / GroupSize;
+			unsigned int OddGroup    = Ticks % GroupSize;
+			Trace(teMOVE_BEGIN, Letter, TotalTicks);
+
+			if (OddGroup)
+			{
+				this->Send(Frames[OddGroup]);
+				Trace(teCOMMAND, Letter, OddGroup);
+				this->Sent(Sign * int(OddGroup));
+			}
+
+			this->GroupsSinceQuery = CORRECTION_INTERVAL;
+			for (unsigned int k = WholeGroups; k > 0; k--)
+			{
+				this->AwaitReplenish(k < WholeGroups);
+				this->Send(Frames[GroupSize]);
+				Trace(teCOMMAND, Letter, GroupSize);
+				this->Sent(Sign * int(GroupSize));
+			}
+			Trace(teMOVE_END, Letter, TotalTicks);
+			TraceLatency(Letter, tmMOVE_DURATION, MonotonicSeconds() - Started);
+
+			this->HomeDeviation   = DesiredPosition;
+			this->CurrentPosition = AngularPosition;
+			return 0;
+		}
+
+		// JointMove::Home's first search: a HomeStep every 0.3 s until the
+		// switch closes. The register is read before each step, so the
+		// watchdog stops a joint that jams on the way, as in HomeAll. The
+		// joint ends at HomePosition with an empty register, as there.
+		template <joint J, class Profile>
+		int JointMove<J, Profile>::Home(void)
+		{
+			std::lock_guard<std::mutex> PortHeld(PortWorker::Lock(this->ComPort));
+			Trace(teHOME_BEGIN, Letter);
+			while (this->CheckSwitch())
+			{
+				this->QueryRegister();
+				this->Send(HomeStep);
+				Trace(teCOMMAND, Letter, 20);
+				this->Sent(20);
+				Trace(teSLEEP_BEGIN, Letter);
+				SwitchPoller::SleepUntil(this->ComPort, MonotonicSeconds() + 0.3);
+				Trace(teSLEEP_END, Letter);
+			}
+			this->Halt();
+			this->HomeDeviation   = 0;
+			this->CurrentPosition = Profile::HomePosition;
+			this->State.Settle(0, MonotonicSeconds());
+			Trace(teHOME_END, Letter);
+			return 0;
+		}
+	}
+}
+#endif
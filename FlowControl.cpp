@@ -0,0 +1,161 @@
+#include <chrono>
+#include <thread>
+#include "FlowControl.h"
+
+namespace TLeyson_Robot
+{
+	const double DrainModel::SMOOTHING     = 0.3;
+	const double DrainModel::MINIMUM_STALL = 1.0;
+	const double DrainModel::STALL_TICKS   = 20;
+
+	// The clock installed in place of the steady clock, if any.
+	static std::atomic<Clock*> Installed(0);
+
+	static double SteadySeconds(void)
+	{
+		return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/********************************************************************
+	*                   MonotonicSeconds
+	* Seconds since an arbitrary, fixed starting point. Never goes back.
+	********************************************************************/
+	double MonotonicSeconds(void)
+	{
+		Clock* Replacement = Installed.load(std::memory_order_acquire);
+		return Replacement ? Replacement->Now() : SteadySeconds();
+	}
+
+	/********************************************************************
+	*                   SleepUntil
+	* Sleeps until MonotonicSeconds reaches When. Returns at once if that
+	* time has already passed.
+	********************************************************************/
+	void SleepUntil(double When)
+	{
+		Clock* Replacement = Installed.load(std::memory_order_acquire);
+		if (Replacement)
+		{
+			Replacement->SleepUntil(When);
+			return;
+		}
+		double Remaining = When - SteadySeconds();
+		if (Remaining > 0)
+			std::this_thread::sleep_for(std::chrono::duration<double>(Remaining));
+	}
+
+	Clock* Clock::Install(Clock* Replacement)
+	{
+		return Installed.exchange(Replacement, std::memory_order_acq_rel);
+	}
+
+	VirtualClock::VirtualClock(void)
+	{
+		this->Time.store(SteadySeconds(), std::memory_order_relaxed);
+	}
+
+	// Moves the clock on to When, unless it is already past it.
+	void VirtualClock::SleepUntil(double When)
+	{
+		double Seen = this->Time.load(std::memory_order_relaxed);
+		while (When > Seen && !this->Time.compare_exchange_weak(Seen, When, std::memory_order_acq_rel))
+			;
+	}
+
+	DrainModel::DrainModel()
+	{
+		this->TicksPerSecond = 0;
+		this->Measurements   = 0;
+		this->Reset();
+	}
+
+	/********************************************************************
+	*                   DrainModel::Reset
+	* Forgets the register contents but keeps the learned drain rate,
+	* which belongs to the joint rather than to a single move.
+	********************************************************************/
+	void DrainModel::Reset(void)
+	{
+		this->Level             = 0;
+		this->Stamp             = 0;
+		this->Observed          = 0;
+		this->ObservedStamp     = 0;
+		this->SentSinceObserved = 0;
+		this->HaveObservation   = false;
+		this->StuckSince        = 0;
+		this->StuckAt           = 0;
+	}
+
+	void DrainModel::Sent(int Ticks, double When)
+	{
+		this->Level = this->Predict(When) + Ticks;
+		this->Stamp = When;
+		this->SentSinceObserved += Ticks;
+	}
+
+	/********************************************************************
+	*                   DrainModel::Observe
+	* Takes a register value read from the robot. The ticks that left
+	* the register since the previous reading give a rate, but only if
+	* the register never ran dry in between, so a reading of zero
+	* re-anchors the model without measuring anything. Nor is a rate
+	* taken across a send: the ticks reach the controller some time
+	* after they are written, so the drain would look slower than it is.
+	********************************************************************/
+	void DrainModel::Observe(int Register, double When)
+	{
+		// Nothing left since the last reading, counting what was sent
+		// on top of it: stuck for a little longer. A full reading can't
+		// rise, so it only has to hold.
+		int Expected = this->Observed + this->SentSinceObserved;
+		if (Expected > LARGEST_READING)
+			Expected = LARGEST_READING;
+		if (this->HaveObservation && Register > 0 && Register >= Expected)
+			this->StuckAt = When;
+		else
+			this->StuckSince = this->StuckAt = When;
+
+		if (this->HaveObservation && Register > 0 && this->SentSinceObserved == 0)
+		{
+			double Elapsed = When - this->ObservedStamp;
+			int    Drained = this->Observed + this->SentSinceObserved - Register;
+			if (Elapsed > 0 && Drained > 0)
+			{
+				double Measured = Drained / Elapsed;
+				if (this->Measurements == 0)
+					this->TicksPerSecond = Measured;
+				else
+					this->TicksPerSecond += SMOOTHING * (Measured - this->TicksPerSecond);
+				this->Measurements++;
+			}
+		}
+
+		this->Observed          = Register;
+		this->ObservedStamp     = When;
+		this->SentSinceObserved = 0;
+		this->HaveObservation   = true;
+		this->Level             = Register;
+		this->Stamp             = When;
+	}
+
+	double DrainModel::Predict(double When) const
+	{
+		double Value = this->Level - this->TicksPerSecond * (When - this->Stamp);
+		return Value > 0 ? Value : 0;
+	}
+
+	double DrainModel::StallLimit(void) const
+	{
+		double Limit = this->TicksPerSecond > 0 ? STALL_TICKS / this->TicksPerSecond : 0;
+		return Limit > MINIMUM_STALL ? Limit : MINIMUM_STALL;
+	}
+
+	double DrainModel::TimeToReach(int Level, double From) const
+	{
+		if (this->TicksPerSecond <= 0 || this->Level <= Level)
+			return From;
+		double When = this->Stamp + (this->Level - Level) / this->TicksPerSecond;
+		return When > From ? When : From;
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef FLOWCONTROL_H
+#define FLOWCONTROL_H
+
+#include <atomic>
+
+/*************************************************************************************
+* FlowControl.h contains the timing helpers used to pace tick groups and class
+* DrainModel, which learns how fast a joint empties its register and notices when
+* it stops:
+*
+* - void Sent(int Ticks, double When):
+*      Records that Ticks were added to the register at time When.
+* - void Observe(int Register, double When):
+*      Records a register value read back from the robot. Two observations with
+*      the register still non-empty, and nothing sent in between, give a drain
+*      rate; later ones refine it.
+* - double Predict(double When):
+*      The register value expected at time When.
+* - double TimeToReach(int Level, double From):
+*      The time, no earlier than From, at which the register is expected to
+*      have drained to Level.
+* - bool Stalled(void):
+*      True once the readings show the register non-empty and nothing leaving it,
+*      counting what was sent between them, for longer than StallLimit: STALL_TICKS
+*      ticks' worth at the measured rate, and never less than MINIMUM_STALL
+*      seconds. A reading pinned at LARGEST_READING only has to hold. StuckFor
+*      says for how long. Only the readings the caller takes anyway are used.
+*
+* Times are seconds on the monotonic clock returned by MonotonicSeconds.
+*
+* MonotonicSeconds and SleepUntil read the steady clock and sleep for real until
+* another Clock is installed with Clock::Install. A VirtualClock only moves when it
+* is told to: SleepUntil jumps it straight to the time asked for, so code that
+* paces itself with them, as JointMove does, runs as fast as it can compute. It
+* suits one thread driving everything, as a test does with a LoopbackPort (see
+* XRSimulator.h); a thread waiting on a condition variable, such as a started
+* SwitchPoller's, still waits in real time.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	double MonotonicSeconds(void);
+	void   SleepUntil      (double When);
+
+	class Clock
+	{
+		public:
+			virtual ~Clock() {}
+			virtual double Now       (void) = 0;
+			virtual void   SleepUntil(double When) = 0;
+
+			// Makes Replacement the clock that MonotonicSeconds and SleepUntil
+			// use, or the steady clock again if it is null, and returns the
+			// one it replaces (null for the steady clock).
+			static Clock* Install(Clock* Replacement);
+	};
+
+	class VirtualClock : public Clock
+	{
+		public:
+			// Starts where the steady clock is, so time doesn't go back when
+			// it is installed.
+			VirtualClock(void);
+
+			double Now       (void) { return this->Time.load(std::memory_order_acquire); }
+			void   SleepUntil(double When);
+			void   Advance   (double Seconds) { this->SleepUntil(this->Now() + Seconds); }
+		private:
+			std::atomic<double> Time;
+	};
+
+	class DrainModel
+	{
+		public:
+			DrainModel();
+
+			void   Reset      (void);
+			void   Sent       (int Ticks, double When);
+			void   Observe    (int Register, double When);
+			double Predict    (double When) const;
+			double TimeToReach(int Level, double From) const;
+
+			// True once a drain rate has been measured.
+			bool   Calibrated (void) const { return this->Measurements > 0; }
+			double Rate       (void) const { return this->TicksPerSecond; }
+			double StuckFor   (void) const { return this->StuckAt - this->StuckSince; }
+			double StallLimit (void) const;
+			bool   Stalled    (void) const { return this->StuckFor() > this->StallLimit(); }
+		private:
+			// The modelled register value at time Stamp.
+			double Level;
+			double Stamp;
+			// The last register value actually read, when it was read, and
+			// how many ticks have been sent since.
+			int    Observed;
+			double ObservedStamp;
+			int    SentSinceObserved;
+			bool   HaveObservation;
+			// The first and last readings in a row with nothing leaving
+			// the register.
+			double StuckSince;
+			double StuckAt;
+			// Smoothed drain rate and the number of measurements behind it.
+			double TicksPerSecond;
+			int    Measurements;
+			// Weight of a new measurement in the smoothed rate.
+			static const double SMOOTHING;
+			static const double MINIMUM_STALL;
+			static const double STALL_TICKS;
+			// A reading is one printable character, so it shows no more than
+			// this however full the register is.
+			static const int    LARGEST_READING = 95;
+	};
+}
+#endif
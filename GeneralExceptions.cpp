@@ -11,4 +11,10 @@ namespace TLeyson_Robot
 	{
 		this->fname = fname;
 	}
+
+	MalformedConfigException::MalformedConfigException(char* fname, int line)
+	{
+		this->fname = fname;
+		this->line  = line;
+	}
 }
\ No newline at end of file
@@ -4,5 +4,6 @@ namespace TLeyson_Robot
 {
 	class FileNotFoundException  { public: char* fname; FileNotFoundException(char* fname); };
 	class ValueNotFoundException { public: char* fname; ValueNotFoundException(char* fname); };
+	class MalformedConfigException { public: char* fname; int line; MalformedConfigException(char* fname, int line); };
 }
 #endif
\ No newline at end of file
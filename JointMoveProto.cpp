@@ -1,15 +1,20 @@
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <new>
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <memory>
 #include "JointMoveProto.h"
 #include "GeneralExceptions.h"
 #include "MoveExceptions.h"
+#include "MotionTrace.h"
+#include "CommandEncoder.h"
 
 namespace TLeyson_Robot
 {
-	bool JointMove::PortFree = true;
-
 	/********************************************************************
 	*                   JointMove::JointMove
 	* Constructor for the JointMove class. Requires the following:
@@ -21,12 +26,10 @@ namespace TLeyson_Robot
 	*        will check whether any angle it's given is outside
 	*        this range.
 	*    - char* ResolutionFile
-	*        A C-string which contains the name of a file that
-	*        has resolution values for the joints, in radians.
-	*    - char* SwitchMaskFile
-	*        Another C-string which contains the name of a file that
-	*        has the masks needed to test whether a limit switch is
-	*        open or closed.
+	*        A C-string which contains the name of the robot's
+	*        configuration file (see RobotConfig.h). The joint's
+	*        resolution, switch mask and group sizes come from it;
+	*        the file is only read by the first JointMove to use it.
 	*    - Tserial* Port
 	*        A pointer to an instance of Tserial that controls the
 	*        serial port.
@@ -37,8 +40,7 @@ namespace TLeyson_Robot
 	*    - JointToMove is a character that represents a valid motor.
 	*    - UpperBound and LowerBound are valid radian angles (they can be
 	*      the same, though it won't get you anywhere).
-	*    - ResolutionFile and SwitchMaskFile are names of existing files.
-	*      See ReadFile for more information.
+	*    - ResolutionFile is the name of an existing configuration file.
 	*    - Port is a pointer to an instance of Tserial which has been
 	*      connected to a com port on the robot.
 	*    - HomePosition is a valid radian angle within the upper and lower
@@ -46,50 +48,98 @@ namespace TLeyson_Robot
 	* Postcondition:
 	*    - An instance of JointMove will be created.
 	* Throws:
-	*    - FileNotFoundException and ValueNotFoundException, both from
-	*      the ReadFile function. Instantiations of the class should be
-	*      enclosed in a try-block.
+	*    - FileNotFoundException, MalformedConfigException and
+	*      ValueNotFoundException, from RobotConfig. Instantiations of the
+	*      class should be enclosed in a try-block.
 	********************************************************************/
-	JointMove::JointMove(joint Joint, double UpperBound, double LowerBound,
+	JointMove::JointMove(char Joint, double UpperBound, double LowerBound,
                          char* ResolutionFile, Tserial* Port, bool LimitSwitch, double HomePosition)
 	{
-		this->JointToMove  = toupper(Joint);
-		this->UpperBound   = UpperBound;
-		this->LowerBound   = LowerBound;
-		this->ComPort      = Port;
-		this->HomePosition = HomePosition;
+		this->JointToMove = toupper(Joint);
+		this->ComPort     = Port;
 
-		this->HomeDeviation = 0;
-		this->CurrentPosition = HomePosition;
+		// This can throw errors, so the creation of an object should take
+		// place inside a try/catch block.
+		this->Configure(RobotConfig::Shared(ResolutionFile)[this->JointToMove]);
 
-		// This function can throw errors, so the creation of an object
-		// should take place inside a try/catch block.
+		this->UpperBound      = UpperBound;
+		this->LowerBound      = LowerBound;
+		this->HomePosition    = HomePosition;
+		this->CurrentPosition = HomePosition;
+		this->State.Configure(this->Resolution, HomePosition);
 
-		this->Resolution = atof( (this->ReadFile(ResolutionFile)).c_str() );
+		if (LimitSwitch)
+			this->Home();
+	}
 
-		this->SwitchMask = char(std::pow(2, float(this->JointToMove - 67)));
+	/********************************************************************
+	*                   JointMove::JointMove
+	* Builds the joint entirely from Config: bounds, home position,
+	* resolution, switch mask and group sizes. A joint whose switch mask
+	* is zero has no limit switch and is never homed.
+	* Throws:        ValueNotFoundException, if Config has no such joint.
+	********************************************************************/
+	JointMove::JointMove(char Joint, const RobotConfig& Config, Tserial* Port, bool LimitSwitch)
+	{
+		this->JointToMove = toupper(Joint);
+		this->ComPort     = Port;
+		this->Configure(Config[this->JointToMove]);
 
-		JointMove::PortFree = true;
-		if (LimitSwitch)
+		if (LimitSwitch && this->SwitchMask)
 			this->Home();
 	}
 
+	void JointMove::Configure(const JointConfig& Settings)
+	{
+		this->UpperBound   = Settings.UpperBound;
+		this->LowerBound   = Settings.LowerBound;
+		this->HomePosition = Settings.HomePosition;
+		this->Resolution   = Settings.Resolution;
+		this->SwitchMask   = Settings.SwitchMask;
+		this->GroupSize    = Settings.GroupSize;
+		this->Replenish    = Settings.Replenish;
+
+		this->HomeDeviation   = 0;
+		this->CurrentPosition = Settings.HomePosition;
+		this->State.Configure(Settings.Resolution, Settings.HomePosition);
+
+		this->FlowMode         = POLLED;
+		this->GroupsSinceQuery = 0;
+		this->QueryTicket      = 0;
+		this->QueryAsked       = 0;
+		this->Starvations      = 0;
+
+		// A robot that stops answering must not hang the caller for ever.
+		if (this->ComPort && this->ComPort->getTimeout() == 0)
+			this->ComPort->setTimeout(REPLY_TIMEOUT);
+	}
+
 	/********************************************************************
 	*                    JointMove::CheckSwitch
 	* Checks the return value of the I command to determine if the limit
 	* switch on the current motor is set. Returns false for closed and
-	* true for open.
+	* true for open. The I byte comes from the port's SwitchPoller, so
+	* it is only sent again once the last answer is a Period old.
+	* If the robot doesn't answer, the joint is stopped and
+	* StalledMovementException thrown, as CollectRegister does.
 	* Precondition:  ComPort is a valid pointer to a Tserial instance;
-	*                an XR series robot is connected to the computer.
+	*                an XR series robot is connected to the computer;
+	*                the caller holds the port's lock.
 	* Postcondition: A true or false value is returned. A true shows the
 	*                switch is closed; a false shows it is open.
 	*********************************************************************/
 	char JointMove::CheckSwitch(void)
 	{
-		*(ComPort) << 'I';
-		char SwitchCheck = ComPort->getChar();
-		SwitchCheck -= 32;
-		return SwitchCheck & this->SwitchMask;
+		double      Asked    = MonotonicSeconds();
+		SwitchState Switches = SwitchPoller::For(this->ComPort).Read();
+		if (Switches.Failed)
+		{
+			Trace(teSTALLED, this->JointToMove, -1);
+			this->Stop();
+			throw StalledMovementException(this->JointToMove, -1, MonotonicSeconds() - Asked,
+			                               this->ComPort->getTimeout() / 1000.0);
+		}
+		return Switches.Bits & this->SwitchMask;
 	}
 
 	/********************************************************************
@@ -101,9 +151,15 @@ namespace TLeyson_Robot
 	* Postcondition: AngularPosition will be converted into the number of
 	*                ticks the robot needs to move, rounded to the nearest
 	*                whole number.
+	* Throws:        BoundaryViolationException, if the position is more
+	*                than RobotConfig::TICK_LIMIT ticks from home.
 	*********************************************************************/
 	int JointMove::Round(double TickPosition)
 	{
+		// Written so that a NaN fails it too.
+		if ( !(std::abs(TickPosition) <= RobotConfig::TICK_LIMIT) )
+			throw BoundaryViolationException();
+
 		int    TruncatedPosition = static_cast<int>(TickPosition);
 		double DecimalPart       = TickPosition - TruncatedPosition;
 
@@ -124,39 +180,16 @@ namespace TLeyson_Robot
 	}
 
 	/********************************************************************
-	*                    JointMove::ReadFile
-	* Takes a file name, searches for the current motor letter in that
-	* file, and reads out a number separated from the letter by
-	* whitespace. The number must terminate with a newline. Returns a
-	* string containing the number, which can be converted to a float 
-	* or an int using atof or atoi.
-	* Precondition:  Filename is a valid file which contains letters,
-	*                representing motors, followed by a single tab or
-	*                space, and a number.
-	* Postcondition: The number will be read into a string and returned.
+	*                     JointMove::CheckAngle
+	* Move's checks of an angle, made without moving: the bounds, then
+	* the rounding, for the distance from home.
+	* Throws:        BoundaryViolationException.
 	********************************************************************/
-	std::string JointMove::ReadFile(char* Filename)
+	void JointMove::CheckAngle(double AngularPosition)
 	{
-		std::ifstream infile;
-		std::string   number;
-		char CurrentPosition;
-
-		infile.open(Filename);
-
-		if (!infile.is_open())
-		{
-			throw TLeyson_Robot::FileNotFoundException(Filename);
-		}
-
-		while ( ( CurrentPosition = infile.get() ) != this->JointToMove )
-		{
-			if (infile.fail())
-				throw TLeyson_Robot::ValueNotFoundException(Filename);
-		}
-
-		std::getline(infile, number);
-		infile.close();
-		return number;
+		if ( !(AngularPosition > this->LowerBound && AngularPosition < this->UpperBound) )
+			throw BoundaryViolationException();
+		this->Round(this->ConvertToTicks(AngularPosition));
 	}
 
 	/********************************************************************
@@ -173,28 +206,123 @@ namespace TLeyson_Robot
 	}
 
 	/********************************************************************
-	*                    JointMove::DivideTicks
-	* Divides the ticks into groups according to the GROUP_SIZE constant
-	* in the class. 
-	* Precondition:  NumberOfTicks is a rounded number of ticks.
-	* Postcondition: A vector with the number of whole groups of size
-	*                GROUP_SIZE and the final, non-uniform group will
-	*                be returned to the calling process.
+	*                    JointMove::QueryRegister
+	* Sends the register query and returns the number of ticks left in
+	* the joint's register. Every reading is handed to the drain model,
+	* stamped halfway through the round trip.
+	* Precondition:  QueryString is the "<joint>?" command.
+	* Postcondition: The register value is returned.
+	*********************************************************************/
+	int JointMove::QueryRegister(char* QueryString)
+	{
+		this->AskRegister(QueryString);
+		return this->CollectRegister();
+	}
+
+	/********************************************************************
+	*                    JointMove::AskRegister
+	*                    JointMove::CollectRegister
+	* QueryRegister in two halves, so that several joints' queries can
+	* be on the line at once: AskRegister sends the query through the
+	* port's query pipeline (see tserial.h) without waiting, and
+	* CollectRegister waits for that reply. Each AskRegister must be
+	* followed by one CollectRegister before the joint asks again.
+	* CollectRegister is also the joint's watchdog: every reading passes
+	* through it, so it stops the joint and throws
+	* StalledMovementException if the robot didn't answer within the
+	* port's timeout, or if the drain model finds the register stuck
+	* (see DrainModel::Stalled). Neither costs a byte on the line.
 	*********************************************************************/
-	std::vector<int> JointMove::DivideTicks(int NumberOfTicks)
+	void JointMove::AskRegister(char* QueryString)
 	{
-		// If the number of ticks is not divided evenly by the group size, we
-		// have a final, less than full, group.
-		unsigned int WholeGroups = NumberOfTicks / GROUP_SIZE;
+		this->QueryAsked = MonotonicSeconds();
+		Trace(teQUERY, this->JointToMove, '?');
+		this->QueryTicket = this->ComPort->sendQuery(QueryString, int(strlen(QueryString)));
+	}
 
-		std::vector<int> TickGroups;  // The vector needs to hold the number of groups and the odd group.
+	int JointMove::CollectRegister(void)
+	{
+		char RegisterValue = abs(this->ComPort->getReply(this->QueryTicket));
+		double Answered = MonotonicSeconds();
+		if (this->ComPort->timedOut())
+		{
+			Trace(teSTALLED, this->JointToMove, -1);
+			this->Stop();
+			throw StalledMovementException(this->JointToMove, -1, Answered - this->QueryAsked,
+			                               this->ComPort->getTimeout() / 1000.0);
+		}
+		RegisterValue -= 32;
+		Trace(teRESPONSE, this->JointToMove, RegisterValue);
+		TraceLatency(this->JointToMove, tmQUERY_ROUND_TRIP, Answered - this->QueryAsked);
+		this->Drain.Observe(RegisterValue, (this->QueryAsked + Answered) / 2);
+		this->State.Observed(this->Drain, (this->QueryAsked + Answered) / 2);
+		if (this->Drain.Stalled())
+		{
+			double Stuck = this->Drain.StuckFor();
+			double Limit = this->Drain.StallLimit();
+			Trace(teSTALLED, this->JointToMove, RegisterValue);
+			this->Stop();
+			throw StalledMovementException(this->JointToMove, RegisterValue, Stuck, Limit);
+		}
+		return RegisterValue;
+	}
 
-		TickGroups.push_back(WholeGroups);
+	/********************************************************************
+	*                    JointMove::AwaitReplenish
+	* Returns once the register has drained to the Replenish level, so
+	* that the next group can be sent.
+	*   POLLED:     query, then sleep POLL_INTERVAL ms and query again until the
+	*               register is low enough.
+	*   PREDICTIVE: once a drain rate is known, sleep until the model
+	*               says the register crosses Replenish and return
+	*               without a query; every CORRECTION_INTERVAL groups,
+	*               query anyway and, while the register is still too
+	*               full, sleep for exactly as long as it should take.
+	* If Refilling, a whole group has already gone out in this move, so
+	* a first reading of zero means the joint ran dry waiting for the
+	* next: it is counted as a starvation and traced.
+	* Precondition:  QueryString is the "<joint>?" command.
+	* Postcondition: The register is at or below Replenish, or is
+	*                predicted to be.
+	* Throws:        StalledMovementException, from CollectRegister.
+	*********************************************************************/
+	void JointMove::AwaitReplenish(char* QueryString, bool Refilling)
+	{
+		bool   Predictive = this->FlowMode == PREDICTIVE && this->Drain.Calibrated();
+		double Entered    = MonotonicSeconds();
+
+		if (Predictive && ++this->GroupsSinceQuery < CORRECTION_INTERVAL)
+		{
+			Trace(teSLEEP_BEGIN, this->JointToMove);
+			SwitchPoller::SleepUntil(this->ComPort, this->Drain.TimeToReach(this->Replenish, Entered));
+			Trace(teSLEEP_END, this->JointToMove);
+			TraceLatency(this->JointToMove, tmTIME_TO_REPLENISH, MonotonicSeconds() - Entered);
+			return;
+		}
+		this->GroupsSinceQuery = 0;
 
-		if ( NumberOfTicks % GROUP_SIZE != 0 )
-			TickGroups.push_back(NumberOfTicks % GROUP_SIZE);
+		int RegisterValue = this->QueryRegister(QueryString);
+		if (Refilling && RegisterValue == 0)
+		{
+			Trace(teSTARVED, this->JointToMove, 0);
+			this->Starvations++;
+		}
 
-		return TickGroups;
+		// Note: I'm a little worried that if the register weren't below
+		// the replenish level, the program would just move on and skip a
+		// group. However, the register seems to run down pretty fast, so it
+		// might never be a problem.
+		// Actually it was a problem, but it's been solved.
+		while ( RegisterValue > int(this->Replenish) )
+		{
+			Trace(teSLEEP_BEGIN, this->JointToMove);
+			double Wake = Predictive ? this->Drain.TimeToReach(this->Replenish, MonotonicSeconds())
+			                         : MonotonicSeconds() + POLL_INTERVAL / 1000.0;
+			SwitchPoller::SleepUntil(this->ComPort, Wake);
+			Trace(teSLEEP_END, this->JointToMove);
+			RegisterValue = this->QueryRegister(QueryString);
+		}
+		TraceLatency(this->JointToMove, tmTIME_TO_REPLENISH, MonotonicSeconds() - Entered);
 	}
 
 	/*******************************************************************
@@ -216,6 +344,10 @@ namespace TLeyson_Robot
 		else if (this->CurrentPosition == AngularPosition)
 			return 0;
 		
+		// Instances sharing the com port take turns, whichever thread they run on.
+		std::lock_guard<std::mutex> PortHeld(PortWorker::Lock(this->ComPort));
+		double Started = MonotonicSeconds();
+
 		// Find out how far the desired position is from home (in ticks), then find out how
 		// far that is from where you are
 		int    DesiredPosition      = this->Round(this->ConvertToTicks(AngularPosition));
@@ -229,53 +361,34 @@ namespace TLeyson_Robot
 		// This means that whatever we define HomePosition to be, everything greater
 		// than it is always one way and everything smaller is always the other way.
 		char MovementDirection = AngularPosition > this->CurrentPosition ? '+' : '-';
-		char Newline[ ]  = {0x0A, 0x0D, '\0'};
-		// A joint, a direction, 4 possible digits, and two newline characters plus a null = 9 spaces.
-		char EvenCommand    [9] = {this->JointToMove, MovementDirection, '\0'};
-		char UnevenCommand  [9] = {this->JointToMove, MovementDirection, '\0'};
-		char TickString[4];  // With this length, we can do up to 9999 ticks, which is 6.666 * Pi radians
-		std::vector<int> TickGroups = this->DivideTicks(abs(TotalTicks));
+		// However long the move, it goes out as whole groups and one odd group,
+		// each small enough for the register.
+		unsigned int Ticks       = (unsigned int) abs(TotalTicks);
+		unsigned int WholeGroups = Ticks / this->GroupSize;
+		unsigned int OddGroup    = Ticks % this->GroupSize;
+		char QueryString[] = {this->JointToMove, '?', 0x0A, 0x0D, '\0'};
+		Trace(teMOVE_BEGIN, this->JointToMove, TotalTicks);
 
 		// First send the uneven group, if there is one.
-		if ( TickGroups.size() == 2 )
+		if (OddGroup)
 		{
-			int OddGroup = TickGroups.back();
-			TickGroups.pop_back();	
-			// Convert the odd group to an integer and concatenate to the command string.
-			_itoa_s(OddGroup, TickString, 4, 10);
-			strcat_s(UnevenCommand, 9, TickString);
-			(*ComPort) << UnevenCommand;
-			(*ComPort) << Newline;
+			SendTicks(*ComPort, this->JointToMove, MovementDirection, OddGroup);
+			Trace(teCOMMAND, this->JointToMove, OddGroup);
+			this->Sent(MovementDirection, OddGroup, MonotonicSeconds());
 		}
 
-		// Assemble a command string with the size of a normal group.
-		_itoa_s(GROUP_SIZE, TickString, 4, 10);
-		strcat_s(EvenCommand, 9, TickString);
-		char QueryString[] = {this->JointToMove, '?', 0x0A, 0x0D, '\0'};
-		char StopString [] = {this->JointToMove, 'X', ';', 0x0A, 0x0D, '\0'};
-
-		// Now send the whole groups, using the string assembled above.
-		for ( unsigned int k = TickGroups.front(); k > 0; k-- )
+		// Now send the whole groups. The register is always read back
+		// before the first one.
+		this->GroupsSinceQuery = CORRECTION_INTERVAL;
+		for ( unsigned int k = WholeGroups; k > 0; k-- )
 		{
-			(*ComPort) << QueryString;
-			char RegisterValue = abs(ComPort->getChar());
-			RegisterValue -= 32;
-
-		// Note: I'm a little worried that if the register weren't below
-		// the replenish level, the program would just move on and skip a
-		// group. However, the register seems to run down pretty fast, so it
-		// might never be a problem.
-		// Actually it was a problem, but it's been solved.
-			while ( RegisterValue > REPLENISH )
-			{
-				Sleep(10);
-				(*ComPort) << QueryString;
-				RegisterValue = abs(ComPort->getChar());
-				RegisterValue -= 32;
-			}
-			(*ComPort) << EvenCommand;
-			(*ComPort) << Newline;
+			this->AwaitReplenish(QueryString, k < WholeGroups);
+			SendTicks(*ComPort, this->JointToMove, MovementDirection, this->GroupSize);
+			Trace(teCOMMAND, this->JointToMove, this->GroupSize);
+			this->Sent(MovementDirection, this->GroupSize, MonotonicSeconds());
 		}
+		Trace(teMOVE_END, this->JointToMove, TotalTicks);
+		TraceLatency(this->JointToMove, tmMOVE_DURATION, MonotonicSeconds() - Started);
 
 		this->HomeDeviation = DesiredPosition;
 		this->CurrentPosition = AngularPosition;
@@ -283,6 +396,108 @@ namespace TLeyson_Robot
 		return 0;
 	}
 
+	/********************************************************************
+	*                    JointMove::TimeDrain
+	* Polls the register until it is empty and returns the drain rate,
+	* in ticks per second, between the first and the last non-empty
+	* readings, or 0 if there weren't two.
+	*********************************************************************/
+	double JointMove::TimeDrain(char* QueryString)
+	{
+		double FirstTime = 0, LastTime = 0;
+		int    FirstValue = 0, LastValue = 0;
+		int    RegisterValue;
+
+		while ( (RegisterValue = this->QueryRegister(QueryString)) > 0 )
+		{
+			double Now = MonotonicSeconds();
+			if (FirstValue == 0)
+			{
+				FirstTime  = Now;
+				FirstValue = RegisterValue;
+			}
+			LastTime  = Now;
+			LastValue = RegisterValue;
+			SleepUntil(Now + POLL_INTERVAL / 1000.0);
+		}
+
+		if (LastTime <= FirstTime || LastValue >= FirstValue)
+			return 0;
+		return (FirstValue - LastValue) / (LastTime - FirstTime);
+	}
+
+	/********************************************************************
+	*                    JointMove::Calibrate
+	* Measures the joint and sizes its tick groups to suit it.
+	*   1. Times CALIBRATION_QUERIES register queries on the idle joint
+	*      and keeps the slowest.
+	*   2. Sends CALIBRATION_TICKS forward and times the register as it
+	*      drains, then sends them back and times that too.
+	*   3. While the next group is being asked for, the register keeps
+	*      draining for up to a poll interval, a query and a command; the
+	*      command is no longer than two queries. Replenish is that many
+	*      ticks plus half again, and the group is whatever room is left
+	*      in the register: the larger the group, the fewer queries the
+	*      line has to carry per tick.
+	* Precondition:  The joint is stopped and can move CALIBRATION_TICKS
+	*                in the positive direction.
+	* Postcondition: GroupSize and Replenish are set and the drain model
+	*                is primed. The joint's settings are returned.
+	* Throws:        CalibrationFailedException, if the joint didn't move
+	*                or drains too fast for this line to keep its
+	*                register filled.
+	*********************************************************************/
+	JointConfig JointMove::Calibrate(void)
+	{
+		char QueryString[] = {this->JointToMove, '?', 0x0A, 0x0D, '\0'};
+
+		std::lock_guard<std::mutex> PortHeld(PortWorker::Lock(this->ComPort));
+
+		// Let anything still queued run out, so the joint starts idle.
+		this->TimeDrain(QueryString);
+
+		double RoundTrip = 0;
+		for (unsigned int k = 0; k < CALIBRATION_QUERIES; k++)
+		{
+			double Asked = MonotonicSeconds();
+			this->QueryRegister(QueryString);
+			if (MonotonicSeconds() - Asked > RoundTrip)
+				RoundTrip = MonotonicSeconds() - Asked;
+		}
+
+		SendTicks(*ComPort, this->JointToMove, '+', CALIBRATION_TICKS);
+		Trace(teCOMMAND, this->JointToMove, CALIBRATION_TICKS);
+		this->Sent('+', CALIBRATION_TICKS, MonotonicSeconds());
+		double Outward = this->TimeDrain(QueryString);
+
+		SendTicks(*ComPort, this->JointToMove, '-', CALIBRATION_TICKS);
+		Trace(teCOMMAND, this->JointToMove, CALIBRATION_TICKS);
+		this->Sent('-', CALIBRATION_TICKS, MonotonicSeconds());
+		double Inward = this->TimeDrain(QueryString);
+
+		double TicksPerSecond = Outward > Inward ? Outward : Inward;
+		double Exposure       = POLL_INTERVAL / 1000.0 + 3 * RoundTrip;
+		double Needed         = std::ceil(1.5 * TicksPerSecond * Exposure);
+
+		// Leave room for a group at least as large as the replenish level.
+		if (TicksPerSecond <= 0 || Needed > RobotConfig::REGISTER_LIMIT / 2)
+			throw CalibrationFailedException();
+
+		this->Replenish = Needed < 1 ? 1 : (unsigned int) Needed;
+		this->GroupSize = RobotConfig::REGISTER_LIMIT - this->Replenish;
+
+		JointConfig Settings;
+		Settings.Present      = true;
+		Settings.Resolution   = this->Resolution;
+		Settings.LowerBound   = this->LowerBound;
+		Settings.UpperBound   = this->UpperBound;
+		Settings.HomePosition = this->HomePosition;
+		Settings.SwitchMask   = this->SwitchMask;
+		Settings.GroupSize    = this->GroupSize;
+		Settings.Replenish    = this->Replenish;
+		return Settings;
+	}
+
 	/********************************************************************
 	*                     JointMove::Home
 	* Tries to move the joint to the home position defined by the 
@@ -295,22 +510,220 @@ namespace TLeyson_Robot
 	*********************************************************************/
 	int JointMove::Home(void)
 	{
-		char Move[] = {this->JointToMove, '+', '2', '0', 0x0A, 0x0D, '\0'};
-		char Stop[] = {this->JointToMove, 'X', 0x0A, 0x0D, '\0'};
-		char SwitchStatus = this->CheckSwitch();
+		return HomeAll(std::vector<JointMove*>(1, this));
+	}
+
+	void JointMove::Nudge(char Direction, unsigned int Ticks)
+	{
+		SendTicks(*(this->ComPort), this->JointToMove, Direction, Ticks);
+		Trace(teCOMMAND, this->JointToMove, Ticks);
+		this->Sent(Direction, Ticks, MonotonicSeconds());
+	}
 
-		while (!PortFree);
+	// Books ticks just written for the joint with the drain model and the
+	// estimator, in that order.
+	void JointMove::Sent(char Direction, unsigned int Ticks, double When)
+	{
+		this->Drain.Sent(Ticks, When);
+		this->State.Sent(Direction == '+' ? int(Ticks) : -int(Ticks), this->Drain, When);
+	}
 
-		PortFree = false;
-		while (SwitchStatus)
+	// Stopping a joint empties its register.
+	void JointMove::Stop(void)
+	{
+		SendCommand(*(this->ComPort), this->JointToMove, 'X');
+		this->State.Stopped(this->Drain, MonotonicSeconds());
+		this->Drain.Reset();
+	}
+
+	/********************************************************************
+	*                     JointMove::HomeAll
+	* Runs every joint's search at once, in cycles of HOME_POLL_INTERVAL:
+	* one read of each port's switches (see SwitchPoller.h), pipelined
+	* with whatever register queries the approach needs, then a command for each joint still
+	* searching, all sent in one write per port.
+	*   Approach: keep HOME_STEP ticks coming, refilled when the register
+	*             is down to HOME_REFILL, until the switch closes; then
+	*             stop at once. The joint has overshot by however far it
+	*             moved in the last cycle.
+	*   Back off: HOME_BACKOFF_STEP ticks the other way each cycle until
+	*             the switch opens again.
+	*   Creep:    HOME_CREEP_STEP ticks forward each cycle, slower than
+	*             the joint drains, until the switch closes. That edge
+	*             is the home position.
+	* A joint with no switch is already home. While approaching, the
+	* register is read back until the drain model has a rate, and after
+	* that only when the model says it is due for more ticks; backing off
+	* and creeping, every cycle, as the steps drain at once. Either way
+	* CollectRegister watches for a jam. A switch that doesn't change
+	* within HOME_SEARCH_TIME of backing off or creeping is a stall too,
+	* and so is a switch reading the robot never answers.
+	* Precondition:  As Home, for every joint.
+	* Postcondition: Every joint is at its switch, at HomePosition.
+	*********************************************************************/
+	int JointMove::HomeAll(const std::vector<JointMove*>& Joints)
+	{
+		enum home_phase {hpAPPROACH, hpBACK_OFF, hpCREEP, hpDONE};
+
+		std::vector<Tserial*> Ports;
+		for (size_t j = 0; j < Joints.size(); j++)
+			Ports.push_back(Joints[j]->ComPort);
+		std::sort(Ports.begin(), Ports.end());
+		Ports.erase(std::unique(Ports.begin(), Ports.end()), Ports.end());
+		std::vector< std::unique_ptr< std::lock_guard<std::mutex> > > PortsHeld;
+		for (size_t p = 0; p < Ports.size(); p++)
+			PortsHeld.emplace_back(new std::lock_guard<std::mutex>(PortWorker::Lock(Ports[p])));
+
+		std::vector<home_phase> Phase(Joints.size(), hpAPPROACH);
+		std::vector<char>       Asked(Joints.size());
+		// When each joint began backing off, or creeping.
+		std::vector<double>     Began(Joints.size());
+		size_t Searching = Joints.size();
+		for (size_t j = 0; j < Joints.size(); j++)
 		{
-			//std::cout << Move << std::endl;
-			*(this->ComPort) << Move;
-			Sleep(300);
-			SwitchStatus = this->CheckSwitch();
+			Trace(teHOME_BEGIN, Joints[j]->JointToMove);
+			if (!Joints[j]->SwitchMask)
+			{
+				Phase[j] = hpDONE;
+				Searching--;
+			}
 		}
-		*(this->ComPort) << Stop;
-		PortFree = true;
+
+		double Cycle = MonotonicSeconds();
+		while (Searching > 0)
+		{
+			for (size_t p = 0; p < Ports.size(); p++)
+			{
+				size_t First = 0;
+				while (Joints[First]->ComPort != Ports[p])
+					First++;
+
+				// The register queries for joints the drain model can't vouch
+				// for go out with the I query, in one write, and their
+				// replies follow the switches'.
+				PortBatch Batch(Ports[p]);
+				for (size_t j = First; j < Joints.size(); j++)
+				{
+					JointMove& Joint = *Joints[j];
+					Asked[j] = Joint.ComPort == Ports[p] && Phase[j] != hpDONE
+					        && (Phase[j] != hpAPPROACH || !Joint.Drain.Calibrated()
+					            || Joint.Drain.Predict(MonotonicSeconds()) <= HOME_REFILL);
+					if (Asked[j])
+					{
+						char QueryString[] = {Joint.JointToMove, '?', 0x0A, 0x0D, '\0'};
+						Joint.AskRegister(QueryString);
+					}
+				}
+
+				// Anything read since the last cycle is new enough; anything
+				// older is sent for again. If the robot doesn't answer, no
+				// joint on the port can tell where its switch is, so they
+				// all stop.
+				double      Polled  = MonotonicSeconds();
+				SwitchState Reading = SwitchPoller::For(Ports[p]).Read(HOME_POLL_INTERVAL / 2000.0);
+				if (Reading.Failed)
+				{
+					double Waited = MonotonicSeconds() - Polled;
+					char   Lost   = 0;
+					for (size_t j = First; j < Joints.size(); j++)
+						if (Joints[j]->ComPort == Ports[p] && Phase[j] != hpDONE)
+						{
+							Trace(teSTALLED, Joints[j]->JointToMove, -1);
+							Joints[j]->Stop();
+							if (!Lost)
+								Lost = Joints[j]->JointToMove;
+						}
+					throw StalledMovementException(Lost, -1, Waited, Ports[p]->getTimeout() / 1000.0);
+				}
+				char Switches = Reading.Bits;
+
+				for (size_t j = First; j < Joints.size(); j++)
+				{
+					JointMove& Joint = *Joints[j];
+					if (Joint.ComPort != Ports[p] || Phase[j] == hpDONE)
+						continue;
+
+					// A set bit means the switch is still open.
+					bool   Open   = (Switches & Joint.SwitchMask) != 0;
+					double Queued = Asked[j] ? Joint.CollectRegister()
+					                         : Joint.Drain.Predict(MonotonicSeconds());
+					double Now    = MonotonicSeconds();
+					if (Phase[j] != hpAPPROACH && Now - Began[j] > HOME_SEARCH_TIME / 1000.0)
+					{
+						Trace(teSTALLED, Joint.JointToMove, int(Queued));
+						Joint.Stop();
+						throw StalledMovementException(Joint.JointToMove, int(Queued), Now - Began[j],
+						                               HOME_SEARCH_TIME / 1000.0);
+					}
+					switch (Phase[j])
+					{
+						case hpAPPROACH:
+							if (!Open)
+							{
+								Joint.Stop();
+								Phase[j] = hpBACK_OFF;
+								Began[j] = Now;
+							}
+							else if (Queued <= HOME_REFILL)
+								Joint.Nudge('+', HOME_STEP);
+							break;
+						case hpBACK_OFF:
+							if (Open)
+							{
+								Phase[j] = hpCREEP;
+								Began[j] = Now;
+							}
+							else
+								Joint.Nudge('-', HOME_BACKOFF_STEP);
+							break;
+						case hpCREEP:
+							if (!Open)
+							{
+								Joint.Stop();
+								Joint.HomeDeviation   = 0;
+								Joint.CurrentPosition = Joint.HomePosition;
+								Joint.State.Settle(0, MonotonicSeconds());
+								Phase[j] = hpDONE;
+								Searching--;
+								Trace(teHOME_END, Joint.JointToMove);
+							}
+							else
+								Joint.Nudge('+', HOME_CREEP_STEP);
+							break;
+						case hpDONE:
+							break;
+					}
+				}
+			}
+
+			Cycle += HOME_POLL_INTERVAL / 1000.0;
+			Trace(teSLEEP_BEGIN, Joints[0]->JointToMove);
+			SleepUntil(Cycle);
+			Trace(teSLEEP_END, Joints[0]->JointToMove);
+		}
+
+		for (size_t j = 0; j < Joints.size(); j++)
+			if (!Joints[j]->SwitchMask)
+				Trace(teHOME_END, Joints[j]->JointToMove);
 		return 0;
 	}
+
+	/********************************************************************
+	*                     JointMove::MoveAsync
+	*                     JointMove::HomeAsync
+	* Queue Move or Home on the I/O thread of the joint's com port and
+	* return without waiting. The instance must outlive the returned
+	* future.
+	*********************************************************************/
+	std::future<int> JointMove::MoveAsync(double AngularPosition, Completion Done)
+	{
+		return PortWorker::For(this->ComPort).Submit(
+			[this, AngularPosition]() { return this->Move(AngularPosition); }, Done);
+	}
+
+	std::future<int> JointMove::HomeAsync(Completion Done)
+	{
+		return PortWorker::For(this->ComPort).Submit(
+			[this]() { return this->Home(); }, Done);
+	}
 } // End namespace TLeyson_Robot
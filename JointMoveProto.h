@@ -6,6 +6,11 @@
 #include <vector>
 #include <string>
 #include "tserial.h"
+#include "FlowControl.h"
+#include "StateEstimator.h"
+#include "PortWorker.h"
+#include "SwitchPoller.h"
+#include "RobotConfig.h"
 #include "GeneralExceptions.h"
 #include "MoveExceptions.h"
 
@@ -18,35 +23,118 @@
 *                     and resolution file.
 *      Postcondition: The joint will be moved the given angle.
 *      Throws:        BoundaryViolationException, if the given angle violates one of 
-*                     the boundaries.
+*                     the boundaries, or is further from home than the controller
+*                     can be sent (RobotConfig::TICK_LIMIT). A move of any length within
+*                     those limits is sent as groups of GroupSize ticks, without
+*                     allocating memory.
+*                     StalledMovementException, after stopping the joint, if its
+*                     register stops draining (see DrainModel::Stalled) or the
+*                     robot stops answering for the port's timeout, which is set
+*                     to REPLY_TIMEOUT ms if it has none. Home, HomeAll and
+*                     Calibrate throw it too, as do CoordinatedMove and
+*                     Trajectory. The watchdog only looks at register readings
+*                     the move takes anyway.
 * - int Home:
 *      Precondition:  The joint has a limit switch and has been moved to the negative
 *                     side of its switch.
 *      Postcondition: The joint will have moved until it hits the switch. This is
 *                     represented by the position passed into the constructor's 
 *                     HomePosition argument,which is zero by default.
+* - static int HomeAll(const std::vector<JointMove*>& Joints):
+*      Homes several joints at once. Each cycle reads the I byte once per port, for
+*      every joint's switch, and nudges each joint still looking for its switch.
+*      A joint runs at full speed until its switch closes, then stops, backs off
+*      until it opens and creeps back a tick at a time, so the home position is
+*      found to a tick. Home is HomeAll for one joint. A joint whose switch hasn't
+*      changed after HOME_SEARCH_TIME ms of backing off, or of creeping back, is
+*      stopped and StalledMovementException thrown, as is every joint on a port
+*      whose switch reading the robot doesn't answer.
+* - void CheckAngle(double AngularPosition):
+*      Throws BoundaryViolationException if Move would, for the angle's bounds or
+*      its distance from home, without sending anything.
+* - std::future<int> MoveAsync(double AngularPosition, Completion Done):
+* - std::future<int> HomeAsync(Completion Done):
+*      Queue Move or Home on the I/O thread that owns the joint's Tserial (see
+*      PortWorker.h) and return at once. The future holds the result, or the
+*      BoundaryViolationException; Done, if given, is called on the I/O thread
+*      when the motion has been sent.
+* - void SetFlowControl(flow_control Mode):
+*      POLLED (the default) queries the register before every group and re-queries
+*      every 10 ms until it has drained to the replenish level. PREDICTIVE learns
+*      the joint's drain rate from those queries, sends each group at the moment
+*      the register is expected to reach the replenish level, and only queries
+*      every few groups to correct drift.
+* - JointEstimate ViewEstimate(void):
+*      Where the joint is now and how fast it is going, while the ticks already
+*      sent run out (see StateEstimator.h). ViewCurrentPosition is where it was
+*      last sent, and changes as soon as the last group is written. ViewEstimate
+*      takes no lock and may be called from any thread.
+* - void PublishTo(JointStateBoard& Board):
+*      Publishes the estimate to the joint's slot on Board from now on, so other
+*      processes can read it too.
+*      Precondition:  The joint isn't moving, and Board was made with Create.
+* - JointMove(char Joint, const RobotConfig& Config, Tserial* Port, bool LimitSwitch):
+*      Takes the joint's bounds, home position, resolution, switch mask and group
+*      sizes from a RobotConfig (see RobotConfig.h), and homes the joint if
+*      LimitSwitch is set and the joint has a switch.
+*      Throws:        ValueNotFoundException, if Config has no such joint.
+* - JointConfig Calibrate(void):
+*      Precondition:  The joint is stopped and free to move CALIBRATION_TICKS in the
+*                     positive direction and back.
+*      Postcondition: The joint is back where it started. Its register round trip
+*                     and drain rate have been measured and its group size and
+*                     replenish level chosen from them: the replenish level covers
+*                     the ticks drained while the next group is requested and sent,
+*                     and the group fills the rest of the register. The joint's
+*                     settings are returned, to be kept with RobotConfig::Set and
+*                     RobotConfig::Save.
+*      Throws:        CalibrationFailedException, if no usable drain rate was seen or
+*                     the register can't be kept filled at this line speed.
 * It also contains the constant PI, which is calculated to 30 places, for use in 
 * radian angles.
 *************************************************************************************/
 namespace TLeyson_Robot
 {
-	const double PI = 3.1415926535897932384626433832795;
+	constexpr double PI = 3.1415926535897932384626433832795;
 
 	enum joint {A=65, B, C, D, E, F, G, H};
 
+	enum flow_control {POLLED, PREDICTIVE};
+
 	class JointMove
 	{
+		// Interleaves the tick groups of several joints, so it needs the
+		// same view of a joint's position and register that Move has.
+		friend class CoordinatedMove;
+		friend class Trajectory;
+		friend class MotionReplay;
+		friend class RobotCell;
+		friend class MotionScheduler;
+
 		public:
 			JointMove(char Joint, double UpperBound, double LowerBound, char* ResolutionFile,
 					  Tserial* Port, bool LimitSwitch = true, double HomePosition = 0);
+			JointMove(char Joint, const RobotConfig& Config, Tserial* Port, bool LimitSwitch = true);
 
 			int  Move(double AngularPosition);
 			int  Home(void);
+			static int HomeAll(const std::vector<JointMove*>& Joints);
+			std::future<int> MoveAsync(double AngularPosition, Completion Done = Completion());
+			std::future<int> HomeAsync(Completion Done = Completion());
+			void SetFlowControl(flow_control Mode) { this->FlowMode = Mode; }
+			JointConfig Calibrate(void);
+			void CheckAngle(double AngularPosition);
 
 			char   ViewJoint          (void) const { return this->JointToMove; }
 			double ViewUpperBound     (void) const { return this->UpperBound; } 
 			double ViewLowerBound     (void) const { return this->LowerBound; }
 			double ViewCurrentPosition(void) const { return this->CurrentPosition; }
+			flow_control ViewFlowControl(void) const { return this->FlowMode; }
+			JointEstimate ViewEstimate(void) const { return this->State.Estimate(MonotonicSeconds()); }
+			void PublishTo(JointStateBoard& Board) { this->State.Attach(Board.Slot(this->JointToMove)); }
+			// Readings that found the register empty mid-move: the joint stopped
+			// for want of ticks, so its groups are being sent too slowly.
+			unsigned int ViewStarvations(void) const { return this->Starvations; }
 		private:
 		// Attributes
 			char   JointToMove;
@@ -65,19 +153,54 @@ namespace TLeyson_Robot
 			// The mask to use when testing the limit switch.
 			char SwitchMask;
 			// The size of a single group of ticks sent to the robot at one time.
-			const static unsigned int GROUP_SIZE = 50;
+			unsigned int GroupSize;
 			// The number of ticks remaining when we send the next group in.
-			const static unsigned int REPLENISH = 15;
-			// The variable that lets different instances share the com port.
-			static bool PortFree;
+			unsigned int Replenish;
+			// How register replenishment is paced, and the drain rate it learns.
+			flow_control FlowMode;
+			DrainModel   Drain;
+			// Where the joint really is, published for other threads.
+			StateEstimator State;
+			// In PREDICTIVE mode, the register is read back once every this many groups.
+			const static unsigned int CORRECTION_INTERVAL = 4;
+			unsigned int GroupsSinceQuery;
+			// The pipeline ticket of the register query last sent, and when.
+			unsigned int QueryTicket;
+			double       QueryAsked;
+			// Counted by AwaitReplenish, and by RobotCell.
+			unsigned int Starvations;
+			// Milliseconds the port waits for a reply, unless already set otherwise.
+			const static int REPLY_TIMEOUT = 1000;
+			// Milliseconds between register queries while waiting in POLLED mode.
+			const static unsigned int POLL_INTERVAL = 10;
+			// HomeAll's cycle in milliseconds, the ticks sent while approaching
+			// the switch, the register level at which more are sent, and the
+			// steps taken backing off and creeping back.
+			const static unsigned int HOME_POLL_INTERVAL = 20;
+			const static unsigned int HOME_STEP          = 20;
+			const static unsigned int HOME_REFILL        = 5;
+			const static unsigned int HOME_BACKOFF_STEP  = 2;
+			const static unsigned int HOME_CREEP_STEP    = 1;
+			// Milliseconds backing off, or creeping back, before the switch
+			// must have changed: ten times what the approach can overshoot.
+			const static unsigned int HOME_SEARCH_TIME   = 2000;
+			// Ticks moved out and back by Calibrate, and register queries timed.
+			const static unsigned int CALIBRATION_TICKS   = 90;
+			const static unsigned int CALIBRATION_QUERIES = 8;
 
 		// Private helper methods
-			std::string                      ReadFile      (char*  Filename);
+			void                             Configure     (const JointConfig& Settings);
 			double                           ConvertToTicks(double AngularPosition);
 			char                             CheckSwitch   (void);
 			int                              Round         (double TickPosition);
-
-			std::vector<int>                 DivideTicks   (int NumberOfTicks);
+			int                              QueryRegister (char*  QueryString);
+			void                             AskRegister   (char*  QueryString);
+			int                              CollectRegister(void);
+			void                             AwaitReplenish(char*  QueryString, bool Refilling);
+			double                           TimeDrain     (char*  QueryString);
+			void                             Nudge         (char   Direction, unsigned int Ticks);
+			void                             Sent          (char   Direction, unsigned int Ticks, double When);
+			void                             Stop          (void);
 	};
 }
 #endif
\ No newline at end of file
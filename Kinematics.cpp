@@ -0,0 +1,177 @@
+#include <cmath>
+#include <vector>
+#include "Kinematics.h"
+#include "CoordinatedMove.h"
+#include "MoveExceptions.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		const double QUARTER_TURN = PI / 2;
+	}
+
+	ArmGeometry::ArmGeometry(void)
+	{
+		this->BaseHeight = 0.263;
+		this->UpperArm   = 0.2286;
+		this->Forearm    = 0.2286;
+		this->Hand       = 0.165;
+	}
+
+	ArmKinematics::ArmKinematics(const ArmGeometry& Geometry, bool ElbowUp)
+	{
+		this->Geometry  = Geometry;
+		this->ElbowSign = ElbowUp ? -1 : 1;
+	}
+
+	ArmPose ArmKinematics::Forward(const ArmAngles& Angles) const
+	{
+		const ArmGeometry& G = this->Geometry;
+		double Elbow = Angles.Shoulder + Angles.Elbow;
+		double Tool  = Elbow + Angles.Wrist;
+		double Reach = G.UpperArm * std::cos(Angles.Shoulder) + G.Forearm * std::cos(Elbow)
+		             + G.Hand * std::cos(Tool);
+
+		ArmPose Pose;
+		Pose.X     = Reach * std::cos(Angles.Waist);
+		Pose.Y     = Reach * std::sin(Angles.Waist);
+		Pose.Z     = G.BaseHeight + G.UpperArm * std::sin(Angles.Shoulder) + G.Forearm * std::sin(Elbow)
+		           + G.Hand * std::sin(Tool);
+		Pose.Pitch = Tool;
+		return Pose;
+	}
+
+	bool ArmKinematics::Inverse(const ArmPose& Target, ArmAngles& Angles) const
+	{
+		unsigned char Reachable;
+		this->InverseBatch(1, &Target.X, &Target.Y, &Target.Z, &Target.Pitch,
+		                   &Angles.Waist, &Angles.Shoulder, &Angles.Elbow, &Angles.Wrist, &Reachable);
+		return Reachable != 0;
+	}
+
+	/********************************************************************
+	*                   ArmKinematics::InverseBatch
+	* The waist turns to face the target; the wrist is then one hand's
+	* length back from the tool tip along Pitch, and the shoulder and
+	* elbow form a triangle with it, solved by the law of cosines. The
+	* arrays are read and written straight through, and the one case
+	* that could branch, a wrist out of reach, is clamped and flagged
+	* instead, so each pose is the same arithmetic. Built with -O3
+	* -ffast-math, GCC runs it four poses at a time on AVX2 (eight on
+	* AVX-512) through glibc's vector math library. The arrays must not
+	* overlap; with nine of them, the compiler won't check that itself.
+	********************************************************************/
+	void ArmKinematics::InverseBatch(size_t Count, const double* __restrict X, const double* __restrict Y,
+	                                 const double* __restrict Z, const double* __restrict Pitch,
+	                                 double* __restrict Waist, double* __restrict Shoulder,
+	                                 double* __restrict Elbow, double* __restrict Wrist,
+	                                 unsigned char* __restrict Reachable) const
+	{
+		const double Base  = this->Geometry.BaseHeight;
+		const double L1    = this->Geometry.UpperArm;
+		const double L2    = this->Geometry.Forearm;
+		const double L3    = this->Geometry.Hand;
+		const double Sign  = this->ElbowSign;
+		const double Scale = 1 / (2 * L1 * L2);
+		const double Sides = L1 * L1 + L2 * L2;
+
+		for (size_t i = 0; i < Count; i++)
+		{
+			// The sine is taken as a cosine, or the compiler fuses the two
+			// into a sincos call, which has no vector form and stops the
+			// whole loop being vectorized.
+			double Reach   = std::sqrt(X[i] * X[i] + Y[i] * Y[i]);
+			double WristR  = Reach - L3 * std::cos(Pitch[i]);
+			double WristZ  = Z[i] - Base - L3 * std::cos(Pitch[i] - QUARTER_TURN);
+			double Cosine  = (WristR * WristR + WristZ * WristZ - Sides) * Scale;
+
+			double Inside  = Cosine >= -1 && Cosine <= 1;
+			Cosine         = Cosine < -1 ? -1 : (Cosine > 1 ? 1 : Cosine);
+			double Sine    = Sign * std::sqrt(1 - Cosine * Cosine);
+			double Upper   = std::atan2(WristZ, WristR) - std::atan2(L2 * Sine, L1 + L2 * Cosine);
+			double Bend    = std::atan2(Sine, Cosine);
+
+			Waist[i]     = std::atan2(Y[i], X[i]);
+			Shoulder[i]  = Upper;
+			Elbow[i]     = Bend;
+			Wrist[i]     = Pitch[i] - Upper - Bend;
+			Reachable[i] = (unsigned char) Inside;
+		}
+	}
+
+	/********************************************************************
+	*                   Arm::Arm
+	* Precondition:  The four JointMoves are the waist, shoulder, elbow
+	*                and wrist pitch joints (F, E, D and C on the XR),
+	*                and outlive the Arm.
+	********************************************************************/
+	Arm::Arm(JointMove* Waist, JointMove* Shoulder, JointMove* Elbow, JointMove* Wrist,
+	         const ArmKinematics& Solver) : Solver(Solver)
+	{
+		this->Joints[0] = Waist;
+		this->Joints[1] = Shoulder;
+		this->Joints[2] = Elbow;
+		this->Joints[3] = Wrist;
+	}
+
+	bool Arm::Solve(const ArmPose& Target, ArmAngles& Angles) const
+	{
+		unsigned char Reachable;
+		this->SolveBatch(1, &Target.X, &Target.Y, &Target.Z, &Target.Pitch,
+		                 &Angles.Waist, &Angles.Shoulder, &Angles.Elbow, &Angles.Wrist, &Reachable);
+		return Reachable != 0;
+	}
+
+	void Arm::SolveBatch(size_t Count, const double* X, const double* Y, const double* Z,
+	                     const double* Pitch, double* Waist, double* Shoulder,
+	                     double* Elbow, double* Wrist, unsigned char* Reachable) const
+	{
+		this->Solver.InverseBatch(Count, X, Y, Z, Pitch, Waist, Shoulder, Elbow, Wrist, Reachable);
+
+		double* Angles[4] = {Waist, Shoulder, Elbow, Wrist};
+		for (int j = 0; j < 4; j++)
+		{
+			// The same test as Move, so a pose passed here is never refused there.
+			const double  Lower  = this->Joints[j]->ViewLowerBound();
+			const double  Upper  = this->Joints[j]->ViewUpperBound();
+			const double* Angle  = Angles[j];
+			for (size_t i = 0; i < Count; i++)
+				Reachable[i] &= (unsigned char) (Angle[i] > Lower && Angle[i] < Upper);
+		}
+	}
+
+	ArmPose Arm::Where(void) const
+	{
+		ArmAngles Angles;
+		Angles.Waist    = this->Joints[0]->ViewCurrentPosition();
+		Angles.Shoulder = this->Joints[1]->ViewCurrentPosition();
+		Angles.Elbow    = this->Joints[2]->ViewCurrentPosition();
+		Angles.Wrist    = this->Joints[3]->ViewCurrentPosition();
+		return this->Solver.Forward(Angles);
+	}
+
+	/********************************************************************
+	*                   Arm::MoveTo
+	* Solves for the pose and moves the four joints at once, so the tool
+	* arrives with every joint finishing together.
+	* Precondition:  The joints are connected to the robot and homed.
+	* Postcondition: The tool tip is at (X, Y, Z), pointing at Pitch.
+	* Throws:        BoundaryViolationException, with no joint moved,
+	*                if the pose can't be reached.
+	********************************************************************/
+	int Arm::MoveTo(double X, double Y, double Z, double Pitch)
+	{
+		ArmPose   Target = {X, Y, Z, Pitch};
+		ArmAngles Angles;
+		if (!this->Solve(Target, Angles))
+			throw BoundaryViolationException();
+
+		CoordinatedMove Together;
+		Together.Add(this->Joints[0], Angles.Waist);
+		Together.Add(this->Joints[1], Angles.Shoulder);
+		Together.Add(this->Joints[2], Angles.Elbow);
+		Together.Add(this->Joints[3], Angles.Wrist);
+		return Together.Execute();
+	}
+}
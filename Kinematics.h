@@ -0,0 +1,107 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <stddef.h>
+#include "JointMoveProto.h"
+
+/*************************************************************************************
+* Kinematics.h contains the geometry of the XR arm's positioning joints, waist (F),
+* shoulder (E), elbow (D) and wrist pitch (C), and class Arm, which moves them to a
+* point in space:
+*
+* - ArmPose ArmKinematics::Forward(const ArmAngles& Angles):
+*      Where the tool tip is, and the angle it points at, for the given joint angles.
+* - bool ArmKinematics::Inverse(const ArmPose& Target, ArmAngles& Angles):
+*      The joint angles that put the tool tip at Target. Returns false if Target is
+*      out of reach.
+* - void ArmKinematics::InverseBatch(...):
+*      Inverse for Count poses at once, each coordinate in its own array. The loop
+*      has no branches, so the compiler can run it several poses to a vector
+*      register.
+* - bool Arm::Solve(const ArmPose& Target, ArmAngles& Angles):
+*      Inverse, then a check of every angle against its JointMove's bounds.
+* - int Arm::MoveTo(double X, double Y, double Z, double Pitch):
+*      Moves the four joints to the solved angles together, with a CoordinatedMove.
+*      Throws:        BoundaryViolationException, if the point is out of reach or
+*                     any joint would pass one of its bounds.
+*
+* Distances are in metres, from the point on the floor below the waist axis, with
+* Z up and X along the arm when the waist is at 0. Angles are JointMove's, so each
+* joint's home position must be set to match: the shoulder angle is the upper arm's
+* elevation above horizontal, and the elbow and wrist angles are each relative to
+* the link before, 0 being straight on. Pitch is the tool's elevation above
+* horizontal, the sum of the last three.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	struct ArmGeometry
+	{
+		// Height of the shoulder axis above the base.
+		double BaseHeight;
+		// Shoulder to elbow, elbow to wrist, and wrist to tool tip.
+		double UpperArm;
+		double Forearm;
+		double Hand;
+
+		// The XR-4's nominal dimensions; measure your own arm if it matters.
+		ArmGeometry(void);
+	};
+
+	struct ArmPose
+	{
+		double X, Y, Z;
+		double Pitch;
+	};
+
+	struct ArmAngles
+	{
+		double Waist;
+		double Shoulder;
+		double Elbow;
+		double Wrist;
+	};
+
+	class ArmKinematics
+	{
+		public:
+			// ElbowUp picks the solution with the elbow above the line from
+			// shoulder to wrist, which keeps the forearm clear of the table.
+			ArmKinematics(const ArmGeometry& Geometry = ArmGeometry(), bool ElbowUp = true);
+
+			ArmPose Forward     (const ArmAngles& Angles) const;
+			bool    Inverse     (const ArmPose& Target, ArmAngles& Angles) const;
+			// Reachable[i] is 1 if pose i could be solved and 0 if not, in
+			// which case its angles mean nothing.
+			void    InverseBatch(size_t Count, const double* X, const double* Y, const double* Z,
+			                     const double* Pitch, double* Waist, double* Shoulder,
+			                     double* Elbow, double* Wrist, unsigned char* Reachable) const;
+
+			const ArmGeometry& ViewGeometry(void) const { return this->Geometry; }
+		private:
+			ArmGeometry Geometry;
+			// -1 for elbow up, +1 for elbow down.
+			double      ElbowSign;
+	};
+
+	class Arm
+	{
+		public:
+			Arm(JointMove* Waist, JointMove* Shoulder, JointMove* Elbow, JointMove* Wrist,
+			    const ArmKinematics& Solver = ArmKinematics());
+
+			bool    Solve     (const ArmPose& Target, ArmAngles& Angles) const;
+			// As ArmKinematics::InverseBatch, but a pose is only reachable if
+			// every angle is also within its joint's bounds.
+			void    SolveBatch(size_t Count, const double* X, const double* Y, const double* Z,
+			                   const double* Pitch, double* Waist, double* Shoulder,
+			                   double* Elbow, double* Wrist, unsigned char* Reachable) const;
+			ArmPose Where     (void) const;
+			int     MoveTo    (double X, double Y, double Z, double Pitch);
+
+			const ArmKinematics& ViewKinematics(void) const { return this->Solver; }
+		private:
+			JointMove*    Joints[4];
+			ArmKinematics Solver;
+	};
+}
+#endif
@@ -0,0 +1,112 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*************************************************************************************
+* MappedFile.h contains class MappedFile, which maps a file into memory for reading,
+* so that RobotConfig and MotionReplay read their files straight from the page
+* cache without copying them.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	/********************************************************************
+	* MappedFile: a read-only view of a whole file. Text is null and
+	* Length zero if the file is empty. Open returns false if the file
+	* can't be opened, sized or mapped, and leaves Length zero; Length
+	* is only set once the view exists.
+	********************************************************************/
+	class MappedFile
+	{
+		public:
+			MappedFile(void) : Text(0), Length(0)
+			{
+#ifdef _WIN32
+				this->File    = INVALID_HANDLE_VALUE;
+				this->Mapping = NULL;
+#endif
+			}
+
+			bool Open(const char* Filename)
+			{
+#ifdef _WIN32
+				this->File = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+				                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+				if (this->File == INVALID_HANDLE_VALUE)
+					return false;
+				// A size of INVALID_FILE_SIZE is only an error if GetLastError
+				// says so; one of 4 GB or more is never wanted here.
+				DWORD High = 0;
+				DWORD Size = GetFileSize(this->File, &High);
+				if (High != 0 || (Size == INVALID_FILE_SIZE && GetLastError() != NO_ERROR))
+					return false;
+				if (Size == 0)
+					return true;
+				this->Mapping = CreateFileMapping(this->File, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (!this->Mapping)
+					return false;
+				this->Text = (const char*) MapViewOfFile(this->Mapping, FILE_MAP_READ, 0, 0, 0);
+				if (!this->Text)
+					return false;
+				this->Length = Size;
+#else
+				int Descriptor = open(Filename, O_RDONLY | O_CLOEXEC);
+				struct stat Status;
+				if (Descriptor == -1)
+					return false;
+				if (fstat(Descriptor, &Status) != 0)
+				{
+					close(Descriptor);
+					return false;
+				}
+				if (Status.st_size > 0)
+				{
+					void* View = mmap(0, Status.st_size, PROT_READ, MAP_PRIVATE, Descriptor, 0);
+					if (View == MAP_FAILED)
+					{
+						close(Descriptor);
+						return false;
+					}
+					this->Text   = (const char*) View;
+					this->Length = size_t(Status.st_size);
+				}
+				close(Descriptor);
+#endif
+				return true;
+			}
+
+			~MappedFile()
+			{
+#ifdef _WIN32
+				if (this->Text)
+					UnmapViewOfFile(this->Text);
+				if (this->Mapping)
+					CloseHandle(this->Mapping);
+				if (this->File != INVALID_HANDLE_VALUE)
+					CloseHandle(this->File);
+#else
+				if (this->Text)
+					munmap((void*) this->Text, this->Length);
+#endif
+			}
+
+			const char* Text;
+			size_t      Length;
+		private:
+			MappedFile(const MappedFile&);
+			MappedFile& operator=(const MappedFile&);
+#ifdef _WIN32
+			HANDLE File;
+			HANDLE Mapping;
+#endif
+	};
+}
+#endif
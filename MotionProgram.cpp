@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <cmath>
+#include "MotionProgram.h"
+#include "GeneralExceptions.h"
+#include "MoveExceptions.h"
+#include "MotionTrace.h"
+#include "CommandEncoder.h"
+
+namespace TLeyson_Robot
+{
+	/********************************************************************
+	*                   MotionCompiler::Compile
+	* Builds the whole program in memory and only then writes it, so a
+	* bad line leaves any earlier Output alone.
+	********************************************************************/
+	void MotionCompiler::Compile(char* Source, char* Output)
+	{
+		MappedFile File;
+		if (!File.Open(Source))
+			throw FileNotFoundException(Source);
+
+		this->Joints.clear();
+		this->Steps.clear();
+		this->Frames.clear();
+		for (int j = 0; j < 8; j++)
+			this->QueryAt[j] = UINT32_MAX;
+
+		this->Parse(File.Text, File.Length, Source);
+		this->Write(Output);
+	}
+
+	/********************************************************************
+	*                   MotionCompiler::Parse
+	* Reads the program a line at a time, as RobotConfig::Parse reads a
+	* configuration, and compiles each move as it goes.
+	********************************************************************/
+	void MotionCompiler::Parse(const char* Text, size_t Length, char* Name)
+	{
+		int    Line   = 0;
+		size_t Offset = 0;
+
+		while (Offset < Length)
+		{
+			size_t End = Offset;
+			while (End < Length && Text[End] != '\n')
+				End++;
+			std::string Content(Text + Offset, End - Offset);
+			Offset = End + 1;
+			Line++;
+
+			size_t Comment = Content.find('#');
+			if (Comment != std::string::npos)
+				Content.erase(Comment);
+
+			std::vector<std::string> Tokens;
+			size_t Position = 0;
+			while (Position < Content.size())
+			{
+				while (Position < Content.size() && isspace((unsigned char) Content[Position]))
+					Position++;
+				size_t Start = Position;
+				while (Position < Content.size() && !isspace((unsigned char) Content[Position]))
+					Position++;
+				if (Position > Start)
+					Tokens.push_back(Content.substr(Start, Position - Start));
+			}
+			if (Tokens.empty())
+				continue;
+
+			char Letter = char(toupper((unsigned char) Tokens[0][0]));
+			if (Tokens.size() != 2 || Tokens[0].size() != 1 || !this->Config.Has(Letter))
+				throw MalformedConfigException(Name, Line);
+			const JointConfig& Settings = this->Config[Letter];
+
+			char*  Rest;
+			double Angle = strtod(Tokens[1].c_str(), &Rest);
+			if (*Rest != '\0')
+				throw MalformedConfigException(Name, Line);
+			// The same tests as Move.
+			if ( !(Angle > Settings.LowerBound && Angle < Settings.UpperBound)
+			     || !(std::abs(Angle / Settings.Resolution) <= RobotConfig::TICK_LIMIT) )
+				throw MalformedConfigException(Name, Line);
+
+			size_t j = 0;
+			while (j < this->Joints.size() && this->Joints[j].Letter != Letter)
+				j++;
+			if (j == this->Joints.size())
+			{
+				Program::Joint Added;
+				memset(&Added, 0, sizeof(Added));
+				Added.Letter   = Letter;
+				Added.EndAngle = Settings.HomePosition;
+				this->Joints.push_back(Added);
+
+				char Query[MAX_FRAME];
+				this->QueryAt[Letter - 'A'] = uint32_t(this->Frames.size());
+				this->Frames.append(Query, size_t(EncodeCommand(Query, Letter, '?')));
+			}
+
+			// Rounded half away from zero, as JointMove::Round does.
+			this->AddMove(this->Joints[j], Settings, int(std::lround(Angle / Settings.Resolution)));
+			this->Joints[j].EndAngle = Angle;
+		}
+	}
+
+	/********************************************************************
+	*                   MotionCompiler::AddMove
+	* The steps Move takes in POLLED mode: the odd group straight away,
+	* then each whole group once the register has drained to the
+	* replenish level.
+	********************************************************************/
+	void MotionCompiler::AddMove(Program::Joint& Moved, const JointConfig& Settings, int Target)
+	{
+		int TotalTicks = Target - Moved.End;
+		if (TotalTicks == 0)
+			return;
+
+		char         Direction   = TotalTicks > 0 ? '+' : '-';
+		unsigned int Ticks       = (unsigned int) abs(TotalTicks);
+		unsigned int WholeGroups = Ticks / Settings.GroupSize;
+		unsigned int OddGroup    = Ticks % Settings.GroupSize;
+		char         Command[MAX_FRAME];
+		int          Written;
+
+		if (OddGroup)
+		{
+			Written = EncodeTicks(Command, Moved.Letter, Direction, OddGroup);
+			this->Send(Command, size_t(Written));
+		}
+
+		Written = EncodeTicks(Command, Moved.Letter, Direction, Settings.GroupSize);
+		for (unsigned int k = 0; k < WholeGroups; k++)
+		{
+			Program::Step Await = {this->QueryAt[Moved.Letter - 'A'], 4, Program::psAWAIT,
+			                       uint8_t(Settings.Replenish)};
+			this->Steps.push_back(Await);
+			this->Send(Command, size_t(Written));
+		}
+		Moved.End = Target;
+	}
+
+	// Frames sent with nothing to wait for in between share one step,
+	// and so one write.
+	void MotionCompiler::Send(const char* Frame, size_t Length)
+	{
+		uint32_t Offset = uint32_t(this->Frames.size());
+		this->Frames.append(Frame, Length);
+
+		if (!this->Steps.empty())
+		{
+			Program::Step& Last = this->Steps.back();
+			if (Last.Kind == Program::psSEND && Last.Offset + Last.Length == Offset
+			    && Last.Length + Length <= 0xFFFF)
+			{
+				Last.Length = uint16_t(Last.Length + Length);
+				return;
+			}
+		}
+		Program::Step Added = {Offset, uint16_t(Length), Program::psSEND, 0};
+		this->Steps.push_back(Added);
+	}
+
+	// Through a temporary, as RobotConfig::Save.
+	void MotionCompiler::Write(char* Output) const
+	{
+		Program::Header Head;
+		memset(&Head, 0, sizeof(Head));
+		memcpy(Head.Magic, Program::MAGIC, sizeof(Head.Magic));
+		Head.Version    = Program::VERSION;
+		Head.JointCount = uint32_t(this->Joints.size());
+		Head.StepCount  = uint32_t(this->Steps.size());
+		Head.FrameBytes = uint32_t(this->Frames.size());
+
+		std::string Temporary = std::string(Output) + ".new";
+		FILE* Out = fopen(Temporary.c_str(), "wb");
+		if (!Out)
+			throw FileNotFoundException(Output);
+
+		fwrite(&Head, sizeof(Head), 1, Out);
+		if (!this->Joints.empty())
+			fwrite(&this->Joints[0], sizeof(Program::Joint), this->Joints.size(), Out);
+		if (!this->Steps.empty())
+			fwrite(&this->Steps[0], sizeof(Program::Step), this->Steps.size(), Out);
+		fwrite(this->Frames.data(), 1, this->Frames.size(), Out);
+
+		bool Written = !ferror(Out);
+		if (fclose(Out) != 0 || !Written)
+		{
+			remove(Temporary.c_str());
+			throw FileNotFoundException(Output);
+		}
+#ifdef _WIN32
+		remove(Output);
+#endif
+		if (rename(Temporary.c_str(), Output) != 0)
+			throw FileNotFoundException(Output);
+	}
+
+	/********************************************************************
+	*                   MotionReplay::MotionReplay
+	* Everything Play will read is checked here: the sizes add up to the
+	* file's length and every step lies inside the frames, so Play can
+	* trust the file from then on.
+	********************************************************************/
+	MotionReplay::MotionReplay(char* Filename)
+	{
+		if (!this->File.Open(Filename))
+			throw FileNotFoundException(Filename);
+
+		const char* Text   = this->File.Text;
+		size_t      Length = this->File.Length;
+		if (Length < sizeof(Program::Header))
+			throw MalformedConfigException(Filename, 0);
+
+		this->Head = (const Program::Header*) Text;
+		if (memcmp(this->Head->Magic, Program::MAGIC, sizeof(Program::MAGIC)) != 0
+		    || this->Head->Version != Program::VERSION)
+			throw MalformedConfigException(Filename, 0);
+
+		size_t Tables = sizeof(Program::Header) + this->Head->JointCount * sizeof(Program::Joint)
+		              + size_t(this->Head->StepCount) * sizeof(Program::Step);
+		if (this->Head->JointCount > 8 || Length != Tables + this->Head->FrameBytes)
+			throw MalformedConfigException(Filename, 0);
+
+		this->Joints = (const Program::Joint*) (Text + sizeof(Program::Header));
+		this->Steps  = (const Program::Step*) (this->Joints + this->Head->JointCount);
+		this->Frames = Text + Tables;
+
+		for (uint32_t k = 0; k < this->Head->StepCount; k++)
+		{
+			const Program::Step& Each = this->Steps[k];
+			if (Each.Kind > Program::psAWAIT || Each.Length == 0
+			    || size_t(Each.Offset) + Each.Length > this->Head->FrameBytes)
+				throw MalformedConfigException(Filename, 0);
+		}
+	}
+
+	/********************************************************************
+	*                   MotionReplay::Play
+	* Each wait has the watchdog JointMove::CollectRegister has: a reply
+	* lost to the port's timeout, or a register the drain model finds
+	* stuck (see DrainModel::Stalled), stops the joint and throws
+	* StalledMovementException. The model is a fresh one for each wait,
+	* as nothing is sent while it lasts.
+	* Precondition:  Every joint the program moves is where it starts
+	*                it, and no other thread is moving them.
+	* Postcondition: Every command frame has been sent.
+	********************************************************************/
+	int MotionReplay::Play(Tserial* Port)
+	{
+		std::lock_guard<std::mutex> PortHeld(PortWorker::Lock(Port));
+		if (Port->getTimeout() == 0)
+			Port->setTimeout(JointMove::REPLY_TIMEOUT);
+
+		for (uint32_t k = 0; k < this->Head->StepCount; k++)
+		{
+			const Program::Step& Each  = this->Steps[k];
+			char*                Frame = const_cast<char*>(this->Frames + Each.Offset);
+
+			if (Each.Kind == Program::psSEND)
+			{
+				Port->sendArray(Frame, Each.Length);
+				continue;
+			}
+
+			DrainModel Drain;
+			for (;;)
+			{
+				double Asked = MonotonicSeconds();
+				Trace(teQUERY, Frame[0], '?');
+				char RegisterValue = abs(Port->query(Frame, Each.Length));
+				double Answered = MonotonicSeconds();
+				if (Port->timedOut())
+				{
+					Trace(teSTALLED, Frame[0], -1);
+					SendCommand(*Port, Frame[0], 'X');
+					throw StalledMovementException(Frame[0], -1, Answered - Asked, Port->getTimeout() / 1000.0);
+				}
+				RegisterValue -= 32;
+				Trace(teRESPONSE, Frame[0], RegisterValue);
+				if (RegisterValue <= int(Each.Level))
+					break;
+				Drain.Observe(RegisterValue, (Asked + Answered) / 2);
+				if (Drain.Stalled())
+				{
+					Trace(teSTALLED, Frame[0], RegisterValue);
+					SendCommand(*Port, Frame[0], 'X');
+					throw StalledMovementException(Frame[0], RegisterValue, Drain.StuckFor(), Drain.StallLimit());
+				}
+				SwitchPoller::SleepUntil(Port, MonotonicSeconds() + POLL_INTERVAL / 1000.0);
+			}
+		}
+		return 0;
+	}
+
+	int MotionReplay::Play(const std::vector<JointMove*>& Joints)
+	{
+		// The frames go out on one port, so every joint has to be on it.
+		for (size_t k = 1; k < Joints.size(); k++)
+			if (Joints[k]->ComPort != Joints[0]->ComPort)
+				throw PortMismatchException();
+
+		std::vector<JointMove*> Moved(this->Head->JointCount);
+		for (uint32_t j = 0; j < this->Head->JointCount; j++)
+		{
+			for (size_t k = 0; k < Joints.size(); k++)
+				if (Joints[k]->JointToMove == this->Joints[j].Letter)
+					Moved[j] = Joints[k];
+			if (!Moved[j] || Moved[j]->HomeDeviation != this->Joints[j].Start)
+				throw BoundaryViolationException();
+		}
+		if (Moved.empty())
+			return 0;
+
+		this->Play(Moved[0]->ComPort);
+		for (uint32_t j = 0; j < this->Head->JointCount; j++)
+		{
+			Moved[j]->HomeDeviation   = this->Joints[j].End;
+			Moved[j]->CurrentPosition = this->Joints[j].EndAngle;
+			// The replay keeps no drain model, so the estimate only
+			// catches up once it is over.
+			Moved[j]->State.Settle(this->Joints[j].End, MonotonicSeconds());
+		}
+		return 0;
+	}
+}
@@ -0,0 +1,145 @@
+#ifndef MOTIONPROGRAM_H
+#define MOTIONPROGRAM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "JointMoveProto.h"
+#include "MappedFile.h"
+
+/*************************************************************************************
+* MotionProgram.h contains class MotionCompiler, which turns a fixed sequence of
+* joint moves into the exact bytes JointMove would send for it, and class
+* MotionReplay, which sends those bytes again:
+*
+*     # joint  angle
+*     D        -0.392699081698724
+*     D         0.261799387799149
+*     F         0.392699081698724
+*
+* Each line of a program moves one joint to an angle in radians, as Move would.
+* Every joint starts at its home position. Anything after a '#' is a comment.
+*
+* - MotionCompiler(const RobotConfig& Config):
+*      Compiles against Config's resolutions, bounds and group sizes.
+* - void Compile(char* Source, char* Output):
+*      Checks every line of Source and writes the compiled program to Output. The
+*      ticks, groups and command frames are worked out here, once, exactly as Move
+*      works them out in POLLED mode.
+*      Throws:        FileNotFoundException, if Source can't be read or Output
+*                     can't be written; MalformedConfigException, with the line
+*                     number, for an unreadable line, a joint Config doesn't have,
+*                     or an angle outside the joint's bounds or too many ticks
+*                     from home (RobotConfig::TICK_LIMIT).
+* - MotionReplay(char* Filename):
+*      Maps a compiled program into memory and checks that it is whole.
+*      Throws:        FileNotFoundException; MalformedConfigException, with line 0,
+*                     if the file isn't a compiled program or is cut short.
+* - int Play(Tserial* Port):
+*      Sends the program. Between the command frames it only waits for the
+*      registers that have to drain, querying them as Move does, so the commands
+*      on the line are the same bytes in the same order on every run; only the
+*      number of register queries between them varies. The port's timeout is set
+*      as a JointMove sets it, if it has none.
+*      Throws:        StalledMovementException, after stopping the joint, if a
+*                     register it waits for stops draining or the robot stops
+*                     answering, as Move does. The rest of the program isn't sent.
+* - int Play(const std::vector<JointMove*>& Joints):
+*      Plays on the Joints' port, then leaves each Joint at the program's end
+*      position, as though it had made the moves itself. After a stall the
+*      Joints are left as they were, since the replay doesn't know how far each
+*      got; home them before moving them again.
+*      Precondition:  Joints include every joint the program moves.
+*      Throws:        BoundaryViolationException, before anything is sent, if one
+*                     of the joints isn't where the program starts it.
+*                     PortMismatchException, before anything is sent, if the
+*                     joints aren't all on one port.
+*
+* A compiled program is a header, a table of the joints it moves with their start
+* and end positions, a list of steps, and the command frames. Each step either
+* sends a run of frames in one write, or waits for one joint's register to drain
+* to its replenish level. It is read where it lies in the mapping, without being
+* copied or parsed, on the same kind of machine as compiled it.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	namespace Program
+	{
+		enum step_kind {psSEND, psAWAIT};
+
+		struct Header
+		{
+			char     Magic[4];
+			uint32_t Version;
+			uint32_t JointCount;
+			uint32_t StepCount;
+			uint32_t FrameBytes;
+			uint32_t Reserved;
+		};
+
+		struct Joint
+		{
+			// The angle left behind, and the start and end in ticks from home.
+			double   EndAngle;
+			int32_t  Start;
+			int32_t  End;
+			char     Letter;
+			char     Reserved[7];
+		};
+
+		// psSEND: write Length bytes of the frames from Offset.
+		// psAWAIT: send the query at Offset until the reply is at most Level.
+		struct Step
+		{
+			uint32_t Offset;
+			uint16_t Length;
+			uint8_t  Kind;
+			uint8_t  Level;
+		};
+
+		const char     MAGIC[4] = {'X', 'R', 'M', 'P'};
+		const uint32_t VERSION  = 1;
+	}
+
+	class MotionCompiler
+	{
+		public:
+			MotionCompiler(const RobotConfig& Config) : Config(Config) { }
+
+			void Compile(char* Source, char* Output);
+		private:
+			const RobotConfig&         Config;
+			std::vector<Program::Joint> Joints;
+			std::vector<Program::Step>  Steps;
+			std::string                 Frames;
+			// Where each joint's query frame is, by letter.
+			uint32_t                    QueryAt[8];
+
+			void Parse  (const char* Text, size_t Length, char* Name);
+			void AddMove(Program::Joint& Moved, const JointConfig& Settings, int Target);
+			void Send   (const char* Frame, size_t Length);
+			void Write  (char* Output) const;
+	};
+
+	class MotionReplay
+	{
+		public:
+			MotionReplay(char* Filename);
+
+			int  Play(Tserial* Port);
+			int  Play(const std::vector<JointMove*>& Joints);
+
+			int  ViewJointCount(void) const { return int(this->Head->JointCount); }
+			int  ViewStepCount (void) const { return int(this->Head->StepCount); }
+		private:
+			MappedFile             File;
+			const Program::Header* Head;
+			const Program::Joint*  Joints;
+			const Program::Step*   Steps;
+			const char*            Frames;
+
+			// Milliseconds between register queries while a step waits.
+			const static unsigned int POLL_INTERVAL = 10;
+	};
+}
+#endif
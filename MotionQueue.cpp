@@ -0,0 +1,98 @@
+#include "MotionQueue.h"
+#include "CoordinatedMove.h"
+
+namespace TLeyson_Robot
+{
+	MotionQueue::MotionQueue(double Window)
+	{
+		this->Window = Window;
+		this->Oldest = 0;
+		this->Merged = 0;
+	}
+
+	// A destructor can't throw, so a stall during the last flush goes unheard.
+	MotionQueue::~MotionQueue()
+	{
+		try
+		{
+			this->Flush();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	/********************************************************************
+	*                   MotionQueue::Move
+	* Checks the angle as Move would, then holds it as the joint's
+	* target, replacing any target already held for it, then polls.
+	* Throws:        BoundaryViolationException, from the checks.
+	********************************************************************/
+	void MotionQueue::Move(JointMove* Joint, double AngularPosition)
+	{
+		Joint->CheckAngle(AngularPosition);
+
+		double Now = MonotonicSeconds();
+		if (this->Pending.empty())
+			this->Oldest = Now;
+
+		size_t j = 0;
+		while (j < this->Pending.size() && this->Pending[j].Joint != Joint)
+			j++;
+		if (j < this->Pending.size())
+		{
+			this->Pending[j].Target = AngularPosition;
+			this->Merged++;
+		}
+		else
+		{
+			Request Asked;
+			Asked.Joint  = Joint;
+			Asked.Target = AngularPosition;
+			this->Pending.push_back(Asked);
+		}
+
+		this->Poll();
+	}
+
+	int MotionQueue::Poll(void)
+	{
+		if (this->Pending.empty() || MonotonicSeconds() < this->Oldest + this->Window)
+			return 0;
+		return this->Flush();
+	}
+
+	/********************************************************************
+	*                   MotionQueue::Flush
+	* Leaves out the joints already at their targets, then moves the
+	* rest. Whatever is held is let go before anything is sent, so a
+	* stall leaves the queue empty.
+	********************************************************************/
+	int MotionQueue::Flush(void)
+	{
+		std::vector<Request> Taken;
+		Taken.swap(this->Pending);
+
+		CoordinatedMove Together;
+		JointMove*      Single = 0;
+		double          Target = 0;
+		for (size_t j = 0; j < Taken.size(); j++)
+		{
+			JointMove& Joint = *Taken[j].Joint;
+			if (Joint.ViewCurrentPosition() == Taken[j].Target)
+			{
+				this->Merged++;
+				continue;
+			}
+			Together.Add(&Joint, Taken[j].Target);
+			Single = &Joint;
+			Target = Taken[j].Target;
+		}
+
+		if (Together.ViewJointCount() == 1)
+			return Single->Move(Target);
+		if (Together.ViewJointCount() > 1)
+			return Together.Execute();
+		return 0;
+	}
+}
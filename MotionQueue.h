@@ -0,0 +1,80 @@
+#ifndef MOTIONQUEUE_H
+#define MOTIONQUEUE_H
+
+#include <vector>
+#include "JointMoveProto.h"
+
+/*************************************************************************************
+* MotionQueue.h contains class MotionQueue, which holds Move requests for a short
+* while and then sends only where each joint has to end up, every joint at once:
+*
+* - MotionQueue(double Window):
+*      Requests are held until a call finds the oldest Window seconds old, or
+*      until Flush. Nothing happens between calls: the queue has no thread or
+*      timer of its own, so its stalls reach whoever made the call.
+* - void Move(JointMove* Joint, double AngularPosition):
+*      Asks for Joint to go to AngularPosition once whatever was asked of it
+*      before is done. A later request for the same joint takes the place of an
+*      earlier one still held, since the joint would only pass through it, so a
+*      move that a later one undoes costs nothing on the line.
+*      Throws:        BoundaryViolationException, at once and holding nothing,
+*                     if the angle is one Move would refuse. If the request makes
+*                     the oldest Window old, whatever Flush throws.
+* - int Poll(void), double ViewDeadline(void):
+*      Poll flushes if the oldest request held is Window old, and otherwise
+*      sends nothing. ViewDeadline says when that will be, or 0 if nothing is
+*      held, so a caller with no more requests can Poll on its own timer.
+*      Throws:        Whatever Flush throws, if it flushes.
+* - int Flush(void):
+*      Sends every joint held to the last angle asked of it, all of them
+*      together as a CoordinatedMove, or with Move if only one has anywhere to
+*      go. A joint asked to end where it is sends nothing.
+*      Postcondition: Nothing is held.
+*      Throws:        StalledMovementException, as CoordinatedMove::Execute does.
+* - int ViewPendingCount(void), unsigned int ViewMerged(void):
+*      Joints with a request held, and requests that never reached the line
+*      because a later one replaced them or the joint was already there.
+*
+* So the six moves of jointtest.cpp, three of them on D, go out as one move for
+* each of D, E and F, interleaved on the line. A joint's ViewCurrentPosition only
+* changes once its request is sent. The last requests of a burst wait for the next
+* call, so a caller must Poll or Flush once it stops asking. The destructor flushes
+* whatever is still held, but can't report a stall; call Flush to hear of one.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	class MotionQueue
+	{
+		public:
+			MotionQueue(double Window = DEFAULT_WINDOW);
+			~MotionQueue();
+
+			void Move (JointMove* Joint, double AngularPosition);
+			int  Poll (void);
+			int  Flush(void);
+
+			int          ViewPendingCount(void) const { return int(this->Pending.size()); }
+			unsigned int ViewMerged      (void) const { return this->Merged; }
+			double       ViewWindow      (void) const { return this->Window; }
+			double       ViewDeadline    (void) const { return this->Pending.empty() ? 0 : this->Oldest + this->Window; }
+		private:
+			MotionQueue(const MotionQueue&);
+			MotionQueue& operator=(const MotionQueue&);
+
+			struct Request
+			{
+				JointMove* Joint;
+				double     Target;
+			};
+
+			// Seconds a request is held by default.
+			static constexpr double DEFAULT_WINDOW = 0.05;
+
+			std::vector<Request> Pending;
+			double               Window;
+			// When the oldest request held was made.
+			double               Oldest;
+			unsigned int         Merged;
+	};
+}
+#endif
@@ -0,0 +1,517 @@
+#include "MotionScheduler.h"
+
+#if !defined(_WIN32) && defined(__cpp_impl_coroutine)
+#include <cmath>
+#include <stdlib.h>
+#include "MotionTrace.h"
+#include "CommandEncoder.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		// The sooner of two times, where 0 means never.
+		double Sooner(double First, double Second)
+		{
+			if (First == 0)
+				return Second;
+			return Second == 0 || First < Second ? First : Second;
+		}
+	}
+
+	MotionScheduler::MotionScheduler(Tserial* Port)
+	{
+		this->Port           = Port;
+		this->Running        = false;
+		this->Reading.Bits   = 0;
+		this->Reading.Time   = 0;
+		this->Reading.Failed = false;
+		this->SwitchAsked    = false;
+		this->SwitchFailed   = false;
+		this->SwitchTicket   = 0;
+		this->SwitchAskedAt  = 0;
+	}
+
+	MotionScheduler::~MotionScheduler()
+	{
+		this->Wait();
+	}
+
+	std::future<int> MotionScheduler::Move(JointMove* Joint, double AngularPosition, Completion Done)
+	{
+		return this->Submit(Joint, this->MoveTask(*Joint, AngularPosition), Done);
+	}
+
+	std::future<int> MotionScheduler::Home(JointMove* Joint, Completion Done)
+	{
+		return this->Submit(Joint, this->HomeTask(*Joint), Done);
+	}
+
+	void MotionScheduler::Wait(void)
+	{
+		std::unique_lock<std::mutex> Hold(this->Lock);
+		while (this->Running)
+			this->Idle.wait(Hold);
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::Submit
+	* Hands the task to the I/O thread, and queues Run there unless it
+	* is already queued or running.
+	********************************************************************/
+	std::future<int> MotionScheduler::Submit(JointMove* Joint, MotionTask Task, Completion Done)
+	{
+		Entry Asked;
+		Asked.Joint = Joint;
+		Asked.Task  = std::move(Task);
+		Asked.Done  = Done;
+		Asked.Result.reset(new std::promise<int>);
+		std::future<int> Future = Asked.Result->get_future();
+
+		bool Idle;
+		{
+			std::lock_guard<std::mutex> Hold(this->Lock);
+			this->Incoming.push_back(std::move(Asked));
+			Idle          = !this->Running;
+			this->Running = true;
+		}
+		if (Idle)
+			PortWorker::For(this->Port).Submit([this]() { return this->Run(); });
+		return Future;
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::Run
+	* The scheduler, on the I/O thread. Each pass takes in new tasks,
+	* resumes whatever is ready in one batch of writes, then waits for
+	* replies, or sleeps if none are expected, until the next thing is
+	* due. Tasks that returned are finished once the batch has gone out,
+	* so their last commands are on the line before their futures are
+	* ready. Returns once every task has finished.
+	* Postcondition: The port is unlocked.
+	********************************************************************/
+	int MotionScheduler::Run(void)
+	{
+		std::lock_guard<std::mutex> PortHeld(PortWorker::Lock(this->Port));
+
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> Hold(this->Lock);
+				while (!this->Incoming.empty())
+				{
+					this->Queued.push_back(std::move(this->Incoming.front()));
+					this->Incoming.pop_front();
+				}
+				if (this->Queued.empty() && this->Active.empty())
+				{
+					this->Running = false;
+					this->Idle.notify_all();
+					return 0;
+				}
+			}
+
+			this->Port->beginBatch();
+			double Wake = this->Step();
+			this->Port->endBatch();
+			if (this->Retire())
+				continue;
+
+			int Timeout = -1;
+			if (Wake > 0)
+			{
+				double Left = std::ceil((Wake - MonotonicSeconds()) * 1000);
+				Timeout = Left > 0 ? int(Left) : 0;
+			}
+			if (this->Port->pendingReplies() > 0)
+				this->Port->awaitReplies(Timeout);
+			else if (Wake > 0)
+				SleepUntil(Wake);
+			this->Receive();
+		}
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::Start
+	* Starts, in the order they were asked for, the queued tasks whose
+	* joints have nothing else under way.
+	********************************************************************/
+	void MotionScheduler::Start(void)
+	{
+		for (size_t q = 0; q < this->Queued.size(); )
+		{
+			bool Busy = false;
+			for (size_t a = 0; a < this->Active.size() && !Busy; a++)
+				Busy = this->Active[a].Joint == this->Queued[q].Joint;
+			for (size_t p = 0; p < q && !Busy; p++)
+				Busy = this->Queued[p].Joint == this->Queued[q].Joint;
+			if (Busy)
+			{
+				q++;
+				continue;
+			}
+			this->Active.push_back(std::move(this->Queued[q]));
+			this->Queued.erase(this->Queued.begin() + q);
+		}
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::Step
+	* Resumes every task that is ready, again and again until none is.
+	* If any is waiting on the switches, asks for them unless a query is
+	* already on the line. Returns when a task's time next comes or a
+	* reply is next given up on, or 0 if only a reply can wake one.
+	********************************************************************/
+	double MotionScheduler::Step(void)
+	{
+		double Timeout = this->Port->getTimeout() / 1000.0;
+		bool   Resumed = true;
+
+		while (Resumed)
+		{
+			Resumed = false;
+			this->Start();
+			double Now = MonotonicSeconds();
+			for (size_t t = 0; t < this->Active.size(); t++)
+			{
+				MotionTask& Task = this->Active[t].Task;
+				if (!Task.Done())
+					this->Reask(this->Active[t]);
+				if (!Task.Done() && this->Ready(Task.State(), Now, Timeout))
+				{
+					Task.Resume();
+					Resumed = true;
+				}
+			}
+		}
+		this->SwitchFailed = false;
+
+		double Next      = 0;
+		bool   Switching = false;
+		for (size_t t = 0; t < this->Active.size(); t++)
+		{
+			if (this->Active[t].Task.Done())
+				continue;
+			const MotionTask::promise_type& State = this->Active[t].Task.State();
+			if (State.Waiting == MotionTask::mwTIME)
+				Next = Sooner(Next, State.When);
+			else if (State.Waiting == MotionTask::mwREPLY && Timeout > 0)
+				Next = Sooner(Next, State.When + Timeout);
+			else if (State.Waiting == MotionTask::mwSWITCHES)
+				Switching = true;
+		}
+
+		// One I query serves every joint that is homing.
+		if (Switching && !this->SwitchAsked)
+		{
+			char Command = 'I';
+			Trace(teQUERY, SWITCH_TRACK, 'I');
+			this->SwitchTicket  = this->Port->sendQuery(&Command, 1);
+			this->SwitchAsked   = true;
+			this->SwitchAskedAt = MonotonicSeconds();
+		}
+		if (this->SwitchAsked && Timeout > 0)
+			Next = Sooner(Next, this->SwitchAskedAt + Timeout);
+		return Next;
+	}
+
+	bool MotionScheduler::Ready(const MotionTask::promise_type& State, double Now, double Timeout)
+	{
+		switch (State.Waiting)
+		{
+			case MotionTask::mwSTART:
+				return true;
+			case MotionTask::mwTIME:
+				return State.When <= Now;
+			case MotionTask::mwREPLY:
+				return this->Port->hasReply(State.Ticket) || (Timeout > 0 && Now - State.When > Timeout);
+			case MotionTask::mwSWITCHES:
+				return this->Reading.Time >= State.When || this->SwitchFailed;
+		}
+		return false;
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::Receive
+	* Takes the switch reading off the line once it has come, and hands
+	* it to the port's SwitchPoller. If the port's timeout runs out first
+	* the line is abandoned, and the tasks waiting for the switches fail.
+	********************************************************************/
+	void MotionScheduler::Receive(void)
+	{
+		double Now     = MonotonicSeconds();
+		double Timeout = this->Port->getTimeout() / 1000.0;
+
+		if (!this->SwitchAsked)
+			return;
+		if (this->Port->hasReply(this->SwitchTicket))
+		{
+			this->Reading.Bits = char(this->Port->getReply(this->SwitchTicket) - 32);
+			this->Reading.Time = (this->SwitchAskedAt + Now) / 2;
+			Trace(teRESPONSE, SWITCH_TRACK, this->Reading.Bits);
+			this->SwitchAsked = false;
+			SwitchPoller::For(this->Port).Publish(this->Reading);
+		}
+		else if (Timeout > 0 && Now - this->SwitchAskedAt > Timeout)
+		{
+			this->Abandon();
+			this->SwitchFailed = true;
+		}
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::Abandon
+	*                   MotionScheduler::Reask
+	* A reply given up on takes every query still on the line with it,
+	* as the robot answers in order, and any late replies are thrown
+	* away (see abandonReplies in tserial.h). A task that then finds its
+	* register reply lost asks again, and waits a timeout afresh, rather
+	* than failing for the joint that didn't answer.
+	********************************************************************/
+	void MotionScheduler::Abandon(void)
+	{
+		this->Port->abandonReplies();
+		this->SwitchAsked = false;
+	}
+
+	void MotionScheduler::Reask(Entry& Part)
+	{
+		MotionTask::promise_type& State = Part.Task.State();
+		if (State.Waiting != MotionTask::mwREPLY || !this->Port->hasReply(State.Ticket))
+			return;
+		// Reads nothing off the line: the reply, if it came, is in the ring.
+		this->Port->getReply(State.Ticket);
+		if (!this->Port->timedOut())
+			return;
+
+		char QueryString[5];
+		EncodeCommand(QueryString, Part.Joint->JointToMove, '?');
+		QueryString[4] = '\0';
+		Part.Joint->AskRegister(QueryString);
+		State.Wait(MotionTask::mwREPLY, Part.Joint->QueryAsked, Part.Joint->QueryTicket);
+	}
+
+	// Finishes every task that has returned. Returns whether there were any.
+	bool MotionScheduler::Retire(void)
+	{
+		bool Retired = false;
+		for (size_t t = 0; t < this->Active.size(); )
+		{
+			if (!this->Active[t].Task.Done())
+			{
+				t++;
+				continue;
+			}
+			this->Finish(this->Active[t]);
+			this->Active.erase(this->Active.begin() + t);
+			Retired = true;
+		}
+		return Retired;
+	}
+
+	void MotionScheduler::Finish(Entry& Part)
+	{
+		MotionTask::promise_type& State = Part.Task.State();
+
+		PortWorker::Complete(*Part.Result, Part.Done, State.Result, State.Error);
+	}
+
+	void MotionScheduler::Suspend(MotionTask::Handle Task, JointMove& Joint)
+	{
+		Task.promise().Wait(MotionTask::mwREPLY, Joint.QueryAsked, Joint.QueryTicket);
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::Collect
+	*                   MotionScheduler::Latest
+	* What a task resumes with once its register reply or its switch
+	* reading is in. If the port's timeout ran out instead, the joint is
+	* stopped, the line abandoned and StalledMovementException thrown,
+	* as CollectRegister does.
+	********************************************************************/
+	int MotionScheduler::Collect(JointMove& Joint)
+	{
+		if (!this->Port->hasReply(Joint.QueryTicket))
+		{
+			double Waited = MonotonicSeconds() - Joint.QueryAsked;
+			Trace(teSTALLED, Joint.JointToMove, -1);
+			Joint.Stop();
+			this->Abandon();
+			throw StalledMovementException(Joint.JointToMove, -1, Waited, this->Port->getTimeout() / 1000.0);
+		}
+		return Joint.CollectRegister();
+	}
+
+	SwitchState MotionScheduler::Latest(JointMove& Joint, double Since)
+	{
+		if (this->Reading.Time < Since)
+		{
+			double Waited = MonotonicSeconds() - this->SwitchAskedAt;
+			Trace(teSTALLED, Joint.JointToMove, -1);
+			Joint.Stop();
+			throw StalledMovementException(Joint.JointToMove, -1, Waited, this->Port->getTimeout() / 1000.0);
+		}
+		return this->Reading;
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::MoveTask
+	* JointMove::Move, with AwaitReplenish written in, suspending where
+	* they would sleep or wait for the register.
+	********************************************************************/
+	MotionTask MotionScheduler::MoveTask(JointMove& Joint, double AngularPosition)
+	{
+		if ( !(AngularPosition > Joint.LowerBound && AngularPosition < Joint.UpperBound) )
+			throw BoundaryViolationException();
+		else if (Joint.CurrentPosition == AngularPosition)
+			co_return 0;
+
+		double       Started         = MonotonicSeconds();
+		int          DesiredPosition = Joint.Round(Joint.ConvertToTicks(AngularPosition));
+		int          TotalTicks      = DesiredPosition - Joint.HomeDeviation;
+		char         Direction       = AngularPosition > Joint.CurrentPosition ? '+' : '-';
+		unsigned int Ticks           = (unsigned int) abs(TotalTicks);
+		unsigned int WholeGroups     = Ticks / Joint.GroupSize;
+		unsigned int OddGroup        = Ticks % Joint.GroupSize;
+		char QueryString[] = {Joint.JointToMove, '?', 0x0A, 0x0D, '\0'};
+		Trace(teMOVE_BEGIN, Joint.JointToMove, TotalTicks);
+
+		if (OddGroup)
+		{
+			SendTicks(*Joint.ComPort, Joint.JointToMove, Direction, OddGroup);
+			Trace(teCOMMAND, Joint.JointToMove, OddGroup);
+			Joint.Sent(Direction, OddGroup, MonotonicSeconds());
+		}
+
+		Joint.GroupsSinceQuery = JointMove::CORRECTION_INTERVAL;
+		for (unsigned int k = WholeGroups; k > 0; k--)
+		{
+			bool   Predictive = Joint.FlowMode == PREDICTIVE && Joint.Drain.Calibrated();
+			double Entered    = MonotonicSeconds();
+
+			if (Predictive && ++Joint.GroupsSinceQuery < JointMove::CORRECTION_INTERVAL)
+			{
+				Trace(teSLEEP_BEGIN, Joint.JointToMove);
+				co_await this->Until(Joint.Drain.TimeToReach(Joint.Replenish, Entered));
+				Trace(teSLEEP_END, Joint.JointToMove);
+			}
+			else
+			{
+				Joint.GroupsSinceQuery = 0;
+				Joint.AskRegister(QueryString);
+				int RegisterValue = co_await this->Reply(Joint);
+				if (k < WholeGroups && RegisterValue == 0)
+				{
+					Trace(teSTARVED, Joint.JointToMove, 0);
+					Joint.Starvations++;
+				}
+				while (RegisterValue > int(Joint.Replenish))
+				{
+					Trace(teSLEEP_BEGIN, Joint.JointToMove);
+					co_await this->Until(Predictive ? Joint.Drain.TimeToReach(Joint.Replenish, MonotonicSeconds())
+					                                : MonotonicSeconds() + JointMove::POLL_INTERVAL / 1000.0);
+					Trace(teSLEEP_END, Joint.JointToMove);
+					Joint.AskRegister(QueryString);
+					RegisterValue = co_await this->Reply(Joint);
+				}
+			}
+			TraceLatency(Joint.JointToMove, tmTIME_TO_REPLENISH, MonotonicSeconds() - Entered);
+
+			SendTicks(*Joint.ComPort, Joint.JointToMove, Direction, Joint.GroupSize);
+			Trace(teCOMMAND, Joint.JointToMove, Joint.GroupSize);
+			Joint.Sent(Direction, Joint.GroupSize, MonotonicSeconds());
+		}
+		Trace(teMOVE_END, Joint.JointToMove, TotalTicks);
+		TraceLatency(Joint.JointToMove, tmMOVE_DURATION, MonotonicSeconds() - Started);
+
+		Joint.HomeDeviation   = DesiredPosition;
+		Joint.CurrentPosition = AngularPosition;
+		co_return 0;
+	}
+
+	/********************************************************************
+	*                   MotionScheduler::HomeTask
+	* One joint's part of JointMove::HomeAll: approach, back off and
+	* creep, a step each HOME_POLL_INTERVAL. Each step waits for a
+	* reading of the switches no more than half a cycle old, which every
+	* joint homing at the time shares, and for the register whenever
+	* HomeAll would read it, with the same limit on backing off and
+	* creeping.
+	********************************************************************/
+	MotionTask MotionScheduler::HomeTask(JointMove& Joint)
+	{
+		enum home_phase {hpAPPROACH, hpBACK_OFF, hpCREEP};
+
+		char       QueryString[] = {Joint.JointToMove, '?', 0x0A, 0x0D, '\0'};
+		home_phase Phase         = hpAPPROACH;
+		double     Cycle         = MonotonicSeconds();
+		double     Began         = 0;
+		double     Limit         = JointMove::HOME_SEARCH_TIME / 1000.0;
+
+		Trace(teHOME_BEGIN, Joint.JointToMove);
+		while (Joint.SwitchMask)
+		{
+			bool Asked = Phase != hpAPPROACH || !Joint.Drain.Calibrated()
+			          || Joint.Drain.Predict(MonotonicSeconds()) <= JointMove::HOME_REFILL;
+			if (Asked)
+				Joint.AskRegister(QueryString);
+
+			SwitchState Switches = co_await this->Switches(Joint, Cycle - JointMove::HOME_POLL_INTERVAL / 2000.0);
+			// A set bit means the switch is still open.
+			bool Open = (Switches.Bits & Joint.SwitchMask) != 0;
+
+			double Queued;
+			if (Asked)
+				Queued = co_await this->Reply(Joint);
+			else
+				Queued = Joint.Drain.Predict(MonotonicSeconds());
+			double Now = MonotonicSeconds();
+			if (Phase != hpAPPROACH && Now - Began > Limit)
+			{
+				Trace(teSTALLED, Joint.JointToMove, int(Queued));
+				Joint.Stop();
+				throw StalledMovementException(Joint.JointToMove, int(Queued), Now - Began, Limit);
+			}
+
+			if (Phase == hpAPPROACH)
+			{
+				if (!Open)
+				{
+					Joint.Stop();
+					Phase = hpBACK_OFF;
+					Began = Now;
+				}
+				else if (Queued <= JointMove::HOME_REFILL)
+					Joint.Nudge('+', JointMove::HOME_STEP);
+			}
+			else if (Phase == hpBACK_OFF)
+			{
+				if (Open)
+				{
+					Phase = hpCREEP;
+					Began = Now;
+				}
+				else
+					Joint.Nudge('-', JointMove::HOME_BACKOFF_STEP);
+			}
+			else if (!Open)
+			{
+				Joint.Stop();
+				Joint.HomeDeviation   = 0;
+				Joint.CurrentPosition = Joint.HomePosition;
+				Joint.State.Settle(0, MonotonicSeconds());
+				break;
+			}
+			else
+				Joint.Nudge('+', JointMove::HOME_CREEP_STEP);
+
+			Cycle += JointMove::HOME_POLL_INTERVAL / 1000.0;
+			Trace(teSLEEP_BEGIN, Joint.JointToMove);
+			co_await this->Until(Cycle);
+			Trace(teSLEEP_END, Joint.JointToMove);
+		}
+		Trace(teHOME_END, Joint.JointToMove);
+		co_return 0;
+	}
+}
+#endif
@@ -0,0 +1,201 @@
+#ifndef MOTIONSCHEDULER_H
+#define MOTIONSCHEDULER_H
+
+#if !defined(_WIN32) && defined(__cpp_impl_coroutine)
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "JointMoveProto.h"
+
+/*************************************************************************************
+* MotionScheduler.h contains class MotionScheduler, which runs Move and Home for any
+* number of joints on one serial port at once, as coroutines on the port's I/O
+* thread (see PortWorker.h), instead of on a thread per joint:
+*
+* - MotionScheduler(Tserial* Port):
+*      A scheduler for the joints on Port.
+* - std::future<int> Move(JointMove* Joint, double AngularPosition, Completion Done):
+* - std::future<int> Home(JointMove* Joint, Completion Done):
+*      Ask for Joint to be moved or homed as Move or Home would, after anything
+*      already asked of it here, and return at once. The future holds 0, or the
+*      BoundaryViolationException or StalledMovementException; Done, if given, is
+*      called on the I/O thread when the joint has finished.
+*      Precondition:  Joint is on the scheduler's port.
+* - void Wait(void):
+*      Returns once everything asked for has finished. The destructor waits too.
+*      Precondition:  Not called from a Done.
+*
+* Each Move or Home is a coroutine that follows JointMove's own step for step, and
+* suspends wherever that would block: for a register reply, for the time the next
+* group is due, and, homing, for a fresh reading of the switches. While any are
+* under way the scheduler runs on the I/O thread holding PortWorker::Lock, so
+* JointMove's own Move and Home wait for it, and as only that thread ever resumes
+* them the joints need no locks of their own. Each pass resumes every coroutine
+* whose reply has come or whose time is up, so the commands they send go out in
+* one write, then waits on the line until the next reply, or until something else
+* falls due. All the joints homing at once share each I query, and its readings go
+* to the port's SwitchPoller with Publish. Motion asked for while the scheduler is
+* running starts the next time it wakes.
+*
+* Coroutines need C++20; without them, and on Win32, this header is empty.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	/********************************************************************
+	* MotionTask: a Move or Home in progress. The promise records what
+	* the coroutine is waiting for, so the scheduler knows when to
+	* resume it.
+	********************************************************************/
+	class MotionTask
+	{
+		public:
+			// mwSTART: not yet run. mwTIME: until When. mwREPLY: for the
+			// reply to Ticket, asked at When. mwSWITCHES: for a reading of
+			// the switches taken no earlier than When.
+			enum motion_wait {mwSTART, mwTIME, mwREPLY, mwSWITCHES};
+
+			struct promise_type
+			{
+				motion_wait        Waiting;
+				double             When;
+				unsigned int       Ticket;
+				int                Result;
+				std::exception_ptr Error;
+
+				promise_type(void) : Waiting(mwSTART), When(0), Ticket(0), Result(0) { }
+
+				MotionTask          get_return_object  (void) { return MotionTask(Handle::from_promise(*this)); }
+				std::suspend_always initial_suspend    (void) noexcept { return std::suspend_always(); }
+				std::suspend_always final_suspend      (void) noexcept { return std::suspend_always(); }
+				void                return_value       (int Value) { this->Result = Value; }
+				void                unhandled_exception(void) { this->Error = std::current_exception(); }
+
+				void Wait(motion_wait What, double When, unsigned int Ticket = 0)
+				{
+					this->Waiting = What;
+					this->When    = When;
+					this->Ticket  = Ticket;
+				}
+			};
+			typedef std::coroutine_handle<promise_type> Handle;
+
+			MotionTask(void) { }
+			MotionTask(MotionTask&& Other) : Coroutine(Other.Coroutine) { Other.Coroutine = Handle(); }
+			MotionTask& operator=(MotionTask&& Other)
+			{
+				std::swap(this->Coroutine, Other.Coroutine);
+				return *this;
+			}
+			~MotionTask() { if (this->Coroutine) this->Coroutine.destroy(); }
+
+			promise_type& State (void) { return this->Coroutine.promise(); }
+			void          Resume(void) { this->Coroutine.resume(); }
+			bool          Done  (void) const { return this->Coroutine.done(); }
+		private:
+			explicit MotionTask(Handle Coroutine) : Coroutine(Coroutine) { }
+			MotionTask(const MotionTask&);
+			MotionTask& operator=(const MotionTask&);
+
+			Handle Coroutine;
+	};
+
+	class MotionScheduler
+	{
+		public:
+			MotionScheduler(Tserial* Port);
+			~MotionScheduler();
+
+			std::future<int> Move(JointMove* Joint, double AngularPosition, Completion Done = Completion());
+			std::future<int> Home(JointMove* Joint, Completion Done = Completion());
+			void             Wait(void);
+		private:
+			MotionScheduler(const MotionScheduler&);
+			MotionScheduler& operator=(const MotionScheduler&);
+
+			struct Entry
+			{
+				JointMove*                           Joint;
+				MotionTask                           Task;
+				Completion                           Done;
+				std::shared_ptr< std::promise<int> > Result;
+			};
+
+			// co_await Until(When): resumes at When, on the MonotonicSeconds clock.
+			struct Alarm
+			{
+				double When;
+
+				bool await_ready  (void) const { return this->When <= MonotonicSeconds(); }
+				void await_suspend(MotionTask::Handle Task) const { Task.promise().Wait(MotionTask::mwTIME, this->When); }
+				void await_resume (void) const { }
+			};
+
+			// co_await Reply(Joint): resumes with the register value the
+			// joint last asked for with AskRegister.
+			struct RegisterReply
+			{
+				MotionScheduler* Scheduler;
+				JointMove*       Joint;
+
+				bool await_ready  (void) const { return false; }
+				void await_suspend(MotionTask::Handle Task) const { this->Scheduler->Suspend(Task, *this->Joint); }
+				int  await_resume (void) const { return this->Scheduler->Collect(*this->Joint); }
+			};
+
+			// co_await Switches(Joint, Since): resumes with a reading of the
+			// switches taken at Since or later.
+			struct SwitchReading
+			{
+				MotionScheduler* Scheduler;
+				JointMove*       Joint;
+				double           Since;
+
+				bool        await_ready  (void) const { return this->Scheduler->Reading.Time >= this->Since; }
+				void        await_suspend(MotionTask::Handle Task) const { Task.promise().Wait(MotionTask::mwSWITCHES, this->Since); }
+				SwitchState await_resume (void) const { return this->Scheduler->Latest(*this->Joint, this->Since); }
+			};
+
+			Tserial*                Port;
+			// Guards Incoming and Running.
+			std::mutex              Lock;
+			std::condition_variable Idle;
+			std::deque<Entry>       Incoming;
+			bool                    Running;
+			// Everything below belongs to the I/O thread. Queued holds what
+			// waits for an earlier task on the same joint to finish.
+			std::deque<Entry>       Queued;
+			std::vector<Entry>      Active;
+			SwitchState             Reading;
+			bool                    SwitchAsked;
+			bool                    SwitchFailed;
+			unsigned int            SwitchTicket;
+			double                  SwitchAskedAt;
+
+			Alarm         Until   (double When) { Alarm Due = {When}; return Due; }
+			RegisterReply Reply   (JointMove& Joint) { RegisterReply Due = {this, &Joint}; return Due; }
+			SwitchReading Switches(JointMove& Joint, double Since) { SwitchReading Due = {this, &Joint, Since}; return Due; }
+
+			MotionTask       MoveTask(JointMove& Joint, double AngularPosition);
+			MotionTask       HomeTask(JointMove& Joint);
+			std::future<int> Submit  (JointMove* Joint, MotionTask Task, Completion Done);
+			int              Run     (void);
+			void             Start   (void);
+			double           Step    (void);
+			bool             Ready   (const MotionTask::promise_type& State, double Now, double Timeout);
+			void             Receive (void);
+			void             Abandon (void);
+			void             Reask   (Entry& Part);
+			bool             Retire  (void);
+			void             Finish  (Entry& Part);
+			void             Suspend (MotionTask::Handle Task, JointMove& Joint);
+			int              Collect (JointMove& Joint);
+			SwitchState      Latest  (JointMove& Joint, double Since);
+	};
+}
+#endif
+#endif
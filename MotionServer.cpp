@@ -0,0 +1,492 @@
+#ifndef _WIN32
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "MotionServer.h"
+#include "CoordinatedMove.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		// Fills in a socket address for Path, or returns false if it is too long.
+		bool SocketAddress(const char* Path, struct sockaddr_un& Address)
+		{
+			memset(&Address, 0, sizeof(Address));
+			Address.sun_family = AF_UNIX;
+			if (strlen(Path) >= sizeof(Address.sun_path))
+				return false;
+			strcpy(Address.sun_path, Path);
+			return true;
+		}
+
+		// Writes as much of Out as the socket will take now and drops it
+		// from Out. Returns false if the other end has gone.
+		bool SendSome(int Socket, std::string& Out)
+		{
+			size_t Sent = 0;
+			while (Sent < Out.size())
+			{
+				ssize_t n = send(Socket, Out.data() + Sent, Out.size() - Sent, MSG_NOSIGNAL);
+				if (n > 0)
+					Sent += size_t(n);
+				else if (n == -1 && errno == EINTR)
+					continue;
+				else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+					break;
+				else
+					return false;
+			}
+			Out.erase(0, Sent);
+			return true;
+		}
+
+		void AppendReply(std::string& Out, uint32_t Id, uint8_t Status, char Joint)
+		{
+			Wire::Reply Answer;
+			Answer.Id       = Id;
+			Answer.Status   = Status;
+			Answer.Joint    = Joint;
+			Answer.Reserved = 0;
+			Out.append((const char*) &Answer, sizeof(Answer));
+		}
+	}
+
+	MotionServer::MotionServer(const RobotConfig& Config, Tserial* Port) : Config(Config)
+	{
+		this->Port       = Port;
+		this->Listener   = -1;
+		this->Epoll      = epoll_create1(EPOLL_CLOEXEC);
+		this->Wake       = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		this->NextClient = FIRST_CLIENT;
+		this->Stopping.store(false);
+
+		struct epoll_event Event;
+		Event.events   = EPOLLIN;
+		Event.data.u64 = WAKE_KEY;
+		epoll_ctl(this->Epoll, EPOLL_CTL_ADD, this->Wake, &Event);
+
+		for (char J = 'A'; J <= 'H'; J++)
+			if (Config.Has(J))
+				this->Joints[J - 'A'].reset(new JointMove(J, Config, Port, false));
+	}
+
+	// Whatever is still queued on the worker runs first, since it posts
+	// its replies here.
+	MotionServer::~MotionServer()
+	{
+		PortWorker::Release(this->Port);
+		while (!this->Clients.empty())
+			this->Drop(this->Clients.begin()->first);
+		if (this->Listener != -1)
+		{
+			close(this->Listener);
+			unlink(this->Path.c_str());
+		}
+		close(this->Epoll);
+		close(this->Wake);
+	}
+
+	bool MotionServer::Listen(const char* Path)
+	{
+		struct sockaddr_un Address;
+		if (!SocketAddress(Path, Address))
+			return false;
+
+		int Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (Socket == -1)
+			return false;
+		unlink(Path);
+		if (bind(Socket, (struct sockaddr*) &Address, sizeof(Address)) == -1
+		    || listen(Socket, SOMAXCONN) == -1)
+		{
+			close(Socket);
+			return false;
+		}
+
+		struct epoll_event Event;
+		Event.events   = EPOLLIN;
+		Event.data.u64 = LISTENER_KEY;
+		epoll_ctl(this->Epoll, EPOLL_CTL_ADD, Socket, &Event);
+		this->Listener = Socket;
+		this->Path     = Path;
+		return true;
+	}
+
+	void MotionServer::Stop(void)
+	{
+		this->Stopping.store(true);
+		uint64_t One = 1;
+		if (write(this->Wake, &One, sizeof(One)) < 0) { }
+	}
+
+	/********************************************************************
+	*                   MotionServer::Run
+	* Sleeps in epoll_wait on the listening socket, the clients and Wake.
+	* Requests are read and admitted as they come; replies posted by the
+	* worker are picked up when it writes to Wake.
+	********************************************************************/
+	void MotionServer::Run(void)
+	{
+		struct epoll_event Events[16];
+
+		while (!this->Stopping.load())
+		{
+			int Ready = epoll_wait(this->Epoll, Events, 16, -1);
+			for (int e = 0; e < Ready; e++)
+			{
+				unsigned int Key = (unsigned int) Events[e].data.u64;
+				if (Key == LISTENER_KEY)
+					this->Accept();
+				else if (Key == WAKE_KEY)
+				{
+					uint64_t Count;
+					if (read(this->Wake, &Count, sizeof(Count)) < 0) { }
+					this->Deliver();
+				}
+				else if (Events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					this->Read(Key);
+				else if (Events[e].events & EPOLLOUT)
+					this->Write(Key);
+			}
+		}
+	}
+
+	void MotionServer::Accept(void)
+	{
+		for (;;)
+		{
+			int Socket = accept4(this->Listener, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (Socket == -1)
+				return;
+
+			unsigned int Key = this->NextClient++;
+			struct epoll_event Event;
+			Event.events   = EPOLLIN;
+			Event.data.u64 = Key;
+			epoll_ctl(this->Epoll, EPOLL_CTL_ADD, Socket, &Event);
+			this->Clients[Key].Socket = Socket;
+		}
+	}
+
+	/********************************************************************
+	*                   MotionServer::Read
+	* Reads everything the client has sent and admits each whole request
+	* in it. The admitted ones go to the worker as one task, and the
+	* answers to all of them are written together. A request claiming
+	* more than MAX_TARGETS targets can't be skipped over, so the client
+	* is dropped.
+	********************************************************************/
+	void MotionServer::Read(unsigned int Key)
+	{
+		std::map<unsigned int, Client>::iterator Found = this->Clients.find(Key);
+		if (Found == this->Clients.end())
+			return;
+		Client& Asker = Found->second;
+		char    Chunk[READ_CHUNK];
+		bool    Closed = false;
+
+		for (;;)
+		{
+			ssize_t n = recv(Asker.Socket, Chunk, sizeof(Chunk), 0);
+			if (n > 0)
+				Asker.In.append(Chunk, size_t(n));
+			else if (n == -1 && errno == EINTR)
+				continue;
+			else
+			{
+				Closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+				break;
+			}
+		}
+
+		std::vector<Job> Batch;
+		size_t Used = 0;
+		while (Asker.In.size() - Used >= Wire::REQUEST_HEAD)
+		{
+			Job Next;
+			memset(&Next.Request, 0, sizeof(Next.Request));
+			memcpy(&Next.Request, Asker.In.data() + Used, Wire::REQUEST_HEAD);
+			if (Next.Request.Count > Wire::MAX_TARGETS)
+			{
+				Closed = true;
+				break;
+			}
+			size_t Length = Wire::REQUEST_HEAD + Next.Request.Count * sizeof(Wire::Target);
+			if (Asker.In.size() - Used < Length)
+				break;
+			memcpy(Next.Request.Targets, Asker.In.data() + Used + Wire::REQUEST_HEAD,
+			       Next.Request.Count * sizeof(Wire::Target));
+			Used += Length;
+
+			char Fault = this->Admit(Next.Request);
+			if (Fault)
+			{
+				AppendReply(Asker.Out, Next.Request.Id, Wire::stREJECTED, Fault);
+				continue;
+			}
+			AppendReply(Asker.Out, Next.Request.Id, Wire::stACCEPTED, 0);
+			Next.Client = Key;
+			Batch.push_back(Next);
+		}
+		Asker.In.erase(0, Used);
+
+		if (!Batch.empty())
+			PortWorker::For(this->Port).Submit([this, Batch]()
+			{
+				for (size_t k = 0; k < Batch.size(); k++)
+				{
+					int Status = this->Execute(Batch[k].Request);
+					this->Post(Batch[k].Client, Batch[k].Request.Id, uint8_t(Status));
+				}
+				return 0;
+			});
+
+		if (Closed)
+			this->Drop(Key);
+		else
+			this->Write(Key);
+	}
+
+	// Writes what it can, and asks to hear when the rest will fit.
+	void MotionServer::Write(unsigned int Key)
+	{
+		std::map<unsigned int, Client>::iterator Found = this->Clients.find(Key);
+		if (Found == this->Clients.end())
+			return;
+		Client& Asker = Found->second;
+
+		if (!SendSome(Asker.Socket, Asker.Out))
+		{
+			this->Drop(Key);
+			return;
+		}
+		struct epoll_event Event;
+		Event.events   = EPOLLIN | (Asker.Out.empty() ? 0u : uint32_t(EPOLLOUT));
+		Event.data.u64 = Key;
+		epoll_ctl(this->Epoll, EPOLL_CTL_MOD, Asker.Socket, &Event);
+	}
+
+	// A dropped client's requests still run; their replies are discarded.
+	void MotionServer::Drop(unsigned int Key)
+	{
+		std::map<unsigned int, Client>::iterator Found = this->Clients.find(Key);
+		if (Found == this->Clients.end())
+			return;
+		epoll_ctl(this->Epoll, EPOLL_CTL_DEL, Found->second.Socket, 0);
+		close(Found->second.Socket);
+		this->Clients.erase(Found);
+	}
+
+	/********************************************************************
+	*                   MotionServer::Admit
+	* Returns 0 if the request may run, otherwise the joint at fault, or
+	* '?' if the request itself is bad.
+	********************************************************************/
+	char MotionServer::Admit(const Wire::Request& Asked) const
+	{
+		if (Asked.Op < Wire::opMOVE || Asked.Op > Wire::opCOORDINATED || Asked.Count == 0)
+			return '?';
+
+		unsigned int Seen = 0;
+		for (int t = 0; t < Asked.Count; t++)
+		{
+			const Wire::Target& Each = Asked.Targets[t];
+			if (Each.Joint < 'A' || Each.Joint > 'H' || !this->Joints[Each.Joint - 'A'])
+				return Each.Joint ? Each.Joint : '?';
+
+			const JointConfig& Settings = this->Config[Each.Joint];
+			unsigned int       Bit      = 1u << (Each.Joint - 'A');
+			if (Asked.Op != Wire::opMOVE && (Seen & Bit))
+				return Each.Joint;
+			Seen |= Bit;
+
+			if (Asked.Op == Wire::opHOME)
+			{
+				if (!Settings.SwitchMask)
+					return Each.Joint;
+			}
+			else if ( !(Each.Angle > Settings.LowerBound && Each.Angle < Settings.UpperBound)
+			          || !(std::abs(Each.Angle / Settings.Resolution) <= RobotConfig::TICK_LIMIT) )
+				return Each.Joint;
+		}
+		return 0;
+	}
+
+	/********************************************************************
+	*                   MotionServer::Execute
+	* Runs an admitted request on the worker's thread and returns its
+	* final status.
+	********************************************************************/
+	int MotionServer::Execute(const Wire::Request& Asked)
+	{
+		try
+		{
+			if (Asked.Op == Wire::opMOVE)
+			{
+				for (int t = 0; t < Asked.Count; t++)
+					this->Joints[Asked.Targets[t].Joint - 'A']->Move(Asked.Targets[t].Angle);
+			}
+			else if (Asked.Op == Wire::opHOME)
+			{
+				std::vector<JointMove*> Homed;
+				for (int t = 0; t < Asked.Count; t++)
+					Homed.push_back(this->Joints[Asked.Targets[t].Joint - 'A'].get());
+				JointMove::HomeAll(Homed);
+			}
+			else
+			{
+				CoordinatedMove Together;
+				for (int t = 0; t < Asked.Count; t++)
+					Together.Add(this->Joints[Asked.Targets[t].Joint - 'A'].get(), Asked.Targets[t].Angle);
+				Together.Execute();
+			}
+		}
+		catch (...)
+		{
+			return Wire::stFAILED;
+		}
+		return Wire::stDONE;
+	}
+
+	// Called on the worker's thread.
+	void MotionServer::Post(unsigned int Key, uint32_t Id, uint8_t Status)
+	{
+		Finished Done;
+		Done.Client = Key;
+		memset(&Done.Reply, 0, sizeof(Done.Reply));
+		Done.Reply.Id     = Id;
+		Done.Reply.Status = Status;
+		{
+			std::lock_guard<std::mutex> Hold(this->CompletedLock);
+			this->Completed.push_back(Done);
+		}
+		uint64_t One = 1;
+		if (write(this->Wake, &One, sizeof(One)) < 0) { }
+	}
+
+	// Hands the posted replies to their clients, one write per client.
+	void MotionServer::Deliver(void)
+	{
+		std::vector<Finished> Ready;
+		{
+			std::lock_guard<std::mutex> Hold(this->CompletedLock);
+			Ready.swap(this->Completed);
+		}
+
+		std::vector<unsigned int> Touched;
+		for (size_t k = 0; k < Ready.size(); k++)
+		{
+			std::map<unsigned int, Client>::iterator Found = this->Clients.find(Ready[k].Client);
+			if (Found == this->Clients.end())
+				continue;
+			Found->second.Out.append((const char*) &Ready[k].Reply, sizeof(Wire::Reply));
+			if (Touched.empty() || Touched.back() != Ready[k].Client)
+				Touched.push_back(Ready[k].Client);
+		}
+		for (size_t k = 0; k < Touched.size(); k++)
+			this->Write(Touched[k]);
+	}
+
+	MotionClient::MotionClient(void)
+	{
+		this->Socket = -1;
+		this->NextId = 1;
+	}
+
+	MotionClient::~MotionClient()
+	{
+		if (this->Socket != -1)
+			close(this->Socket);
+	}
+
+	bool MotionClient::Connect(const char* Path)
+	{
+		struct sockaddr_un Address;
+		if (!SocketAddress(Path, Address))
+			return false;
+
+		int Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (Socket == -1)
+			return false;
+		if (connect(Socket, (struct sockaddr*) &Address, sizeof(Address)) == -1)
+		{
+			close(Socket);
+			return false;
+		}
+		if (this->Socket != -1)
+			close(this->Socket);
+		this->Socket = Socket;
+		return true;
+	}
+
+	uint32_t MotionClient::Send(uint8_t Op, const Wire::Target* Targets, int Count)
+	{
+		Wire::Request Asked;
+		memset(&Asked, 0, sizeof(Asked));
+		Asked.Id    = this->NextId++;
+		Asked.Op    = Op;
+		Asked.Count = uint8_t(Count);
+		this->Out.append((const char*) &Asked, Wire::REQUEST_HEAD);
+		this->Out.append((const char*) Targets, Count * sizeof(Wire::Target));
+		return Asked.Id;
+	}
+
+	bool MotionClient::Flush(void)
+	{
+		// The socket blocks, so SendSome only stops when it is done.
+		return SendSome(this->Socket, this->Out);
+	}
+
+	bool MotionClient::Receive(Wire::Reply& Reply)
+	{
+		size_t Got = 0;
+		while (Got < sizeof(Reply))
+		{
+			ssize_t n = recv(this->Socket, (char*) &Reply + Got, sizeof(Reply) - Got, 0);
+			if (n > 0)
+				Got += size_t(n);
+			else if (n == -1 && errno == EINTR)
+				continue;
+			else
+				return false;
+		}
+		return true;
+	}
+
+	int MotionClient::Move(char Joint, double AngularPosition)
+	{
+		Wire::Target Where;
+		memset(&Where, 0, sizeof(Where));
+		Where.Joint = Joint;
+		Where.Angle = AngularPosition;
+		return this->Await(this->Send(Wire::opMOVE, &Where, 1));
+	}
+
+	int MotionClient::Home(char Joint)
+	{
+		Wire::Target Where;
+		memset(&Where, 0, sizeof(Where));
+		Where.Joint = Joint;
+		return this->Await(this->Send(Wire::opHOME, &Where, 1));
+	}
+
+	// Sends what is queued and waits for Id's final status, passing
+	// over stACCEPTED and any other request's replies.
+	int MotionClient::Await(uint32_t Id)
+	{
+		if (!this->Flush())
+			return -1;
+
+		Wire::Reply Answer;
+		while (this->Receive(Answer))
+			if (Answer.Id == Id && Answer.Status != Wire::stACCEPTED)
+				return Answer.Status;
+		return -1;
+	}
+}
+#endif
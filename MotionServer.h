@@ -0,0 +1,181 @@
+#ifndef MOTIONSERVER_H
+#define MOTIONSERVER_H
+
+#ifndef _WIN32
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "JointMoveProto.h"
+
+/*************************************************************************************
+* MotionServer.h contains class MotionServer, which owns a robot's port and joints
+* and moves them for other processes, and class MotionClient, which those processes
+* use to ask it. They talk over a Unix domain socket in fixed binary records (see
+* namespace Wire):
+*
+* - MotionServer(const RobotConfig& Config, Tserial* Port):
+*      Makes a JointMove for every joint in Config, without homing it.
+* - bool Listen(const char* Path):
+*      Listens on a socket at Path, replacing any left behind by an earlier server.
+*      Returns false if it can't.
+* - void Run(void):
+*      Serves clients until Stop is called.
+* - void Stop(void):
+*      Makes Run return. It may be called from any thread or a signal handler.
+*
+* A request moves joints (opMOVE, one Move after another), homes them
+* (opHOME, with HomeAll) or moves them together (opCOORDINATED, with
+* CoordinatedMove). It is admitted or rejected as soon as it arrives: each joint
+* must exist, be named once, lie within its bounds and, to be homed, have a
+* switch. An admitted request is answered stACCEPTED at once and stDONE or
+* stFAILED when it has finished; a rejected one is answered stREJECTED, naming the
+* joint at fault, and nothing is sent to the robot. Requests from every client run
+* in the order they arrive, on the port's PortWorker thread, and all those read
+* from a client at once are handed over together, as are the replies to them.
+*
+* - bool MotionClient::Connect(const char* Path):
+*      Connects to the server at Path. Returns false if there is none.
+* - uint32_t Send(uint8_t Op, const Wire::Target* Targets, int Count):
+*      Queues a request and returns its Id. Nothing is written until Flush.
+* - bool Flush(void):
+*      Writes the requests queued so far in one go.
+* - bool Receive(Wire::Reply& Reply):
+*      Waits for the next reply. Returns false once the server has gone.
+* - int Move(char Joint, double AngularPosition), int Home(char Joint):
+*      Send one request and wait for it to finish, for clients with nothing else
+*      in flight. They return its final status, or -1 if the server has gone.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	namespace Wire
+	{
+		enum opcode {opMOVE = 1, opHOME, opCOORDINATED};
+		enum status {stACCEPTED, stDONE, stREJECTED, stFAILED};
+
+		const int MAX_TARGETS = 8;
+
+		// The angle is ignored by opHOME.
+		struct Target
+		{
+			double   Angle;
+			char     Joint;
+			char     Reserved[7];
+		};
+
+		// Only the first Count targets are sent.
+		struct Request
+		{
+			uint32_t Id;
+			uint8_t  Op;
+			uint8_t  Count;
+			uint16_t Reserved;
+			Target   Targets[MAX_TARGETS];
+		};
+
+		// Joint is the joint at fault in a stREJECTED reply, otherwise 0.
+		struct Reply
+		{
+			uint32_t Id;
+			uint8_t  Status;
+			char     Joint;
+			uint16_t Reserved;
+		};
+
+		const size_t REQUEST_HEAD = sizeof(uint32_t) + 2 * sizeof(uint8_t) + sizeof(uint16_t);
+	}
+
+	class MotionServer
+	{
+		public:
+			MotionServer(const RobotConfig& Config, Tserial* Port);
+			~MotionServer();
+
+			bool Listen(const char* Path);
+			void Run   (void);
+			void Stop  (void);
+
+			JointMove* ViewJoint(char Joint) const { return this->Joints[Joint - 'A'].get(); }
+		private:
+			MotionServer(const MotionServer&);
+			MotionServer& operator=(const MotionServer&);
+
+			struct Client
+			{
+				int         Socket;
+				std::string In;
+				std::string Out;
+			};
+
+			// A request read from a client, to be run.
+			struct Job
+			{
+				unsigned int  Client;
+				Wire::Request Request;
+			};
+
+			// A reply to be written to a client, posted from the worker.
+			struct Finished
+			{
+				unsigned int Client;
+				Wire::Reply  Reply;
+			};
+
+			// Epoll keys below FIRST_CLIENT are the listening socket and Wake.
+			enum {LISTENER_KEY = 0, WAKE_KEY = 1, FIRST_CLIENT = 2};
+			// Bytes read from a client at a time.
+			const static size_t READ_CHUNK = 4096;
+
+			const RobotConfig&               Config;
+			Tserial*                         Port;
+			std::unique_ptr<JointMove>       Joints[8];
+			std::string                      Path;
+			int                              Listener;
+			int                              Epoll;
+			// An eventfd, written when replies are posted or Stop is called.
+			int                              Wake;
+			std::atomic<bool>                Stopping;
+			std::map<unsigned int, Client>   Clients;
+			unsigned int                     NextClient;
+			// Guards Completed, which the worker fills and Run empties.
+			std::mutex                       CompletedLock;
+			std::vector<Finished>            Completed;
+
+			void Accept (void);
+			void Read   (unsigned int Key);
+			void Write  (unsigned int Key);
+			void Drop   (unsigned int Key);
+			char Admit  (const Wire::Request& Asked) const;
+			int  Execute(const Wire::Request& Asked);
+			void Post   (unsigned int Key, uint32_t Id, uint8_t Status);
+			void Deliver(void);
+	};
+
+	class MotionClient
+	{
+		public:
+			MotionClient(void);
+			~MotionClient();
+
+			bool     Connect(const char* Path);
+			uint32_t Send   (uint8_t Op, const Wire::Target* Targets, int Count);
+			bool     Flush  (void);
+			bool     Receive(Wire::Reply& Reply);
+			int      Move   (char Joint, double AngularPosition);
+			int      Home   (char Joint);
+		private:
+			MotionClient(const MotionClient&);
+			MotionClient& operator=(const MotionClient&);
+
+			int         Socket;
+			uint32_t    NextId;
+			std::string Out;
+
+			int Await(uint32_t Id);
+	};
+}
+#endif
+#endif
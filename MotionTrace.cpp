@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include "MotionTrace.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		const char* EventName(trace_event Event)
+		{
+			switch (Event)
+			{
+				case teCOMMAND:     return "command";
+				case teQUERY:       return "query";
+				case teRESPONSE:    return "response";
+				case teSLEEP_BEGIN:
+				case teSLEEP_END:   return "sleep";
+				case teMOVE_BEGIN:
+				case teMOVE_END:    return "Move";
+				case teHOME_BEGIN:
+				case teHOME_END:    return "Home";
+				case teSTARVED:     return "starved";
+				case teSTALLED:     return "stalled";
+			}
+			return "?";
+		}
+
+		const char* MetricName(int Metric)
+		{
+			switch (Metric)
+			{
+				case tmQUERY_ROUND_TRIP:  return "query round trip";
+				case tmTIME_TO_REPLENISH: return "time to replenish";
+				case tmMOVE_DURATION:     return "move duration";
+			}
+			return "?";
+		}
+
+		// The track after H's is SWITCH_TRACK's.
+		const int SWITCH_INDEX = 8;
+
+		const char* const TRACK_NAMES[] = {"Joint A", "Joint B", "Joint C", "Joint D", "Joint E",
+		                                   "Joint F", "Joint G", "Joint H", "Switches"};
+
+		// A through H, then SWITCH_TRACK. Anything else is put with A.
+		int JointIndex(char Joint)
+		{
+			if (Joint == SWITCH_TRACK)
+				return SWITCH_INDEX;
+			return Joint >= 'A' && Joint <= 'H' ? Joint - 'A' : 0;
+		}
+	}
+
+	/********************************************************************
+	*                   LatencyHistogram
+	********************************************************************/
+	LatencyHistogram::LatencyHistogram(void)
+	{
+		this->Clear();
+	}
+
+	void LatencyHistogram::Clear(void)
+	{
+		for (int k = 0; k < BUCKETS; k++)
+			this->Counts[k].store(0, std::memory_order_relaxed);
+		this->Total.store(0, std::memory_order_relaxed);
+		this->Largest.store(0, std::memory_order_relaxed);
+	}
+
+	/********************************************************************
+	*                   LatencyHistogram::IndexOf
+	* Values below 2^SUB_BITS get a bucket each; above that, each power
+	* of two is split into 2^SUB_BITS equal buckets.
+	********************************************************************/
+	int LatencyHistogram::IndexOf(uint64_t Micros)
+	{
+		if (Micros < (uint64_t(1) << SUB_BITS))
+			return int(Micros);
+
+		int Magnitude = 63;
+		while (!(Micros >> Magnitude))
+			Magnitude--;
+
+		int Shift = Magnitude - SUB_BITS;
+		int Index = ((Shift + 1) << SUB_BITS) + int((Micros >> Shift) & ((1 << SUB_BITS) - 1));
+		return Index < BUCKETS ? Index : BUCKETS - 1;
+	}
+
+	// The largest value that falls in bucket Index.
+	uint64_t LatencyHistogram::ValueAt(int Index)
+	{
+		if (Index < (1 << SUB_BITS))
+			return uint64_t(Index);
+
+		int      Shift = (Index >> SUB_BITS) - 1;
+		uint64_t Sub   = uint64_t(Index & ((1 << SUB_BITS) - 1)) | (uint64_t(1) << SUB_BITS);
+		return ((Sub + 1) << Shift) - 1;
+	}
+
+	void LatencyHistogram::Record(uint64_t Micros)
+	{
+		this->Counts[IndexOf(Micros)].fetch_add(1, std::memory_order_relaxed);
+		this->Total.fetch_add(Micros, std::memory_order_relaxed);
+
+		uint64_t Seen = this->Largest.load(std::memory_order_relaxed);
+		while (Micros > Seen && !this->Largest.compare_exchange_weak(Seen, Micros, std::memory_order_relaxed))
+			;
+	}
+
+	uint64_t LatencyHistogram::Count(void) const
+	{
+		uint64_t Sum = 0;
+		for (int k = 0; k < BUCKETS; k++)
+			Sum += this->Counts[k].load(std::memory_order_relaxed);
+		return Sum;
+	}
+
+	double LatencyHistogram::Mean(void) const
+	{
+		uint64_t Samples = this->Count();
+		return Samples ? double(this->Total.load(std::memory_order_relaxed)) / Samples : 0;
+	}
+
+	uint64_t LatencyHistogram::Percentile(double Fraction) const
+	{
+		uint64_t Samples = this->Count();
+		if (Samples == 0)
+			return 0;
+
+		uint64_t Wanted = uint64_t(Fraction * Samples + 0.5);
+		if (Wanted < 1)
+			Wanted = 1;
+
+		uint64_t Seen = 0;
+		for (int k = 0; k < BUCKETS; k++)
+		{
+			Seen += this->Counts[k].load(std::memory_order_relaxed);
+			if (Seen >= Wanted)
+			{
+				uint64_t Value = ValueAt(k);
+				return Value < this->Max() ? Value : this->Max();
+			}
+		}
+		return this->Max();
+	}
+
+	/********************************************************************
+	*                   MotionTrace
+	********************************************************************/
+	MotionTrace& MotionTrace::Global(void)
+	{
+		static MotionTrace Recorder;
+		return Recorder;
+	}
+
+	MotionTrace::MotionTrace(unsigned int Capacity)
+	{
+		uint64_t Size = 1;
+		while (Size < Capacity)
+			Size <<= 1;
+
+		this->Slots = new Slot[Size];
+		this->Mask  = Size - 1;
+		this->Enabled.store(false, std::memory_order_relaxed);
+		this->Clear();
+	}
+
+	MotionTrace::~MotionTrace()
+	{
+		delete [] this->Slots;
+	}
+
+	uint64_t MotionTrace::Now(void)
+	{
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	/********************************************************************
+	*                   MotionTrace::Clear
+	* Empties the ring and the histograms. Not safe to call while other
+	* threads are recording.
+	********************************************************************/
+	void MotionTrace::Clear(void)
+	{
+		for (uint64_t k = 0; k <= this->Mask; k++)
+			this->Slots[k].Sequence.store(0, std::memory_order_relaxed);
+		this->Head.store(0, std::memory_order_relaxed);
+		for (int j = 0; j < TRACKS; j++)
+			for (int m = 0; m < tmMETRIC_COUNT; m++)
+				this->Histograms[j][m].Clear();
+	}
+
+	void MotionTrace::Record(trace_event Event, char Joint, int Value, uint64_t Nanos)
+	{
+		uint64_t Ticket = this->Head.fetch_add(1, std::memory_order_relaxed);
+		Slot&    Entry  = this->Slots[Ticket & this->Mask];
+		uint64_t Packed = uint64_t(uint32_t(Value)) | uint64_t(uint8_t(Joint)) << 32
+		                | uint64_t(uint8_t(Event)) << 40;
+
+		Entry.Sequence.store(2 * Ticket + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		Entry.Nanos.store(Nanos, std::memory_order_relaxed);
+		Entry.Packed.store(Packed, std::memory_order_relaxed);
+		Entry.Sequence.store(2 * Ticket + 2, std::memory_order_release);
+	}
+
+	/********************************************************************
+	*                   MotionTrace::Snapshot
+	* Copies every complete record still in the ring. A slot that is
+	* being written, or gets overwritten while it is copied, is skipped.
+	********************************************************************/
+	void MotionTrace::Snapshot(std::vector<TraceRecord>& Out) const
+	{
+		uint64_t Head  = this->Head.load(std::memory_order_acquire);
+		uint64_t Size  = this->Mask + 1;
+		uint64_t First = Head > Size ? Head - Size : 0;
+
+		Out.clear();
+		for (uint64_t Ticket = First; Ticket < Head; Ticket++)
+		{
+			const Slot& Entry = this->Slots[Ticket & this->Mask];
+			uint64_t Before = Entry.Sequence.load(std::memory_order_acquire);
+			if (Before != 2 * Ticket + 2)
+				continue;
+
+			uint64_t Nanos  = Entry.Nanos.load(std::memory_order_relaxed);
+			uint64_t Packed = Entry.Packed.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (Entry.Sequence.load(std::memory_order_relaxed) != Before)
+				continue;
+
+			TraceRecord Record;
+			Record.Nanos = Nanos;
+			Record.Value = int(uint32_t(Packed));
+			Record.Joint = char(uint8_t(Packed >> 32));
+			Record.Event = trace_event(uint8_t(Packed >> 40));
+			Out.push_back(Record);
+		}
+	}
+
+	LatencyHistogram& MotionTrace::Histogram(char Joint, trace_metric Metric)
+	{
+		return this->Histograms[JointIndex(Joint)][Metric];
+	}
+
+	/********************************************************************
+	*                   MotionTrace::WriteChromeTrace
+	* Each joint, and the switches, becomes a thread in the trace.
+	* Moves, homes and sleeps are spans; commands, queries and responses
+	* are instant events carrying their value. Returns false if the file
+	* can't be written.
+	********************************************************************/
+	bool MotionTrace::WriteChromeTrace(const char* Filename) const
+	{
+		FILE* Out = fopen(Filename, "w");
+		if (!Out)
+			return false;
+
+		std::vector<TraceRecord> Records;
+		this->Snapshot(Records);
+
+		fprintf(Out, "{\"traceEvents\":[\n");
+		bool Named[TRACKS] = {false};
+		bool First    = true;
+		for (size_t k = 0; k < Records.size(); k++)
+		{
+			const TraceRecord& R = Records[k];
+			int Track = JointIndex(R.Joint);
+			if (!Named[Track])
+			{
+				fprintf(Out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				             "\"args\":{\"name\":\"%s\"}}", First ? "" : ",\n", Track, TRACK_NAMES[Track]);
+				Named[Track] = true;
+				First = false;
+			}
+
+			const char* Phase = "i";
+			if (R.Event == teSLEEP_BEGIN || R.Event == teMOVE_BEGIN || R.Event == teHOME_BEGIN)
+				Phase = "B";
+			else if (R.Event == teSLEEP_END || R.Event == teMOVE_END || R.Event == teHOME_END)
+				Phase = "E";
+
+			fprintf(Out, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+			        EventName(R.Event), Phase, R.Nanos / 1000.0, Track);
+			if (Phase[0] == 'i')
+				fprintf(Out, ",\"s\":\"t\",\"args\":{\"value\":%d}", R.Value);
+			fprintf(Out, "}");
+		}
+		fprintf(Out, "\n]}\n");
+		return fclose(Out) == 0;
+	}
+
+	void MotionTrace::WriteSummary(std::ostream& Out) const
+	{
+		for (int j = 0; j < TRACKS; j++)
+		{
+			for (int m = 0; m < tmMETRIC_COUNT; m++)
+			{
+				const LatencyHistogram& H = this->Histograms[j][m];
+				if (H.Count() == 0)
+					continue;
+				if (j == SWITCH_INDEX)
+					Out << "Switches";
+				else
+					Out << char('A' + j);
+				Out << " " << MetricName(m) << " (us): n=" << H.Count()
+				    << " mean=" << H.Mean() << " p50=" << H.Percentile(0.5)
+				    << " p90=" << H.Percentile(0.9) << " p99=" << H.Percentile(0.99)
+				    << " max=" << H.Max() << "\n";
+			}
+		}
+	}
+}
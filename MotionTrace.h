@@ -0,0 +1,146 @@
+#ifndef MOTIONTRACE_H
+#define MOTIONTRACE_H
+
+#include <atomic>
+#include <ostream>
+#include <vector>
+#include <stdint.h>
+
+/*************************************************************************************
+* MotionTrace.h contains the flight recorder for serial traffic and its timing:
+*
+* - void Trace(trace_event Event, char Joint, int Value):
+*      Records one event in the global ring, stamped with the monotonic clock.
+*      Does nothing (one relaxed load) while tracing is disabled.
+* - MotionTrace& MotionTrace::Global(void):
+*      The recorder JointMove writes to. Tracing starts disabled; Enable(true)
+*      turns it on.
+* - void Snapshot(std::vector<TraceRecord>& Out):
+*      Copies the records still in the ring, oldest first.
+* - LatencyHistogram& Histogram(char Joint, trace_metric Metric):
+*      Per-joint latency distributions: register query round trip, time spent
+*      waiting for the register to drain to the replenish level, and total Move
+*      duration.
+* - bool WriteChromeTrace(const char* Filename):
+*      Writes the ring as Chrome trace JSON (chrome://tracing, Perfetto), one
+*      track per joint, and one more, "Switches", for SWITCH_TRACK.
+* - void WriteSummary(std::ostream& Out):
+*      Prints count, mean and percentiles of every non-empty histogram.
+*
+* Recording never takes a lock or allocates: a writer claims a slot with one
+* atomic increment and publishes it with a per-slot sequence number, and the
+* histograms are arrays of atomic counters. When the ring is full the oldest
+* records are overwritten.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	enum trace_event {teCOMMAND, teQUERY, teRESPONSE, teSLEEP_BEGIN, teSLEEP_END,
+	                  teMOVE_BEGIN, teMOVE_END, teHOME_BEGIN, teHOME_END, teSTARVED, teSTALLED};
+
+	enum trace_metric {tmQUERY_ROUND_TRIP, tmTIME_TO_REPLENISH, tmMOVE_DURATION, tmMETRIC_COUNT};
+
+	// The I command answers for every joint, so it is traced as this joint,
+	// which has a track and histograms of its own.
+	const char SWITCH_TRACK = 'I';
+
+	struct TraceRecord
+	{
+		// Nanoseconds on the monotonic clock.
+		uint64_t    Nanos;
+		trace_event Event;
+		char        Joint;
+		// Ticks sent for teCOMMAND, the register or switch byte for teRESPONSE,
+		// the register for teSTALLED (-1 if the robot stopped answering).
+		int         Value;
+	};
+
+	/********************************************************************
+	* LatencyHistogram: counts of durations in microseconds, kept in
+	* log-linear buckets (HdrHistogram's layout) that resolve any value
+	* to within about 3%.
+	********************************************************************/
+	class LatencyHistogram
+	{
+		public:
+			LatencyHistogram(void);
+
+			void     Record    (uint64_t Micros);
+			void     Clear     (void);
+			uint64_t Count     (void) const;
+			uint64_t Max       (void) const { return this->Largest.load(std::memory_order_relaxed); }
+			double   Mean      (void) const;
+			// The smallest value at or above the given fraction (0 to 1) of samples.
+			uint64_t Percentile(double Fraction) const;
+		private:
+			// 32 sub-buckets per power of two, powers up to 2^40 microseconds.
+			static const int SUB_BITS = 5;
+			static const int BUCKETS  = (40 - SUB_BITS + 1) << SUB_BITS;
+
+			std::atomic<uint64_t> Counts[BUCKETS];
+			std::atomic<uint64_t> Total;
+			std::atomic<uint64_t> Largest;
+
+			static int      IndexOf   (uint64_t Micros);
+			static uint64_t ValueAt   (int Index);
+	};
+
+	class MotionTrace
+	{
+		public:
+			static MotionTrace& Global(void);
+
+			// Capacity is rounded up to a power of two.
+			MotionTrace(unsigned int Capacity = 1 << 16);
+			~MotionTrace();
+
+			void Enable   (bool On)   { this->Enabled.store(On, std::memory_order_relaxed); }
+			bool IsEnabled(void) const { return this->Enabled.load(std::memory_order_relaxed); }
+
+			void              Record       (trace_event Event, char Joint, int Value, uint64_t Nanos);
+			void              Snapshot     (std::vector<TraceRecord>& Out) const;
+			LatencyHistogram& Histogram    (char Joint, trace_metric Metric);
+			void              Clear        (void);
+			bool              WriteChromeTrace(const char* Filename) const;
+			void              WriteSummary (std::ostream& Out) const;
+
+			static uint64_t   Now          (void);
+		private:
+			MotionTrace(const MotionTrace&);
+			MotionTrace& operator=(const MotionTrace&);
+
+			// A record packed into two words, so that readers and writers
+			// only ever touch atomics. Sequence is 2n+1 while ticket n is
+			// being written and 2n+2 once it is complete.
+			struct Slot
+			{
+				std::atomic<uint64_t> Sequence;
+				std::atomic<uint64_t> Nanos;
+				std::atomic<uint64_t> Packed;
+			};
+
+			std::atomic<bool>     Enabled;
+			std::atomic<uint64_t> Head;
+			Slot*                 Slots;
+			uint64_t              Mask;
+			// A track, and a set of histograms, for each joint A through H
+			// and for SWITCH_TRACK.
+			static const int      TRACKS = 9;
+			LatencyHistogram      Histograms[TRACKS][tmMETRIC_COUNT];
+	};
+
+	inline void Trace(trace_event Event, char Joint, int Value = 0)
+	{
+		MotionTrace& Recorder = MotionTrace::Global();
+		if (Recorder.IsEnabled())
+			Recorder.Record(Event, Joint, Value, MotionTrace::Now());
+	}
+
+	// Adds a duration, in seconds, to a joint's histogram if tracing is on.
+	inline void TraceLatency(char Joint, trace_metric Metric, double Seconds)
+	{
+		MotionTrace& Recorder = MotionTrace::Global();
+		if (Recorder.IsEnabled() && Seconds >= 0)
+			Recorder.Histogram(Joint, Metric).Record(uint64_t(Seconds * 1e6 + 0.5));
+	}
+}
+#endif
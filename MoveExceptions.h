@@ -3,6 +3,21 @@
 namespace TLeyson_Robot
 {
 	class BoundaryViolationException { };
-	class StalledMovementException   { };
+	// Register is the value the joint's register was stuck at, or -1 if the
+	// robot stopped answering. Waited is how long, in seconds, it had been
+	// stuck or silent, and Limit how long it was allowed.
+	class StalledMovementException
+	{
+		public:
+			char   Joint;
+			int    Register;
+			double Waited;
+			double Limit;
+			StalledMovementException(char Joint = 0, int Register = -1, double Waited = 0, double Limit = 0)
+				: Joint(Joint), Register(Register), Waited(Waited), Limit(Limit) { }
+	};
+	class CalibrationFailedException { };
+	// Joints that have to share one serial port are on different ones.
+	class PortMismatchException { };
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include <map>
+#include <memory>
+#include "PortWorker.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		// Everything known about one serial port. Entries are never removed,
+		// so a reference to a port's mutex stays valid for the whole program.
+		struct PortEntry
+		{
+			std::mutex                  Lock;
+			std::unique_ptr<PortWorker> Worker;
+		};
+
+		std::mutex                           RegistryLock;
+		std::map< Tserial*, PortEntry* >&    Registry(void)
+		{
+			static std::map< Tserial*, PortEntry* > Ports;
+			return Ports;
+		}
+
+		PortEntry& EntryFor(Tserial* Port)
+		{
+			std::lock_guard<std::mutex> Hold(RegistryLock);
+			PortEntry*& Entry = Registry()[Port];
+			if (!Entry)
+				Entry = new PortEntry;
+			return *Entry;
+		}
+	}
+
+	PortWorker& PortWorker::For(Tserial* Port)
+	{
+		PortEntry& Entry = EntryFor(Port);
+		std::lock_guard<std::mutex> Hold(RegistryLock);
+		if (!Entry.Worker)
+			Entry.Worker.reset(new PortWorker);
+		return *Entry.Worker;
+	}
+
+	void PortWorker::Release(Tserial* Port)
+	{
+		PortEntry& Entry = EntryFor(Port);
+		std::unique_ptr<PortWorker> Worker;
+		{
+			std::lock_guard<std::mutex> Hold(RegistryLock);
+			Worker.swap(Entry.Worker);
+		}
+		// The destructor drains the queue and joins the thread.
+	}
+
+	std::mutex& PortWorker::Lock(Tserial* Port)
+	{
+		return EntryFor(Port).Lock;
+	}
+
+	PortWorker::PortWorker(void)
+	{
+		this->Stopping = false;
+		this->Thread   = std::thread(&PortWorker::Run, this);
+	}
+
+	PortWorker::~PortWorker()
+	{
+		{
+			std::lock_guard<std::mutex> Hold(this->QueueLock);
+			this->Stopping = true;
+		}
+		this->QueueReady.notify_one();
+		if (this->Thread.joinable())
+			this->Thread.join();
+	}
+
+	/********************************************************************
+	*                   PortWorker::Submit
+	* Wraps Work so that its result, or the exception it throws, lands
+	* in the returned future and is passed to Done.
+	********************************************************************/
+	std::future<int> PortWorker::Submit(std::function<int()> Work, Completion Done)
+	{
+		std::shared_ptr< std::promise<int> > Result(new std::promise<int>);
+		std::future<int> Future = Result->get_future();
+
+		std::function<void()> Task = [Work, Done, Result]()
+		{
+			int                Value = 0;
+			std::exception_ptr Error;
+			try
+			{
+				Value = Work();
+			}
+			catch (...)
+			{
+				Error = std::current_exception();
+			}
+
+			Complete(*Result, Done, Value, Error);
+		};
+
+		{
+			std::lock_guard<std::mutex> Hold(this->QueueLock);
+			this->Queue.push_back(Task);
+		}
+		this->QueueReady.notify_one();
+		return Future;
+	}
+
+	void PortWorker::Complete(std::promise<int>& Result, const Completion& Done, int Value, std::exception_ptr Error)
+	{
+		if (Error)
+			Result.set_exception(Error);
+		else
+			Result.set_value(Value);
+
+		if (!Done)
+			return;
+		try
+		{
+			Done(Value, Error);
+		}
+		catch (...)
+		{
+		}
+	}
+
+	/********************************************************************
+	*                   PortWorker::Run
+	* The worker's thread: takes tasks off the queue in order until it
+	* is told to stop and the queue is empty. It sleeps on a condition
+	* variable while there is nothing to do.
+	********************************************************************/
+	void PortWorker::Run(void)
+	{
+		for (;;)
+		{
+			std::function<void()> Task;
+			{
+				std::unique_lock<std::mutex> Hold(this->QueueLock);
+				while (this->Queue.empty() && !this->Stopping)
+					this->QueueReady.wait(Hold);
+				if (this->Queue.empty())
+					return;
+				Task = this->Queue.front();
+				this->Queue.pop_front();
+			}
+			Task();
+		}
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef PORTWORKER_H
+#define PORTWORKER_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include "tserial.h"
+
+/*************************************************************************************
+* PortWorker.h contains class PortWorker, the single I/O thread that owns a Tserial
+* for asynchronous work:
+*
+* - static PortWorker& For(Tserial* Port):
+*      The worker for Port, started the first time it is asked for.
+* - std::future<int> Submit(std::function<int()> Work, Completion Done):
+*      Queues Work to run on the worker's thread, after everything queued before
+*      it. The future holds Work's result or the exception it threw. If Done is
+*      given, it is called on the worker's thread as soon as the future is ready,
+*      with the result or the exception.
+* - static void Complete(std::promise<int>& Result, const Completion& Done,
+*                        int Value, std::exception_ptr Error):
+*      Makes Result ready with Value, or with Error if there is one, then calls
+*      Done. Whatever Done throws is dropped, so a faulty callback can neither
+*      take down the thread it runs on nor leave a future unready.
+* - static void Release(Tserial* Port):
+*      Runs whatever is still queued for Port, then stops its worker. Call it
+*      before the Tserial is disconnected or destroyed.
+* - static std::mutex& Lock(Tserial* Port):
+*      The mutex held by whoever is talking to Port, on any thread. JointMove takes
+*      it for the length of a Move or Home, so a synchronous call waits for an
+*      asynchronous one to finish and the other way around.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	typedef std::function<void(int Result, std::exception_ptr Error)> Completion;
+
+	class PortWorker
+	{
+		public:
+			static PortWorker& For    (Tserial* Port);
+			static void        Release(Tserial* Port);
+			static std::mutex& Lock   (Tserial* Port);
+			static void        Complete(std::promise<int>& Result, const Completion& Done,
+			                            int Value, std::exception_ptr Error);
+
+			std::future<int> Submit(std::function<int()> Work, Completion Done = Completion());
+
+			// True when called from this worker's own thread.
+			bool OnWorkerThread(void) const { return std::this_thread::get_id() == this->Thread.get_id(); }
+
+			~PortWorker();
+		private:
+			PortWorker(void);
+			PortWorker(const PortWorker&);
+			PortWorker& operator=(const PortWorker&);
+
+			std::deque< std::function<void()> > Queue;
+			std::mutex                          QueueLock;
+			std::condition_variable             QueueReady;
+			bool                                Stopping;
+			std::thread                         Thread;
+
+			void Run(void);
+	};
+}
+#endif
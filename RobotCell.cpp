@@ -0,0 +1,553 @@
+#ifndef _WIN32
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <functional>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "RobotCell.h"
+#include "MotionTrace.h"
+#include "CommandEncoder.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		// The sooner of two times, where 0 means never.
+		double Sooner(double First, double Second)
+		{
+			if (First == 0)
+				return Second;
+			return Second == 0 || First < Second ? First : Second;
+		}
+	}
+
+	RobotCell::RobotCell(int Shards, double SwitchPeriod)
+	{
+		this->SwitchPeriod = SwitchPeriod;
+		this->Running      = false;
+		for (int s = 0; s < (Shards > 0 ? Shards : 1); s++)
+		{
+			Shard* Loop    = new Shard;
+			Loop->Epoll    = epoll_create1(EPOLL_CLOEXEC);
+			Loop->Wake     = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			Loop->Stopping = false;
+
+			struct epoll_event Event;
+			Event.events   = EPOLLIN;
+			Event.data.ptr = 0;
+			epoll_ctl(Loop->Epoll, EPOLL_CTL_ADD, Loop->Wake, &Event);
+			this->Shards.push_back(std::unique_ptr<Shard>(Loop));
+		}
+	}
+
+	// The joints go before the ports they talk through.
+	RobotCell::~RobotCell()
+	{
+		this->Stop();
+		this->Axes.clear();
+		for (size_t r = 0; r < this->Robots.size(); r++)
+		{
+			SwitchPoller::Release(this->Robots[r]->Port.get());
+			this->Robots[r]->Port->disconnect();
+		}
+		for (size_t s = 0; s < this->Shards.size(); s++)
+		{
+			close(this->Shards[s]->Epoll);
+			close(this->Shards[s]->Wake);
+		}
+	}
+
+	/********************************************************************
+	*                   RobotCell::AddPort
+	* Ports are dealt out to the loops in turn.
+	* Precondition:  The cell isn't running.
+	********************************************************************/
+	Tserial* RobotCell::AddPort(const char* Device, int Rate)
+	{
+		std::unique_ptr<Tserial> Port(new Tserial);
+		if (Port->connect(Device, Rate, spEVEN) != 0)
+			throw FileNotFoundException(const_cast<char*>(Device));
+
+		Robot* Arm         = new Robot;
+		Arm->Port          = std::move(Port);
+		Arm->Loop          = this->Shards[this->Robots.size() % this->Shards.size()].get();
+		Arm->SwitchAsked   = false;
+		Arm->SwitchTicket  = 0;
+		Arm->SwitchAskedAt = 0;
+		Arm->SwitchDue     = 0;
+		this->Robots.push_back(std::unique_ptr<Robot>(Arm));
+		Arm->Loop->Robots.push_back(Arm);
+
+		struct epoll_event Event;
+		Event.events   = EPOLLIN;
+		Event.data.ptr = Arm;
+		epoll_ctl(Arm->Loop->Epoll, EPOLL_CTL_ADD, Arm->Port->descriptor(), &Event);
+		return Arm->Port.get();
+	}
+
+	JointMove* RobotCell::AddJoint(Tserial* Port, char Joint, const RobotConfig& Config, bool LimitSwitch)
+	{
+		Robot* Arm  = this->Find(Port);
+		Axis*  Part = new Axis;
+		this->Axes.push_back(std::unique_ptr<Axis>(Part));
+		Part->Joint.reset(new JointMove(Joint, Config, Port, LimitSwitch));
+		Part->Arm       = Arm;
+		Part->State     = asIDLE;
+		Part->Target    = 0;
+		Part->Direction = '+';
+		Part->Groups    = 0;
+		Part->Due       = 0;
+		Part->Requery   = false;
+		Part->Refilling = false;
+		Part->Started   = 0;
+		Part->Waiting   = 0;
+		EncodeCommand(Part->QueryString, Part->Joint->JointToMove, '?');
+		Part->QueryString[4] = '\0';
+		Arm->Axes.push_back(Part);
+		return Part->Joint.get();
+	}
+
+	void RobotCell::Start(void)
+	{
+		if (this->Running)
+			return;
+		this->Running = true;
+		for (size_t s = 0; s < this->Shards.size(); s++)
+		{
+			this->Shards[s]->Stopping = false;
+			this->Shards[s]->Thread   = std::thread(&RobotCell::Run, this, std::ref(*this->Shards[s]));
+		}
+	}
+
+	void RobotCell::Stop(void)
+	{
+		if (!this->Running)
+			return;
+		for (size_t s = 0; s < this->Shards.size(); s++)
+		{
+			Shard& Loop = *this->Shards[s];
+			{
+				std::lock_guard<std::mutex> Hold(Loop.Lock);
+				Loop.Stopping = true;
+			}
+			uint64_t One = 1;
+			if (write(Loop.Wake, &One, sizeof(One)) < 0) { }
+		}
+		for (size_t s = 0; s < this->Shards.size(); s++)
+			this->Shards[s]->Thread.join();
+		this->Running = false;
+	}
+
+	/********************************************************************
+	*                   RobotCell::Move
+	* Hands the request to the joint's loop and wakes it.
+	* Precondition:  Joint came from AddJoint.
+	********************************************************************/
+	std::future<int> RobotCell::Move(JointMove* Joint, double AngularPosition, Completion Done)
+	{
+		Axis*   Part = this->Find(Joint);
+		Request Asked;
+		Asked.Angle  = AngularPosition;
+		Asked.Done   = Done;
+		Asked.Result.reset(new std::promise<int>);
+		std::future<int> Future = Asked.Result->get_future();
+
+		Shard& Loop = *Part->Arm->Loop;
+		{
+			std::lock_guard<std::mutex> Hold(Loop.Lock);
+			Loop.Incoming.push_back(std::make_pair(Part, Asked));
+		}
+		uint64_t One = 1;
+		if (write(Loop.Wake, &One, sizeof(One)) < 0) { }
+		return Future;
+	}
+
+	RobotCell::Robot* RobotCell::Find(Tserial* Port) const
+	{
+		for (size_t r = 0; r < this->Robots.size(); r++)
+			if (this->Robots[r]->Port.get() == Port)
+				return this->Robots[r].get();
+		return 0;
+	}
+
+	RobotCell::Axis* RobotCell::Find(JointMove* Joint) const
+	{
+		for (size_t a = 0; a < this->Axes.size(); a++)
+			if (this->Axes[a]->Joint.get() == Joint)
+				return this->Axes[a].get();
+		return 0;
+	}
+
+	/********************************************************************
+	*                   RobotCell::Run
+	* One loop's thread. Each pass takes in new requests, does whatever
+	* has fallen due on each port, then sleeps in epoll_wait until the
+	* next thing is due, a port has replies, or the loop is woken. Once
+	* told to stop, it carries on until every joint is idle.
+	* Postcondition: The loop's ports are unlocked.
+	********************************************************************/
+	void RobotCell::Run(Shard& Loop)
+	{
+		// Locked in address order, as CoordinatedMove locks them.
+		std::vector<Tserial*> Ports;
+		for (size_t r = 0; r < Loop.Robots.size(); r++)
+			Ports.push_back(Loop.Robots[r]->Port.get());
+		std::sort(Ports.begin(), Ports.end());
+		std::vector< std::unique_ptr< std::lock_guard<std::mutex> > > Held;
+		for (size_t p = 0; p < Ports.size(); p++)
+			Held.push_back(std::unique_ptr< std::lock_guard<std::mutex> >(
+				new std::lock_guard<std::mutex>(PortWorker::Lock(Ports[p]))));
+
+		std::vector< std::pair<Axis*, Request> > Arrived;
+		struct epoll_event Events[EVENT_BATCH];
+		for (;;)
+		{
+			bool Stopping;
+			{
+				std::lock_guard<std::mutex> Hold(Loop.Lock);
+				Arrived.swap(Loop.Incoming);
+				Stopping = Loop.Stopping;
+			}
+			for (size_t k = 0; k < Arrived.size(); k++)
+				Arrived[k].first->Queue.push_back(Arrived[k].second);
+			Arrived.clear();
+
+			double Now  = MonotonicSeconds();
+			double Wake = 0;
+			bool   Busy = false;
+			for (size_t r = 0; r < Loop.Robots.size(); r++)
+				Wake = Sooner(Wake, this->Service(*Loop.Robots[r], Now, Stopping, Busy));
+			if (Stopping && !Busy)
+				break;
+
+			int Timeout = -1;
+			if (Wake > 0)
+			{
+				double Left = std::ceil((Wake - MonotonicSeconds()) * 1000);
+				Timeout = Left > 0 ? int(Left) : 0;
+			}
+			int Ready = epoll_wait(Loop.Epoll, Events, EVENT_BATCH, Timeout);
+			for (int e = 0; e < Ready; e++)
+			{
+				if (Events[e].data.ptr == 0)
+				{
+					uint64_t Count;
+					if (read(Loop.Wake, &Count, sizeof(Count)) < 0) { }
+					continue;
+				}
+				this->Receive(*(Robot*) Events[e].data.ptr, MonotonicSeconds());
+			}
+		}
+	}
+
+	/********************************************************************
+	*                   RobotCell::Service
+	* Starts the next move of every idle joint that has one queued,
+	* sends what is due, and asks for the switches if a reading is due
+	* and the loop isn't Stopping. Returns when the port next needs
+	* attention, or 0 if only a reply or a new request can give it any.
+	* Busy is set if any joint on the port is moving or has moves queued,
+	* or a reply is still to come. A reply that takes longer than the
+	* port's timeout is given up on, and the joint waiting for it is
+	* stopped and its move failed, as CollectRegister would; either
+	* way the port's line is abandoned (see Abandon).
+	********************************************************************/
+	double RobotCell::Service(Robot& Arm, double Now, bool Stopping, bool& Busy)
+	{
+		double Next    = 0;
+		double Timeout = Arm.Port->getTimeout() / 1000.0;
+
+		Arm.Port->beginBatch();
+		for (size_t a = 0; a < Arm.Axes.size(); a++)
+		{
+			Axis& Part = *Arm.Axes[a];
+			if (Part.State == asIDLE)
+				this->Begin(Part, Now);
+			if (Part.State == asWAITING && Part.Due <= Now)
+				this->Replenish(Part, Now);
+			if (Part.State == asWAITING)
+				Next = Sooner(Next, Part.Due);
+			if (Part.State == asASKED && Timeout > 0)
+			{
+				JointMove& Joint = *Part.Joint;
+				if (Now - Joint.QueryAsked > Timeout)
+				{
+					Trace(teSTALLED, Joint.JointToMove, -1);
+					Joint.Stop();
+					this->Finish(Part, std::make_exception_ptr(
+						StalledMovementException(Joint.JointToMove, -1, Now - Joint.QueryAsked, Timeout)));
+					this->Abandon(Arm, Now);
+					Next = Now;
+				}
+				else
+					Next = Sooner(Next, Joint.QueryAsked + Timeout);
+			}
+			if (Part.State != asIDLE || !Part.Queue.empty())
+				Busy = true;
+		}
+
+		if (Arm.SwitchAsked && Timeout > 0 && Now - Arm.SwitchAskedAt > Timeout)
+		{
+			this->Abandon(Arm, Now);
+			Next = Now;
+		}
+		if (Arm.SwitchAsked)
+		{
+			Busy = true;
+			if (Timeout > 0)
+				Next = Sooner(Next, Arm.SwitchAskedAt + Timeout);
+		}
+		else if (this->SwitchPeriod > 0 && !Stopping)
+		{
+			if (Arm.SwitchDue <= Now)
+			{
+				char Command = 'I';
+				Trace(teQUERY, SWITCH_TRACK, 'I');
+				Arm.SwitchTicket  = Arm.Port->sendQuery(&Command, 1);
+				Arm.SwitchAsked   = true;
+				Arm.SwitchAskedAt = Now;
+				Arm.SwitchDue     = Now + this->SwitchPeriod;
+			}
+			else
+				Next = Sooner(Next, Arm.SwitchDue);
+		}
+		Arm.Port->endBatch();
+		return Next;
+	}
+
+	/********************************************************************
+	*                   RobotCell::Receive
+	* Takes whatever replies have arrived on the port and hands each to
+	* the joint, or the switch reading, that asked for it. Any groups
+	* they let go are sent together.
+	********************************************************************/
+	void RobotCell::Receive(Robot& Arm, double Now)
+	{
+		Tserial& Port = *Arm.Port;
+		if (Port.receiveReplies() == 0)
+			return;
+
+		Port.beginBatch();
+		for (size_t a = 0; a < Arm.Axes.size(); a++)
+		{
+			Axis& Part = *Arm.Axes[a];
+			if (Part.State != asASKED || !Port.hasReply(Part.Joint->QueryTicket))
+				continue;
+			try
+			{
+				this->Answer(Part, Part.Joint->CollectRegister(), Now);
+			}
+			catch (...)
+			{
+				this->Finish(Part, std::current_exception());
+			}
+		}
+		Port.endBatch();
+
+		if (Arm.SwitchAsked && Port.hasReply(Arm.SwitchTicket))
+		{
+			SwitchState Reading;
+			Reading.Bits   = char(Port.getReply(Arm.SwitchTicket) - 32);
+			Reading.Time   = (Arm.SwitchAskedAt + Now) / 2;
+			Reading.Failed = false;
+			Arm.SwitchAsked = false;
+			// Lost to an abandoned line, so it is asked for again.
+			if (!Port.timedOut())
+			{
+				Trace(teRESPONSE, SWITCH_TRACK, Reading.Bits);
+				SwitchPoller::For(&Port).Publish(Reading);
+			}
+		}
+	}
+
+	/********************************************************************
+	*                   RobotCell::Abandon
+	* A reply has been given up on, and the robot answers in order, so
+	* every query still on the port's line is abandoned with it and any
+	* late replies are thrown away (see abandonReplies in tserial.h).
+	* The other joints that were waiting for the register ask again at
+	* once, and the switches are asked for again when next due.
+	********************************************************************/
+	void RobotCell::Abandon(Robot& Arm, double Now)
+	{
+		Arm.Port->abandonReplies();
+		for (size_t a = 0; a < Arm.Axes.size(); a++)
+		{
+			Axis& Part = *Arm.Axes[a];
+			if (Part.State != asASKED)
+				continue;
+			Part.State   = asWAITING;
+			Part.Requery = true;
+			Part.Due     = Now;
+		}
+		Arm.SwitchAsked = false;
+	}
+
+	/********************************************************************
+	*                   RobotCell::Begin
+	* Starts the joint's next queued move the way Move starts one: checks
+	* the bounds, sends the odd group and waits to send the rest. Moves
+	* with nothing to send, or out of bounds, finish on the spot and the
+	* next is taken.
+	* Precondition:  The joint is idle.
+	********************************************************************/
+	void RobotCell::Begin(Axis& Part, double Now)
+	{
+		JointMove& Joint = *Part.Joint;
+
+		while (Part.State == asIDLE && !Part.Queue.empty())
+		{
+			Part.Current = Part.Queue.front();
+			Part.Queue.pop_front();
+			double Angle = Part.Current.Angle;
+
+			try
+			{
+				if ( !(Angle > Joint.LowerBound && Angle < Joint.UpperBound) )
+					throw BoundaryViolationException();
+				Part.Target = Joint.Round(Joint.ConvertToTicks(Angle));
+			}
+			catch (...)
+			{
+				this->Finish(Part, std::current_exception());
+				continue;
+			}
+			if (Joint.CurrentPosition == Angle)
+			{
+				this->Finish(Part, std::exception_ptr());
+				continue;
+			}
+
+			int          TotalTicks = Part.Target - Joint.HomeDeviation;
+			unsigned int Ticks      = (unsigned int) abs(TotalTicks);
+			unsigned int OddGroup   = Ticks % Joint.GroupSize;
+			Part.Direction = Angle > Joint.CurrentPosition ? '+' : '-';
+			Part.Groups    = Ticks / Joint.GroupSize;
+			Part.Started   = Now;
+			Trace(teMOVE_BEGIN, Joint.JointToMove, TotalTicks);
+
+			if (OddGroup)
+				this->SendGroup(Part, OddGroup, Now);
+			// The register is always read back before the first whole group.
+			Joint.GroupsSinceQuery = JointMove::CORRECTION_INTERVAL;
+			Part.State   = asWAITING;
+			Part.Due     = Now;
+			Part.Requery   = false;
+			Part.Refilling = false;
+			Part.Waiting   = Now;
+
+			if (Part.Groups == 0)
+			{
+				Trace(teMOVE_END, Joint.JointToMove, TotalTicks);
+				TraceLatency(Joint.JointToMove, tmMOVE_DURATION, MonotonicSeconds() - Now);
+				Joint.HomeDeviation   = Part.Target;
+				Joint.CurrentPosition = Angle;
+				this->Finish(Part, std::exception_ptr());
+			}
+		}
+	}
+
+	/********************************************************************
+	*                   RobotCell::Replenish
+	* The joint's next group has fallen due. As in AwaitReplenish, in
+	* PREDICTIVE mode with a known drain rate it is sent on the model's
+	* word, except every CORRECTION_INTERVAL groups; otherwise, and while
+	* the register was last found too full, the register is asked for.
+	********************************************************************/
+	void RobotCell::Replenish(Axis& Part, double Now)
+	{
+		JointMove& Joint      = *Part.Joint;
+		bool       Predictive = Joint.FlowMode == PREDICTIVE && Joint.Drain.Calibrated();
+
+		if (!Part.Requery)
+		{
+			if (Predictive && ++Joint.GroupsSinceQuery < JointMove::CORRECTION_INTERVAL)
+			{
+				this->SendGroup(Part, Joint.GroupSize, Now);
+				return;
+			}
+			Joint.GroupsSinceQuery = 0;
+		}
+		Joint.AskRegister(Part.QueryString);
+		Part.State = asASKED;
+	}
+
+	/********************************************************************
+	*                   RobotCell::Answer
+	* The register has been read: send the next group if it has drained
+	* far enough, otherwise ask again after a poll interval, or when the
+	* model says it will have. An empty register after a whole group is
+	* a starvation, as in AwaitReplenish.
+	********************************************************************/
+	void RobotCell::Answer(Axis& Part, int RegisterValue, double Now)
+	{
+		JointMove& Joint = *Part.Joint;
+
+		if (Part.Refilling && RegisterValue == 0)
+		{
+			Trace(teSTARVED, Joint.JointToMove, 0);
+			Joint.Starvations++;
+		}
+		if (RegisterValue <= int(Joint.Replenish))
+		{
+			this->SendGroup(Part, Joint.GroupSize, Now);
+			return;
+		}
+		bool Predictive = Joint.FlowMode == PREDICTIVE && Joint.Drain.Calibrated();
+		Part.State   = asWAITING;
+		Part.Requery = true;
+		Part.Due     = Predictive ? Joint.Drain.TimeToReach(Joint.Replenish, Now)
+		                          : Now + JointMove::POLL_INTERVAL / 1000.0;
+	}
+
+	/********************************************************************
+	*                   RobotCell::SendGroup
+	* Sends Ticks, and for a whole group works out when the next one is
+	* due: straight away if it must be queried for first, as Move queries
+	* straight after sending, or when the model expects the register to
+	* reach the replenish level. The last whole group ends the move.
+	********************************************************************/
+	void RobotCell::SendGroup(Axis& Part, unsigned int Ticks, double Now)
+	{
+		JointMove& Joint = *Part.Joint;
+
+		SendTicks(*Joint.ComPort, Joint.JointToMove, Part.Direction, Ticks);
+		Trace(teCOMMAND, Joint.JointToMove, Ticks);
+		Joint.Sent(Part.Direction, Ticks, Now);
+		if (Part.State == asIDLE)
+			return;
+
+		TraceLatency(Joint.JointToMove, tmTIME_TO_REPLENISH, Now - Part.Waiting);
+		Part.Waiting   = Now;
+		Part.Refilling = true;
+		if (--Part.Groups == 0)
+		{
+			int TotalTicks = Part.Target - Joint.HomeDeviation;
+			Trace(teMOVE_END, Joint.JointToMove, TotalTicks);
+			TraceLatency(Joint.JointToMove, tmMOVE_DURATION, Now - Part.Started);
+			Joint.HomeDeviation   = Part.Target;
+			Joint.CurrentPosition = Part.Current.Angle;
+			this->Finish(Part, std::exception_ptr());
+			return;
+		}
+
+		bool Predictive = Joint.FlowMode == PREDICTIVE && Joint.Drain.Calibrated();
+		Part.State   = asWAITING;
+		Part.Requery = false;
+		Part.Due     = Predictive && Joint.GroupsSinceQuery + 1 < JointMove::CORRECTION_INTERVAL
+		             ? Joint.Drain.TimeToReach(Joint.Replenish, Now) : Now;
+	}
+
+	void RobotCell::Finish(Axis& Part, std::exception_ptr Error)
+	{
+		Request Done = Part.Current;
+		Part.Current = Request();
+		Part.State   = asIDLE;
+
+		PortWorker::Complete(*Done.Result, Done.Done, 0, Error);
+	}
+}
+#endif
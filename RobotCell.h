@@ -0,0 +1,161 @@
+#ifndef ROBOTCELL_H
+#define ROBOTCELL_H
+
+#ifndef _WIN32
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "JointMoveProto.h"
+
+/*************************************************************************************
+* RobotCell.h contains class RobotCell, which drives the joints of many robots, each
+* on its own serial port, from one event loop instead of one thread per port:
+*
+* - RobotCell(int Shards, double SwitchPeriod):
+*      Splits the ports between Shards loops, each on a thread of its own. The
+*      switches on every port are read every SwitchPeriod seconds while the cell
+*      runs, or never if it is 0.
+* - Tserial* AddPort(const char* Device, int Rate):
+*      Opens another robot's port. The cell keeps the Tserial.
+*      Throws:        FileNotFoundException, if the port can't be opened.
+* - JointMove* AddJoint(Tserial* Port, char Joint, const RobotConfig& Config,
+*                       bool LimitSwitch):
+*      Makes a JointMove for a joint on one of the cell's ports, as the JointMove
+*      constructor does, homing it if asked. The cell keeps the JointMove.
+*      Precondition:  The cell isn't running.
+* - void Start(void), Stop(void):
+*      Start the loops. Stop lets them finish every move already asked for, then
+*      stops them; the cell can be started again.
+* - std::future<int> Move(JointMove* Joint, double AngularPosition, Completion Done):
+*      Asks for Joint to be moved as Move would, after any moves already asked for
+*      it, and returns at once. The future holds 0, or the
+*      BoundaryViolationException or StalledMovementException; Done, if given, is called on the loop's thread
+*      when the last group has been sent. Moves asked for before Start wait for it.
+*
+* While the cell runs its loops hold PortWorker::Lock on every port they serve, so
+* JointMove's own Move, Home and MoveAsync wait until Stop. Each loop sleeps in
+* epoll_wait until a reply arrives, a joint's register is due to be topped up or a
+* switch reading falls due, so its cost grows with the traffic on the lines and not
+* with the number of ports. It keeps a small state machine per joint that follows
+* Move step for step, POLLED or PREDICTIVE as the joint is set, but sends every
+* query through the port's query pipeline without waiting and acts on the reply
+* when it comes. Everything due on a port is sent in one write. Switch readings go
+* to the port's SwitchPoller (see SwitchPoller.h) with Publish, so its Latest and
+* its watchers work as usual; its own thread shouldn't be started for a cell port.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	class RobotCell
+	{
+		public:
+			RobotCell(int Shards = 1, double SwitchPeriod = SWITCH_PERIOD);
+			~RobotCell();
+
+			Tserial*   AddPort (const char* Device, int Rate = 9600);
+			JointMove* AddJoint(Tserial* Port, char Joint, const RobotConfig& Config,
+			                    bool LimitSwitch = true);
+			void       Start   (void);
+			void       Stop    (void);
+			std::future<int> Move(JointMove* Joint, double AngularPosition, Completion Done = Completion());
+
+			int  ViewPortCount (void) const { return int(this->Robots.size()); }
+			int  ViewJointCount(void) const { return int(this->Axes.size()); }
+			int  ViewShardCount(void) const { return int(this->Shards.size()); }
+			bool ViewRunning   (void) const { return this->Running; }
+		private:
+			RobotCell(const RobotCell&);
+			RobotCell& operator=(const RobotCell&);
+
+			struct Robot;
+			struct Shard;
+
+			struct Request
+			{
+				double                               Angle;
+				Completion                           Done;
+				std::shared_ptr< std::promise<int> > Result;
+			};
+
+			// asWAITING: the next group, or query, is due at Due.
+			// asASKED: a register query is on the line.
+			enum axis_state {asIDLE, asWAITING, asASKED};
+
+			// Everything but Joint belongs to the loop's thread.
+			struct Axis
+			{
+				std::unique_ptr<JointMove> Joint;
+				Robot*                     Arm;
+				std::deque<Request>        Queue;
+				Request                    Current;
+				axis_state                 State;
+				// The move under way: where it ends in ticks from home, its
+				// direction and the whole groups still to send.
+				int                        Target;
+				char                       Direction;
+				unsigned int               Groups;
+				double                     Due;
+				// The register was too full last time it was read, so the
+				// next step is another query.
+				bool                       Requery;
+				// A whole group of this move has gone out, so an empty
+				// register means the joint ran dry.
+				bool                       Refilling;
+				double                     Started;
+				double                     Waiting;
+				char                       QueryString[5];
+			};
+
+			struct Robot
+			{
+				std::unique_ptr<Tserial> Port;
+				std::vector<Axis*>       Axes;
+				Shard*                   Loop;
+				bool                     SwitchAsked;
+				unsigned int             SwitchTicket;
+				double                   SwitchAskedAt;
+				double                   SwitchDue;
+			};
+
+			struct Shard
+			{
+				std::vector<Robot*> Robots;
+				int                 Epoll;
+				// An eventfd, written to wake the loop for a new request or Stop.
+				int                 Wake;
+				std::thread         Thread;
+				// Guards Incoming and Stopping.
+				std::mutex          Lock;
+				std::vector< std::pair<Axis*, Request> > Incoming;
+				bool                Stopping;
+			};
+
+			// Seconds between switch readings by default.
+			static constexpr double SWITCH_PERIOD = 0.02;
+			// Events taken from epoll_wait at a time.
+			const static int        EVENT_BATCH   = 16;
+
+			std::vector< std::unique_ptr<Robot> > Robots;
+			std::vector< std::unique_ptr<Axis> >  Axes;
+			std::vector< std::unique_ptr<Shard> > Shards;
+			double                                SwitchPeriod;
+			bool                                  Running;
+
+			Robot* Find     (Tserial* Port) const;
+			Axis*  Find     (JointMove* Joint) const;
+			void   Run      (Shard& Loop);
+			double Service  (Robot& Arm, double Now, bool Stopping, bool& Busy);
+			void   Receive  (Robot& Arm, double Now);
+			void   Abandon  (Robot& Arm, double Now);
+			void   Begin    (Axis& Part, double Now);
+			void   Replenish(Axis& Part, double Now);
+			void   Answer   (Axis& Part, int RegisterValue, double Now);
+			void   SendGroup(Axis& Part, unsigned int Ticks, double Now);
+			void   Finish   (Axis& Part, std::exception_ptr Error);
+	};
+}
+#endif
+#endif
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "RobotConfig.h"
+#include "MappedFile.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		// PI, as in JointMoveProto.h, which includes RobotConfig.h and so
+		// can't be included here. The default bounds are half a turn
+		// either side of home.
+		const double HALF_TURN = 3.1415926535897932384626433832795;
+
+		// A token must be a number from end to end.
+		bool ToNumber(const std::string& Token, double& Value)
+		{
+			char* End;
+			Value = strtod(Token.c_str(), &End);
+			return !Token.empty() && *End == '\0';
+		}
+
+		bool ToCount(const std::string& Token, unsigned int& Value)
+		{
+			char* End;
+			long  Parsed = strtol(Token.c_str(), &End, 0);
+			Value = (unsigned int) Parsed;
+			return !Token.empty() && *End == '\0' && Parsed >= 0 && Parsed <= 0xFFFF;
+		}
+
+		char DefaultMask(char Joint)
+		{
+			// The I command reports joint C in bit 0, D in bit 1, and so on;
+			// A and B have no switch.
+			return Joint >= 'C' ? char(1 << (Joint - 'C')) : 0;
+		}
+	}
+
+	JointConfig::JointConfig(void)
+	{
+		this->Present      = false;
+		this->Resolution   = 0;
+		this->LowerBound   = -HALF_TURN;
+		this->UpperBound   = HALF_TURN;
+		this->HomePosition = 0;
+		this->SwitchMask   = 0;
+		this->GroupSize    = 50;
+		this->Replenish    = 15;
+	}
+
+	RobotConfig::RobotConfig(void)
+	{
+	}
+
+	RobotConfig::RobotConfig(char* Filename)
+	{
+		MappedFile File;
+		if (!File.Open(Filename))
+			throw FileNotFoundException(Filename);
+
+		this->Filename = Filename;
+		this->Parse(File.Text, File.Length, Filename);
+	}
+
+	/********************************************************************
+	*                   RobotConfig::Shared
+	* Every JointMove built from the same file shares one RobotConfig,
+	* so an arm with eight joints reads the file once, not eight times.
+	* A file that fails to load is tried again on the next call.
+	********************************************************************/
+	const RobotConfig& RobotConfig::Shared(char* Filename)
+	{
+		static std::mutex                            Lock;
+		static std::map<std::string, RobotConfig*>   Loaded;
+
+		std::lock_guard<std::mutex> Hold(Lock);
+		RobotConfig*& Config = Loaded[Filename];
+		if (!Config)
+			Config = new RobotConfig(Filename);
+		return *Config;
+	}
+
+	/********************************************************************
+	*                   RobotConfig::Parse
+	* Reads every line of the file. Nothing in Text is assumed to be null
+	* terminated. Name is the caller's string, so that it outlives the
+	* exception if this object is never finished.
+	********************************************************************/
+	void RobotConfig::Parse(const char* Text, size_t Length, char* Name)
+	{
+		int    Line   = 0;
+		size_t Offset = 0;
+
+		while (Offset < Length)
+		{
+			size_t End = Offset;
+			while (End < Length && Text[End] != '\n')
+				End++;
+			std::string Content(Text + Offset, End - Offset);
+			Offset = End + 1;
+			Line++;
+
+			size_t Comment = Content.find('#');
+			if (Comment != std::string::npos)
+				Content.erase(Comment);
+
+			std::vector<std::string> Tokens;
+			size_t Position = 0;
+			while (Position < Content.size())
+			{
+				while (Position < Content.size() && isspace((unsigned char) Content[Position]))
+					Position++;
+				size_t Start = Position;
+				while (Position < Content.size() && !isspace((unsigned char) Content[Position]))
+					Position++;
+				if (Position > Start)
+					Tokens.push_back(Content.substr(Start, Position - Start));
+			}
+			if (Tokens.empty())
+				continue;
+
+			char Joint = char(toupper((unsigned char) Tokens[0][0]));
+			if (Tokens[0].size() != 1 || Joint < 'A' || Joint > 'H' || Tokens.size() < 2)
+				throw MalformedConfigException(Name, Line);
+			if (this->Joints[Joint - 'A'].Present)
+				throw MalformedConfigException(Name, Line);
+
+			JointConfig Settings;
+			Settings.SwitchMask = DefaultMask(Joint);
+			if (!ToNumber(Tokens[1], Settings.Resolution))
+				throw MalformedConfigException(Name, Line);
+
+			for (size_t k = 2; k < Tokens.size(); k++)
+			{
+				size_t      Equals = Tokens[k].find('=');
+				std::string Key    = Tokens[k].substr(0, Equals);
+				std::string Value  = Equals == std::string::npos ? "" : Tokens[k].substr(Equals + 1);
+				unsigned int Mask;
+				bool        Good;
+
+				if (Key == "lower")
+					Good = ToNumber(Value, Settings.LowerBound);
+				else if (Key == "upper")
+					Good = ToNumber(Value, Settings.UpperBound);
+				else if (Key == "home")
+					Good = ToNumber(Value, Settings.HomePosition);
+				else if (Key == "group")
+					Good = ToCount(Value, Settings.GroupSize);
+				else if (Key == "replenish")
+					Good = ToCount(Value, Settings.Replenish);
+				else if (Key == "switch")
+				{
+					Good = ToCount(Value, Mask) && Mask < 64;
+					Settings.SwitchMask = char(Mask);
+				}
+				else
+					Good = false;
+
+				if (!Good)
+					throw MalformedConfigException(Name, Line);
+			}
+
+			if (!Valid(Settings))
+				throw MalformedConfigException(Name, Line);
+			Settings.Present = true;
+			this->Joints[Joint - 'A'] = Settings;
+		}
+	}
+
+	bool RobotConfig::Valid(const JointConfig& Settings)
+	{
+		return Settings.Resolution > 0
+		    && Settings.LowerBound < Settings.UpperBound
+		    && Settings.HomePosition >= Settings.LowerBound
+		    && Settings.HomePosition <= Settings.UpperBound
+		    && Settings.GroupSize > 0
+		    && Settings.Replenish < Settings.GroupSize
+		    && Settings.GroupSize + Settings.Replenish <= REGISTER_LIMIT;
+	}
+
+	const JointConfig& RobotConfig::operator[](char Joint) const
+	{
+		Joint = char(toupper((unsigned char) Joint));
+		if (!this->Has(Joint))
+			throw ValueNotFoundException(const_cast<char*>(this->Filename.c_str()));
+		return this->Joints[Joint - 'A'];
+	}
+
+	bool RobotConfig::Has(char Joint) const
+	{
+		Joint = char(toupper((unsigned char) Joint));
+		return Joint >= 'A' && Joint <= 'H' && this->Joints[Joint - 'A'].Present;
+	}
+
+	/********************************************************************
+	*                   RobotConfig::Save
+	* Writes the file through a temporary and renames it into place, so
+	* a failed write leaves the old configuration intact.
+	********************************************************************/
+	void RobotConfig::Save(char* Filename) const
+	{
+		std::string Temporary = std::string(Filename) + ".new";
+		FILE* Out = fopen(Temporary.c_str(), "w");
+		if (!Out)
+			throw FileNotFoundException(Filename);
+
+		fprintf(Out, "# joint  resolution  [key=value ...]; see RobotConfig.h\n");
+		for (int j = 0; j < 8; j++)
+		{
+			const JointConfig& Settings = this->Joints[j];
+			if (!Settings.Present)
+				continue;
+			fprintf(Out, "%c\t%.15g\tlower=%.15g upper=%.15g home=%.15g switch=%d group=%u replenish=%u\n",
+			        'A' + j, Settings.Resolution, Settings.LowerBound, Settings.UpperBound,
+			        Settings.HomePosition, Settings.SwitchMask, Settings.GroupSize, Settings.Replenish);
+		}
+
+		bool Written = !ferror(Out);
+		if (fclose(Out) != 0 || !Written)
+		{
+			remove(Temporary.c_str());
+			throw FileNotFoundException(Filename);
+		}
+#ifdef _WIN32
+		// Unlike POSIX rename, Win32's won't replace an existing file.
+		remove(Filename);
+#endif
+		if (rename(Temporary.c_str(), Filename) != 0)
+			throw FileNotFoundException(Filename);
+	}
+
+	void RobotConfig::Set(char Joint, const JointConfig& Settings)
+	{
+		Joint = char(toupper((unsigned char) Joint));
+		if (Joint < 'A' || Joint > 'H' || !Valid(Settings))
+			throw MalformedConfigException(const_cast<char*>(this->Filename.c_str()), 0);
+		this->Joints[Joint - 'A']         = Settings;
+		this->Joints[Joint - 'A'].Present = true;
+	}
+}
@@ -0,0 +1,91 @@
+#ifndef ROBOTCONFIG_H
+#define ROBOTCONFIG_H
+
+#include <string>
+#include "GeneralExceptions.h"
+
+/*************************************************************************************
+* RobotConfig.h contains class RobotConfig, everything JointMove needs to know about
+* each joint of the arm, read once from a file such as resolutions.txt:
+*
+*     # joint  resolution  [key=value ...]
+*     D        0.00209439510239  lower=-1.309 upper=1.309 group=50 replenish=15
+*
+* Each line names a joint and its resolution in radians per tick. The optional
+* keys are:
+*     lower, upper  the limits of motion, in radians               (-PI, PI)
+*     home          the angle of the limit switch, in radians            (0)
+*     switch        the I command's bit mask for the joint, or 0 if it has
+*                   no switch                           (C=1, D=2, ... H=32)
+*     group         ticks sent to the register at one time              (50)
+*     replenish     register level at which the next group is sent      (15)
+* Anything after a '#' is a comment.
+*
+* - RobotConfig(char* Filename):
+*      Maps the file into memory and parses and checks every line before
+*      returning, so a bad file fails here and not at the first Move.
+*      Throws:        FileNotFoundException, if the file can't be opened;
+*                     MalformedConfigException, with the line number, for any
+*                     unreadable or out-of-range value or a repeated joint.
+* - static const RobotConfig& Shared(char* Filename):
+*      The configuration in Filename, loaded the first time any JointMove
+*      asks for it and kept for the rest of the program.
+* - const JointConfig& operator[](char Joint):
+*      The joint's settings, found by indexing, not searching.
+*      Throws:        ValueNotFoundException, if the file has no such joint.
+* - void Save(char* Filename):
+*      Writes every joint back out in the format above, with all of its keys,
+*      so that settings changed with Set (by JointMove::Calibrate, say) are
+*      kept. Comments in the original file are not.
+*      Throws:        FileNotFoundException, if the file can't be written.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	struct JointConfig
+	{
+		bool         Present;
+		// Radians per tick.
+		double       Resolution;
+		double       LowerBound;
+		double       UpperBound;
+		double       HomePosition;
+		// Bit of the I command's reply for this joint's switch; 0 for none.
+		char         SwitchMask;
+		unsigned int GroupSize;
+		unsigned int Replenish;
+
+		JointConfig(void);
+	};
+
+	class RobotConfig
+	{
+		public:
+			// The register is read back as one character offset by 32, so it
+			// can't report more than this many ticks.
+			static const unsigned int REGISTER_LIMIT = 95;
+			// The farthest from home a joint can be sent, in ticks, so that the
+			// distance between any two positions still fits in an int.
+			static const int          TICK_LIMIT     = 1 << 30;
+
+			RobotConfig(void);
+			RobotConfig(char* Filename);
+
+			static const RobotConfig& Shared(char* Filename);
+
+			const JointConfig& operator[](char Joint) const;
+			bool               Has       (char Joint) const;
+			// Replaces a joint's settings after checking them as Load would.
+			void               Set       (char Joint, const JointConfig& Settings);
+			void               Save      (char* Filename) const;
+
+			const std::string& ViewFilename(void) const { return this->Filename; }
+		private:
+			// Joints A through H, indexed by letter.
+			JointConfig Joints[8];
+			std::string Filename;
+
+			void Parse   (const char* Text, size_t Length, char* Name);
+			static bool Valid(const JointConfig& Settings);
+	};
+}
+#endif
@@ -0,0 +1,271 @@
+#include <new>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "StateEstimator.h"
+
+namespace TLeyson_Robot
+{
+#ifdef __cpp_lib_atomic_is_always_lock_free
+	static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<double>::is_always_lock_free,
+	              "a slot in shared memory must not need a lock");
+#endif
+
+	namespace
+	{
+		// Before C++17 it can only be asked at run time, so a board whose
+		// slots would need a lock is refused by Create and Open instead.
+		bool SlotsLockFree(void)
+		{
+			std::atomic<uint64_t> Sequence(0);
+			std::atomic<double>   Field(0);
+			return Sequence.is_lock_free() && Field.is_lock_free();
+		}
+	}
+
+	/********************************************************************
+	*                   JointStateSlot::Write
+	* Publishes State. Only one thread may write a slot at a time.
+	********************************************************************/
+	void JointStateSlot::Write(const JointEstimate& State)
+	{
+		uint64_t Next = this->Sequence.load(std::memory_order_relaxed) + 1;
+		this->Sequence.store(Next, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		this->Position.store(State.Position, std::memory_order_relaxed);
+		this->Velocity.store(State.Velocity, std::memory_order_relaxed);
+		this->Target.store(State.Target, std::memory_order_relaxed);
+		this->Stamp.store(State.Time, std::memory_order_relaxed);
+		this->Sequence.store(Next + 1, std::memory_order_release);
+	}
+
+	/********************************************************************
+	*                   JointStateSlot::Read
+	* Copies the last publication whole and carries it forward to When:
+	* the joint keeps its velocity until it reaches the target, then
+	* stands there.
+	********************************************************************/
+	JointEstimate JointStateSlot::Read(double When) const
+	{
+		JointEstimate State;
+		for (;;)
+		{
+			uint64_t Before = this->Sequence.load(std::memory_order_acquire);
+			if (Before & 1)
+				continue;
+			State.Position = this->Position.load(std::memory_order_relaxed);
+			State.Velocity = this->Velocity.load(std::memory_order_relaxed);
+			State.Target   = this->Target.load(std::memory_order_relaxed);
+			State.Time     = this->Stamp.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (this->Sequence.load(std::memory_order_relaxed) == Before)
+				break;
+		}
+		if (State.Time == 0)
+			return State;
+
+		double Elapsed = When - State.Time;
+		if (Elapsed > 0 && State.Velocity != 0)
+		{
+			State.Position += State.Velocity * Elapsed;
+			if ((State.Target - State.Position) * State.Velocity <= 0)
+			{
+				State.Position = State.Target;
+				State.Velocity = 0;
+			}
+		}
+		State.Time = When;
+		return State;
+	}
+
+	StateEstimator::StateEstimator(void)
+	{
+		this->Resolution   = 0;
+		this->HomePosition = 0;
+		this->Commanded    = 0;
+		this->Heading      = 1;
+		this->Slot         = &this->Own;
+	}
+
+	/********************************************************************
+	*                   StateEstimator::Attach
+	* Publishes to Slot from now on, starting with the estimate as it
+	* stands, or to the estimator's own slot again if Slot is null.
+	********************************************************************/
+	void StateEstimator::Attach(JointStateSlot* Slot)
+	{
+		double Now = MonotonicSeconds();
+		JointEstimate State = this->Slot->Read(Now);
+		this->Slot = Slot ? Slot : &this->Own;
+		if (State.Time == 0)
+			State.Time = Now;
+		this->Slot->Write(State);
+	}
+
+	// Forgets anything sent: the joint is at home.
+	void StateEstimator::Configure(double Resolution, double HomePosition)
+	{
+		this->Resolution   = Resolution;
+		this->HomePosition = HomePosition;
+		this->Settle(0, MonotonicSeconds());
+	}
+
+	/********************************************************************
+	*                   StateEstimator::Sent
+	* Takes Ticks (negative for '-') just sent to the joint, after Drain
+	* has been told of them.
+	********************************************************************/
+	void StateEstimator::Sent(int Ticks, const DrainModel& Drain, double When)
+	{
+		if (Ticks == 0)
+			return;
+		this->Commanded += Ticks;
+		this->Heading    = Ticks > 0 ? 1 : -1;
+		this->Publish(Drain.Predict(When), Drain.Rate(), When);
+	}
+
+	// Takes a register reading just given to Drain, made at When.
+	void StateEstimator::Observed(const DrainModel& Drain, double When)
+	{
+		this->Publish(Drain.Predict(When), Drain.Rate(), When);
+	}
+
+	/********************************************************************
+	*                   StateEstimator::Stopped
+	* The joint's register has just been emptied, before Drain is reset:
+	* the ticks Drain expects were still in it will never run.
+	********************************************************************/
+	void StateEstimator::Stopped(const DrainModel& Drain, double When)
+	{
+		this->Commanded -= this->Heading * int(Drain.Predict(When) + 0.5);
+		this->Publish(0, 0, When);
+	}
+
+	// The joint is known to be standing Deviation ticks from home.
+	void StateEstimator::Settle(int Deviation, double When)
+	{
+		this->Commanded = Deviation;
+		this->Publish(0, 0, When);
+	}
+
+	/********************************************************************
+	*                   StateEstimator::Publish
+	* Queued ticks are still to run, at Rate ticks a second, before the
+	* joint reaches where it has been sent.
+	********************************************************************/
+	void StateEstimator::Publish(double Queued, double Rate, double When)
+	{
+		JointEstimate State;
+		State.Target   = this->HomePosition + this->Commanded * this->Resolution;
+		State.Position = State.Target - this->Heading * Queued * this->Resolution;
+		State.Velocity = Queued > 0 ? this->Heading * Rate * this->Resolution : 0;
+		State.Time     = When;
+		this->Slot->Write(State);
+	}
+
+	JointStateBoard::JointStateBoard(void)
+	{
+		this->Mapped = 0;
+	}
+
+	JointStateBoard::~JointStateBoard()
+	{
+#ifndef _WIN32
+		if (this->Mapped)
+			munmap(this->Mapped, sizeof(Layout));
+#endif
+	}
+
+	/********************************************************************
+	*                   JointStateBoard::Create
+	* Sizes the shared memory object for a Layout and starts it afresh,
+	* every slot unpublished. Returns false if it can't, or if the slots
+	* would need a lock, which no other process could share.
+	********************************************************************/
+	bool JointStateBoard::Create(const char* Name)
+	{
+#ifdef _WIN32
+		return false;
+#else
+		if (this->Mapped || !SlotsLockFree())
+			return false;
+		int Descriptor = shm_open(Name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+		if (Descriptor == -1)
+			return false;
+		void* View = MAP_FAILED;
+		if (ftruncate(Descriptor, sizeof(Layout)) == 0)
+			View = mmap(0, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, Descriptor, 0);
+		close(Descriptor);
+		if (View == MAP_FAILED)
+			return false;
+
+		this->Mapped = new (View) Layout();
+		this->Mapped->Magic   = MAGIC;
+		this->Mapped->Version = VERSION;
+		return true;
+#endif
+	}
+
+	/********************************************************************
+	*                   JointStateBoard::Open
+	* Maps a board made by Create, read-only. Returns false if there is
+	* none, what is there isn't a board of this version, or the slots
+	* would need a lock.
+	********************************************************************/
+	bool JointStateBoard::Open(const char* Name)
+	{
+#ifdef _WIN32
+		return false;
+#else
+		if (this->Mapped || !SlotsLockFree())
+			return false;
+		int Descriptor = shm_open(Name, O_RDONLY | O_CLOEXEC, 0);
+		if (Descriptor == -1)
+			return false;
+		struct stat Status;
+		void* View = MAP_FAILED;
+		if (fstat(Descriptor, &Status) == 0 && size_t(Status.st_size) >= sizeof(Layout))
+			View = mmap(0, sizeof(Layout), PROT_READ, MAP_SHARED, Descriptor, 0);
+		close(Descriptor);
+		if (View == MAP_FAILED)
+			return false;
+
+		this->Mapped = (Layout*) View;
+		if (this->Mapped->Magic != MAGIC || this->Mapped->Version != VERSION)
+		{
+			munmap(View, sizeof(Layout));
+			this->Mapped = 0;
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	void JointStateBoard::Remove(const char* Name)
+	{
+#ifndef _WIN32
+		shm_unlink(Name);
+#endif
+	}
+
+	// The slot for Joint, or null if the board isn't mapped. Only a board
+	// made by Create may be written.
+	JointStateSlot* JointStateBoard::Slot(char Joint) const
+	{
+		if (!this->Mapped || Joint < 'A' || Joint > 'H')
+			return 0;
+		return &this->Mapped->Slots[Joint - 'A'];
+	}
+
+	JointEstimate JointStateBoard::Read(char Joint, double When) const
+	{
+		JointStateSlot* Found = this->Slot(Joint);
+		if (Found)
+			return Found->Read(When);
+		JointEstimate Nothing = {0, 0, 0, 0};
+		return Nothing;
+	}
+}
@@ -0,0 +1,134 @@
+#ifndef STATEESTIMATOR_H
+#define STATEESTIMATOR_H
+
+#include <stdint.h>
+#include <atomic>
+#include "FlowControl.h"
+
+/*************************************************************************************
+* StateEstimator.h contains class StateEstimator, which follows where a joint really
+* is while its register runs out, and class JointStateBoard, where the estimates are
+* published for other threads and processes to read:
+*
+* - JointEstimate StateEstimator::Estimate(double When):
+*      The joint's position and velocity at time When, worked out from the ticks
+*      sent to it, the register readings and the drain rate its DrainModel has
+*      measured. JointMove::ViewEstimate returns it for now.
+* - bool JointStateBoard::Create(const char* Name):
+*      Makes (or takes over) the POSIX shared memory object Name, such as "/xr-arm",
+*      with room for joints A through H. Returns false if it can't.
+* - bool JointStateBoard::Open(const char* Name):
+*      Maps an existing board read-only, for a process that only watches.
+* - JointEstimate Read(char Joint), Read(char Joint, double When):
+*      The joint's estimate, now or at When, from the board.
+* - static void JointStateBoard::Remove(const char* Name):
+*      Unlinks the shared memory object; boards still mapped keep working.
+*
+* A JointMove publishes to a slot of its own until PublishTo gives it one on a
+* board. The estimate is published only when something changes it: when ticks are
+* sent, when the register is read and when the joint is stopped or homed. Each
+* publication is the position and velocity at that moment and where the joint will
+* stop, and readers carry it forward to the time they ask about on the monotonic
+* clock, which every process shares. So a reader sees the joint moving smoothly
+* however rarely the register is read, and never touches the port.
+*
+* A slot is a seqlock: its writer, the one thread moving the joint at the time,
+* makes the sequence odd, stores the fields and makes it even again, and a reader
+* copies the fields and tries again if the sequence was odd or changed meanwhile.
+* Neither ever blocks, so the board can be read at any rate without slowing the
+* joint. Every field is a lock-free atomic, so the slots work the same in shared
+* memory as in one process.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	struct JointEstimate
+	{
+		// Radians, and radians per second.
+		double Position;
+		double Velocity;
+		// Where the joint stops once the ticks already sent have run out.
+		double Target;
+		// The time this estimate is for, on the MonotonicSeconds clock. 0 if
+		// nothing has been published.
+		double Time;
+	};
+
+	/********************************************************************
+	* JointStateSlot: one joint's last publication. Sequence is odd while
+	* it is being written.
+	********************************************************************/
+	struct JointStateSlot
+	{
+		std::atomic<uint64_t> Sequence;
+		std::atomic<double>   Position;
+		std::atomic<double>   Velocity;
+		std::atomic<double>   Target;
+		std::atomic<double>   Stamp;
+
+		JointStateSlot(void) : Sequence(0), Position(0), Velocity(0), Target(0), Stamp(0) {}
+
+		void          Write(const JointEstimate& State);
+		JointEstimate Read (double When) const;
+	};
+
+	class StateEstimator
+	{
+		public:
+			StateEstimator(void);
+
+			void Attach   (JointStateSlot* Slot);
+			void Configure(double Resolution, double HomePosition);
+			void Sent     (int Ticks, const DrainModel& Drain, double When);
+			void Observed (const DrainModel& Drain, double When);
+			void Stopped  (const DrainModel& Drain, double When);
+			void Settle   (int Deviation, double When);
+
+			JointEstimate Estimate(double When) const { return this->Slot->Read(When); }
+		private:
+			StateEstimator(const StateEstimator&);
+			StateEstimator& operator=(const StateEstimator&);
+
+			double          Resolution;
+			double          HomePosition;
+			// Ticks from home once everything sent has run out, and the sign
+			// of the last ticks sent.
+			int             Commanded;
+			int             Heading;
+			JointStateSlot  Own;
+			JointStateSlot* Slot;
+
+			void Publish(double Queued, double Rate, double When);
+	};
+
+	class JointStateBoard
+	{
+		public:
+			JointStateBoard(void);
+			~JointStateBoard();
+
+			bool Create(const char* Name);
+			bool Open  (const char* Name);
+			static void Remove(const char* Name);
+
+			JointStateSlot* Slot(char Joint) const;
+			JointEstimate   Read(char Joint) const { return this->Read(Joint, MonotonicSeconds()); }
+			JointEstimate   Read(char Joint, double When) const;
+		private:
+			JointStateBoard(const JointStateBoard&);
+			JointStateBoard& operator=(const JointStateBoard&);
+
+			// What the shared memory object holds.
+			struct Layout
+			{
+				uint32_t       Magic;
+				uint32_t       Version;
+				JointStateSlot Slots[8];
+			};
+
+			static const uint32_t MAGIC   = 0x58525354;
+			static const uint32_t VERSION = 1;
+
+			Layout* Mapped;
+	};
+}
+#endif
@@ -0,0 +1,290 @@
+#include <chrono>
+#include <memory>
+#include "SwitchPoller.h"
+#include "PortWorker.h"
+#include "FlowControl.h"
+#include "MotionTrace.h"
+
+namespace TLeyson_Robot
+{
+	namespace
+	{
+		// Entries are never removed, so a reference to a poller stays valid
+		// for the whole program.
+		std::mutex                              RegistryLock;
+		std::map< Tserial*, SwitchPoller* >&    Registry(void)
+		{
+			static std::map< Tserial*, SwitchPoller* > Ports;
+			return Ports;
+		}
+
+		// The poller for Port if it has one, without making one.
+		SwitchPoller* Find(Tserial* Port)
+		{
+			std::lock_guard<std::mutex> Hold(RegistryLock);
+			std::map< Tserial*, SwitchPoller* >::iterator Entry = Registry().find(Port);
+			return Entry == Registry().end() ? 0 : Entry->second;
+		}
+	}
+
+	SwitchPoller& SwitchPoller::For(Tserial* Port)
+	{
+		std::lock_guard<std::mutex> Hold(RegistryLock);
+		SwitchPoller*& Entry = Registry()[Port];
+		if (!Entry)
+			Entry = new SwitchPoller(Port);
+		return *Entry;
+	}
+
+	void SwitchPoller::Release(Tserial* Port)
+	{
+		SwitchPoller* Poller = Find(Port);
+		if (!Poller)
+			return;
+		Poller->Stop();
+		std::lock_guard<std::mutex> Hold(Poller->StateLock);
+		Poller->State.Bits   = 0;
+		Poller->State.Time   = 0;
+		Poller->State.Failed = false;
+	}
+
+	SwitchPoller::SwitchPoller(Tserial* Port)
+	{
+		this->Port         = Port;
+		this->State.Bits   = 0;
+		this->State.Time   = 0;
+		this->State.Failed = false;
+		this->Period       = DEFAULT_PERIOD;
+		this->Running      = false;
+		this->NextId       = 1;
+	}
+
+	SwitchPoller::~SwitchPoller()
+	{
+		this->Stop();
+	}
+
+	/********************************************************************
+	*                   SwitchPoller::Start
+	* Starts the sampling thread, or changes its Period if it is already
+	* running.
+	* Precondition:  Period is positive.
+	********************************************************************/
+	void SwitchPoller::Start(double Period)
+	{
+		std::lock_guard<std::mutex> Hold(this->StateLock);
+		this->Period = Period;
+		if (!this->Running)
+		{
+			this->Running = true;
+			this->Thread  = std::thread(&SwitchPoller::Run, this);
+		}
+		this->Wake.notify_one();
+	}
+
+	void SwitchPoller::Stop(void)
+	{
+		std::thread Finished;
+		{
+			std::lock_guard<std::mutex> Hold(this->StateLock);
+			this->Running = false;
+			Finished.swap(this->Thread);
+		}
+		this->Wake.notify_one();
+		if (Finished.joinable())
+			Finished.join();
+	}
+
+	SwitchState SwitchPoller::Latest(void)
+	{
+		std::lock_guard<std::mutex> Hold(this->StateLock);
+		return this->State;
+	}
+
+	bool SwitchPoller::ViewRunning(void)
+	{
+		std::lock_guard<std::mutex> Hold(this->StateLock);
+		return this->Running;
+	}
+
+	double SwitchPoller::ViewPeriod(void)
+	{
+		std::lock_guard<std::mutex> Hold(this->StateLock);
+		return this->Period;
+	}
+
+	SwitchState SwitchPoller::Read(void)
+	{
+		return this->Read(this->ViewPeriod());
+	}
+
+	SwitchState SwitchPoller::Read(double MaxAge)
+	{
+		SwitchState Last = this->Latest();
+		if (Last.Time > 0 && MonotonicSeconds() - Last.Time < MaxAge)
+			return Last;
+		return this->Sample();
+	}
+
+	int SwitchPoller::Watch(char Mask, SwitchListener Listener)
+	{
+		std::lock_guard<std::mutex> Hold(this->StateLock);
+		Watcher Added = {Mask, Listener};
+		this->Watchers[this->NextId] = Added;
+		return this->NextId++;
+	}
+
+	void SwitchPoller::Unwatch(int Id)
+	{
+		std::lock_guard<std::mutex> Hold(this->StateLock);
+		this->Watchers.erase(Id);
+	}
+
+	/********************************************************************
+	*                   SwitchPoller::Sample
+	* Sends I and publishes the answer, stamped with the middle of the
+	* round trip. A reply lost to the port's timeout reads as 0, which
+	* would look like switches closing, so it isn't published; the last
+	* sample is returned marked Failed instead.
+	* Precondition:  The caller holds PortWorker::Lock(Port).
+	********************************************************************/
+	SwitchState SwitchPoller::Sample(void)
+	{
+		double Asked = MonotonicSeconds();
+		Trace(teQUERY, SWITCH_TRACK, 'I');
+		char Command = 'I';
+		SwitchState Now;
+		Now.Bits = char(this->Port->query(&Command, 1) - 32);
+		double Answered = MonotonicSeconds();
+		if (this->Port->timedOut())
+		{
+			Trace(teSTALLED, SWITCH_TRACK, -1);
+			Now        = this->Latest();
+			Now.Failed = true;
+			return Now;
+		}
+		Now.Time   = (Asked + Answered) / 2;
+		Now.Failed = false;
+		Trace(teRESPONSE, SWITCH_TRACK, Now.Bits);
+
+		this->Publish(Now);
+		return Now;
+	}
+
+	/********************************************************************
+	*                   SwitchPoller::Publish
+	* Stores the sample and tells the watchers of any switch that
+	* changed. The first sample has nothing to compare with, so it
+	* changes nothing.
+	********************************************************************/
+	void SwitchPoller::Publish(const SwitchState& Now)
+	{
+		std::vector<SwitchListener> Notify;
+		char Changed;
+		{
+			std::lock_guard<std::mutex> Hold(this->StateLock);
+			Changed     = this->State.Time > 0 ? char(this->State.Bits ^ Now.Bits) : 0;
+			this->State = Now;
+			if (Changed)
+				for (std::map<int, Watcher>::iterator w = this->Watchers.begin(); w != this->Watchers.end(); ++w)
+					if (w->second.Mask & Changed)
+						Notify.push_back(w->second.Listener);
+		}
+		for (size_t k = 0; k < Notify.size(); k++)
+			Notify[k](Now, Changed);
+	}
+
+	/********************************************************************
+	*                   SwitchPoller::Service
+	* Takes a sample if the poller is started and one is due, and
+	* returns when the next is due, or 0 if the poller is stopped. After
+	* a lost reply the next is a Period from now, not from the last
+	* sample, so a silent robot isn't asked over and over.
+	* Precondition:  The caller holds PortWorker::Lock(Port).
+	********************************************************************/
+	double SwitchPoller::Service(double Now)
+	{
+		SwitchState Last;
+		double      Every;
+		{
+			std::lock_guard<std::mutex> Hold(this->StateLock);
+			if (!this->Running)
+				return 0;
+			Last  = this->State;
+			Every = this->Period;
+		}
+		if (Now < Last.Time + Every)
+			return Last.Time + Every;
+		SwitchState Taken = this->Sample();
+		return (Taken.Failed ? MonotonicSeconds() : Taken.Time) + Every;
+	}
+
+	void SwitchPoller::SleepUntil(Tserial* Port, double When)
+	{
+		SleepUntil(&Port, 1, When);
+	}
+
+	void SwitchPoller::SleepUntil(const std::vector<Tserial*>& Ports, double When)
+	{
+		if (!Ports.empty())
+			SleepUntil(&Ports[0], Ports.size(), When);
+		else
+			TLeyson_Robot::SleepUntil(When);
+	}
+
+	/********************************************************************
+	*                   SwitchPoller::SleepUntil
+	* Sleeps in steps that end either at When or at the next sample due
+	* on one of the Ports, whichever is sooner. With no poller started
+	* on any of them, it is one plain sleep. Nothing is allocated, since
+	* Move sleeps through here between groups.
+	********************************************************************/
+	void SwitchPoller::SleepUntil(Tserial* const* Ports, size_t Count, double When)
+	{
+		for (;;)
+		{
+			double Now  = MonotonicSeconds();
+			double Wake = When;
+			for (size_t p = 0; p < Count; p++)
+			{
+				SwitchPoller* Poller = Find(Ports[p]);
+				double        Due    = Poller ? Poller->Service(Now) : 0;
+				if (Due > 0 && Due < Wake)
+					Wake = Due;
+			}
+			TLeyson_Robot::SleepUntil(Wake);
+			if (Wake >= When)
+				return;
+		}
+	}
+
+	/********************************************************************
+	*                   SwitchPoller::Run
+	* The sampling thread. When a sample falls due it tries for the port;
+	* if someone else holds it, they are in a SleepUntil or about to be,
+	* and will take the sample themselves, so the thread just checks
+	* again a Period later. It waits a Period after a lost reply too.
+	********************************************************************/
+	void SwitchPoller::Run(void)
+	{
+		std::unique_lock<std::mutex> Hold(this->StateLock);
+		while (this->Running)
+		{
+			double Wait = this->State.Time + this->Period - MonotonicSeconds();
+			if (Wait > 0)
+			{
+				this->Wake.wait_for(Hold, std::chrono::duration<double>(Wait));
+				continue;
+			}
+
+			Hold.unlock();
+			std::unique_lock<std::mutex> PortHeld(PortWorker::Lock(this->Port), std::try_to_lock);
+			bool Sampled = PortHeld.owns_lock() && !this->Sample().Failed;
+			PortHeld = std::unique_lock<std::mutex>();
+			Hold.lock();
+
+			if (!Sampled && this->Running)
+				this->Wake.wait_for(Hold, std::chrono::duration<double>(this->Period));
+		}
+	}
+}
@@ -0,0 +1,126 @@
+#ifndef SWITCHPOLLER_H
+#define SWITCHPOLLER_H
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "tserial.h"
+
+/*************************************************************************************
+* SwitchPoller.h contains class SwitchPoller, which reads the limit switches on one
+* serial port for every joint and thread that wants to know them:
+*
+* - static SwitchPoller& For(Tserial* Port):
+*      The poller for Port, created the first time it is asked for.
+* - void Start(double Period):
+*      Samples the I byte every Period seconds from then on, so the switches are
+*      never more than about a Period old and listeners hear of an edge within a
+*      Period of it.
+* - void Stop(void):
+*      Stops sampling on a schedule. Read still samples when asked to.
+* - static void Release(Tserial* Port):
+*      Stops Port's poller and forgets its last sample, which says nothing about
+*      whatever the Tserial is connected to next. Call it before the Tserial is
+*      disconnected or destroyed.
+* - SwitchState Latest(void):
+*      The last sample taken, without touching the port.
+* - SwitchState Read(void), Read(double MaxAge):
+*      The last sample if it is younger than MaxAge (the Period by default),
+*      otherwise a fresh one. If the robot doesn't answer within the port's
+*      timeout, nothing is published and the last sample comes back with Failed
+*      set, for the caller to stop its joint.
+*      Precondition:  The caller holds PortWorker::Lock(Port).
+* - void Publish(const SwitchState& State):
+*      Records a sample read by someone else, such as a RobotCell, which owns its
+*      ports and reads the I byte itself, and tells the watchers as Read would.
+* - int Watch(char Mask, SwitchListener Listener), void Unwatch(int Id):
+*      Calls Listener whenever a sample finds one of the switches in Mask changed.
+*      Watch returns the Id to pass to Unwatch.
+* - static void SleepUntil(Tserial* Port, double When):
+* - static void SleepUntil(const std::vector<Tserial*>& Ports, double When):
+*      Sleeps until When, taking a sample on each of the Ports whose poller is
+*      started whenever one falls due.
+*      Precondition:  The caller holds PortWorker::Lock on every one of the Ports.
+*
+* A scheduled sample needs the port, so the poller's thread only takes one when
+* nobody holds PortWorker::Lock. Whoever does hold it, for a Move, Home or
+* CoordinatedMove, sleeps through SleepUntil, which takes the samples instead.
+* Either way the switches cost one I command per Period however many joints and
+* threads are looking at them, and none at all while the poller is stopped and
+* nobody calls Read.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	struct SwitchState
+	{
+		// The I byte less its offset of 32. A set bit means that switch is open.
+		char   Bits;
+		// When it was read, on the MonotonicSeconds clock. 0 if never read.
+		double Time;
+		// Set when the I reply never came; Bits and Time are then the last
+		// sample's, and say nothing about the switches now.
+		bool   Failed;
+	};
+
+	// Called with the new state and the bits that changed since the last
+	// sample. Runs on whichever thread took the sample, while it holds the
+	// port, so it must not talk to the port itself; it should only hand the
+	// change off.
+	typedef std::function<void(const SwitchState& State, char Changed)> SwitchListener;
+
+	class SwitchPoller
+	{
+		public:
+			static SwitchPoller& For    (Tserial* Port);
+			static void          Release(Tserial* Port);
+			static void          SleepUntil(Tserial* Port, double When);
+			static void          SleepUntil(const std::vector<Tserial*>& Ports, double When);
+
+			void        Start  (double Period = DEFAULT_PERIOD);
+			void        Stop   (void);
+			SwitchState Latest (void);
+			SwitchState Read   (void);
+			SwitchState Read   (double MaxAge);
+			void        Publish(const SwitchState& State);
+			int         Watch  (char Mask, SwitchListener Listener);
+			void        Unwatch(int Id);
+
+			bool   ViewRunning(void);
+			double ViewPeriod (void);
+
+			~SwitchPoller();
+		private:
+			SwitchPoller(Tserial* Port);
+			SwitchPoller(const SwitchPoller&);
+			SwitchPoller& operator=(const SwitchPoller&);
+
+			struct Watcher
+			{
+				char           Mask;
+				SwitchListener Listener;
+			};
+
+			// Seconds between samples when started.
+			static constexpr double DEFAULT_PERIOD = 0.02;
+
+			Tserial*                Port;
+			// Guards everything below; never held while talking to the port.
+			std::mutex              StateLock;
+			std::condition_variable Wake;
+			SwitchState             State;
+			double                  Period;
+			bool                    Running;
+			std::thread             Thread;
+			std::map<int, Watcher>  Watchers;
+			int                     NextId;
+
+			SwitchState Sample (void);
+			double      Service(double Now);
+			static void SleepUntil(Tserial* const* Ports, size_t Count, double When);
+			void        Run    (void);
+	};
+}
+#endif
@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include "Trajectory.h"
+#include "MoveExceptions.h"
+#include "MotionTrace.h"
+#include "CommandEncoder.h"
+
+namespace TLeyson_Robot
+{
+	Trajectory::Trajectory(double Period)
+	{
+		this->Period   = Period > 0 ? Period : 0.05;
+		this->Duration = 0;
+	}
+
+	/********************************************************************
+	*                   Trajectory::Add
+	* Precondition:  No waypoints have been added yet; MaxVelocity and
+	*                MaxAcceleration are greater than zero.
+	* Postcondition: The joint is part of every waypoint that follows.
+	********************************************************************/
+	void Trajectory::Add(JointMove* Joint, double MaxVelocity, double MaxAcceleration)
+	{
+		Axis Part;
+		Part.Joint           = Joint;
+		Part.MaxVelocity     = MaxVelocity;
+		Part.MaxAcceleration = MaxAcceleration;
+		Part.Sent            = 0;
+		Part.Direction       = '+';
+
+		char QueryString[] = {Joint->JointToMove, '?', 0x0A, 0x0D, '\0'};
+		for (int k = 0; k < 5; k++)
+			Part.QueryString[k] = QueryString[k];
+
+		this->Joints.push_back(Part);
+	}
+
+	/********************************************************************
+	*                   Trajectory::AddWaypoint
+	* Checks every angle before keeping any of them, so a bad waypoint
+	* leaves the path as it was.
+	* Throws:        BoundaryViolationException.
+	********************************************************************/
+	void Trajectory::AddWaypoint(const std::vector<double>& Angles)
+	{
+		if (Angles.size() != this->Joints.size())
+			throw BoundaryViolationException();
+		for (size_t j = 0; j < Angles.size(); j++)
+		{
+			const JointMove& Joint = *this->Joints[j].Joint;
+			if ( !(Angles[j] > Joint.LowerBound && Angles[j] < Joint.UpperBound) )
+				throw BoundaryViolationException();
+		}
+
+		this->Waypoints.push_back(Angles);
+	}
+
+	/********************************************************************
+	*                   Trajectory::Shape
+	* Fits a trapezoid to a segment whose entry and exit speeds are
+	* already known to be reachable. If there isn't room to reach the
+	* top speed, the trapezoid becomes a triangle with a lower peak.
+	********************************************************************/
+	void Trajectory::Shape(Segment& Part)
+	{
+		double A = Part.Acceleration;
+		double Peak = Part.MaxSpeed;
+		double Accelerating = (Peak * Peak - Part.Entry * Part.Entry) / (2 * A);
+		double Decelerating = (Peak * Peak - Part.Exit * Part.Exit) / (2 * A);
+
+		if (Accelerating + Decelerating > Part.Length)
+		{
+			Peak = std::sqrt((2 * A * Part.Length + Part.Entry * Part.Entry + Part.Exit * Part.Exit) / 2);
+			Peak = std::max(Peak, std::max(Part.Entry, Part.Exit));
+			Accelerating = (Peak * Peak - Part.Entry * Part.Entry) / (2 * A);
+			Decelerating = (Peak * Peak - Part.Exit * Part.Exit) / (2 * A);
+		}
+
+		double Cruising = Part.Length - Accelerating - Decelerating;
+		Part.Peak           = Peak;
+		Part.AccelerateTime = (Peak - Part.Entry) / A;
+		Part.DecelerateTime = (Peak - Part.Exit) / A;
+		Part.CruiseTime     = Cruising > 0 && Peak > 0 ? Cruising / Peak : 0;
+	}
+
+	/********************************************************************
+	*                   Trajectory::Plan
+	* Splits the path into segments, limits the speed through each
+	* waypoint, then runs backwards from the final stop and forwards
+	* from the start so that no segment asks for more acceleration than
+	* it has room for, and shapes each segment.
+	********************************************************************/
+	double Trajectory::Plan(void)
+	{
+		size_t Count = this->Joints.size();
+		std::vector<double> From(Count);
+		for (size_t j = 0; j < Count; j++)
+			From[j] = this->Joints[j].Joint->CurrentPosition;
+
+		this->Segments.clear();
+		for (size_t w = 0; w < this->Waypoints.size(); w++)
+		{
+			Segment Part;
+			Part.From  = From;
+			Part.Delta.resize(Count);
+			Part.Length = 0;
+			for (size_t j = 0; j < Count; j++)
+			{
+				Part.Delta[j] = this->Waypoints[w][j] - From[j];
+				Part.Length  += Part.Delta[j] * Part.Delta[j];
+			}
+			Part.Length = std::sqrt(Part.Length);
+			From = this->Waypoints[w];
+			if (Part.Length < 1e-12)
+				continue;
+
+			// The path speed at which the first joint reaches its own limit.
+			Part.MaxSpeed     = HUGE_VAL;
+			Part.Acceleration = HUGE_VAL;
+			for (size_t j = 0; j < Count; j++)
+			{
+				const JointMove& Joint = *this->Joints[j].Joint;
+				double Share    = std::fabs(Part.Delta[j]) / Part.Length;
+				double Velocity = this->Joints[j].MaxVelocity;
+				if (Joint.Drain.Calibrated() && Joint.Drain.Rate() > 0)
+					Velocity = std::min(Velocity, Joint.Drain.Rate() * Joint.Resolution);
+				if (Share > 0)
+				{
+					Part.MaxSpeed     = std::min(Part.MaxSpeed, Velocity / Share);
+					Part.Acceleration = std::min(Part.Acceleration, this->Joints[j].MaxAcceleration / Share);
+				}
+			}
+			Part.Entry = 0;
+			Part.Exit  = 0;
+			this->Segments.push_back(Part);
+		}
+
+		// The speed each segment may be entered at, from the turn before it.
+		std::vector<Segment>& S = this->Segments;
+		for (size_t k = 1; k < S.size(); k++)
+		{
+			double Cosine = 0;
+			for (size_t j = 0; j < Count; j++)
+				Cosine += S[k - 1].Delta[j] * S[k].Delta[j];
+			Cosine /= S[k - 1].Length * S[k].Length;
+			S[k].Entry = Cosine > 0 ? std::min(S[k - 1].MaxSpeed, S[k].MaxSpeed) * Cosine : 0;
+		}
+
+		double Next = 0;
+		for (size_t k = S.size(); k-- > 0; )
+		{
+			S[k].Exit  = Next;
+			S[k].Entry = std::min(S[k].Entry, std::sqrt(Next * Next + 2 * S[k].Acceleration * S[k].Length));
+			Next = S[k].Entry;
+		}
+
+		double Previous = 0;
+		this->Duration = 0;
+		for (size_t k = 0; k < S.size(); k++)
+		{
+			S[k].Entry = std::min(S[k].Entry, Previous);
+			S[k].Exit  = std::min(S[k].Exit, std::sqrt(S[k].Entry * S[k].Entry + 2 * S[k].Acceleration * S[k].Length));
+			Previous   = S[k].Exit;
+
+			this->Shape(S[k]);
+			S[k].Start = this->Duration;
+			this->Duration += S[k].AccelerateTime + S[k].CruiseTime + S[k].DecelerateTime;
+		}
+
+		return this->Duration;
+	}
+
+	// Distance along a segment, Time seconds after it begins.
+	double Trajectory::Travelled(const Segment& Part, double Time) const
+	{
+		double A = Part.Acceleration;
+		double Distance;
+
+		if (Time < Part.AccelerateTime)
+			return Part.Entry * Time + A * Time * Time / 2;
+
+		Distance = Part.Entry * Part.AccelerateTime + A * Part.AccelerateTime * Part.AccelerateTime / 2;
+		Time    -= Part.AccelerateTime;
+		if (Time < Part.CruiseTime)
+			return Distance + Part.Peak * Time;
+
+		Distance += Part.Peak * Part.CruiseTime;
+		Time      = std::min(Time - Part.CruiseTime, Part.DecelerateTime);
+		Distance += Part.Peak * Time - A * Time * Time / 2;
+		return std::min(Distance, Part.Length);
+	}
+
+	void Trajectory::AngleAt(double Time, std::vector<double>& Angles) const
+	{
+		const Segment* Part = &this->Segments.back();
+		for (size_t k = 1; k < this->Segments.size(); k++)
+		{
+			if (this->Segments[k].Start > Time)
+			{
+				Part = &this->Segments[k - 1];
+				break;
+			}
+		}
+
+		double Fraction = this->Travelled(*Part, Time - Part->Start) / Part->Length;
+		Angles.resize(Part->From.size());
+		for (size_t j = 0; j < Angles.size(); j++)
+			Angles[j] = Part->From[j] + Part->Delta[j] * Fraction;
+	}
+
+	/********************************************************************
+	*                   Trajectory::Ask
+	* Sends the joint's register query, without waiting for the reply,
+	* if the drain model says the ticks it still needs to reach Target
+	* might not fit. Returns whether it did.
+	********************************************************************/
+	bool Trajectory::Ask(Axis& Part, int Target)
+	{
+		JointMove& Joint = *Part.Joint;
+		int Capacity = int(Joint.GroupSize + Joint.Replenish);
+		int Room     = Capacity - int(std::ceil(Joint.Drain.Predict(MonotonicSeconds())));
+		int Wanted   = abs(Target - Part.Sent);
+		if (Wanted == 0 || Wanted <= Room)
+			return false;
+		Joint.AskRegister(Part.QueryString);
+		return true;
+	}
+
+	/********************************************************************
+	*                   Trajectory::Feed
+	* Sends a joint whatever ticks it still needs to reach Target, as
+	* far as its register has room: the room read back if Ask sent a
+	* query, otherwise the room the drain model predicts.
+	********************************************************************/
+	void Trajectory::Feed(Axis& Part, int Target, bool Asked)
+	{
+		JointMove& Joint = *Part.Joint;
+		int Capacity = int(Joint.GroupSize + Joint.Replenish);
+		int Room     = Asked ? Capacity - Joint.CollectRegister()
+		                     : Capacity - int(std::ceil(Joint.Drain.Predict(MonotonicSeconds())));
+		int Wanted   = abs(Target - Part.Sent);
+		if (Wanted == 0)
+			return;
+
+		int Ticks = std::min(Wanted, Room);
+		if (Ticks <= 0)
+			return;
+
+		char Direction = Target > Part.Sent ? '+' : '-';
+		SendTicks(*(Joint.ComPort), Joint.JointToMove, Direction, (unsigned int) Ticks);
+		Trace(teCOMMAND, Joint.JointToMove, Ticks);
+		Joint.Sent(Direction, (unsigned int) Ticks, MonotonicSeconds());
+		Part.Sent += Direction == '+' ? Ticks : -Ticks;
+		Part.Direction = Direction;
+	}
+
+	/********************************************************************
+	*                   Trajectory::Unwind
+	* A joint stalled partway through Execute. Each joint's position is
+	* set to the ticks it was actually sent, less whatever the stalled
+	* joint's Stop threw away, and the waypoints are cleared, as after
+	* a path that finished.
+	********************************************************************/
+	void Trajectory::Unwind(const StalledMovementException& Stall)
+	{
+		for (size_t j = 0; j < this->Joints.size(); j++)
+		{
+			Axis&      Part  = this->Joints[j];
+			JointMove& Joint = *Part.Joint;
+			int        Ended = Part.Sent;
+			if (Joint.JointToMove == Stall.Joint && Stall.Register > 0)
+				Ended -= Part.Direction == '+' ? Stall.Register : -Stall.Register;
+			Trace(teMOVE_END, Joint.JointToMove, Ended - Joint.HomeDeviation);
+			Joint.HomeDeviation   = Ended;
+			Joint.CurrentPosition = Ended * Joint.Resolution;
+		}
+		this->Waypoints.clear();
+	}
+
+	/********************************************************************
+	*                   Trajectory::Execute
+	* Every Period, sends each joint the ticks it should have covered by
+	* the end of the next one, so its register is never empty while the
+	* profile still has it moving. Ticks a full register couldn't take
+	* are sent in a later period; the loop ends once every joint has
+	* been sent all of its ticks.
+	* Precondition:  Every joint added is connected to the robot.
+	* Postcondition: Every joint is at the last waypoint.
+	********************************************************************/
+	int Trajectory::Execute(void)
+	{
+		// Planned again, in case a joint has moved since Plan was called.
+		this->Plan();
+		if (this->Segments.empty())
+		{
+			this->Waypoints.clear();
+			return 0;
+		}
+
+		// As in CoordinatedMove, hold every port in a fixed order.
+		std::vector<Tserial*> Ports;
+		for (size_t j = 0; j < this->Joints.size(); j++)
+			Ports.push_back(this->Joints[j].Joint->ComPort);
+		std::sort(Ports.begin(), Ports.end());
+		Ports.erase(std::unique(Ports.begin(), Ports.end()), Ports.end());
+		std::vector< std::unique_ptr< std::lock_guard<std::mutex> > > PortsHeld;
+		for (size_t p = 0; p < Ports.size(); p++)
+			PortsHeld.emplace_back(new std::lock_guard<std::mutex>(PortWorker::Lock(Ports[p])));
+
+		std::vector<int> Final(this->Joints.size());
+		for (size_t j = 0; j < this->Joints.size(); j++)
+		{
+			Axis& Part = this->Joints[j];
+			Part.Sent = Part.Joint->HomeDeviation;
+			Final[j]  = Part.Joint->Round(Part.Joint->ConvertToTicks(this->Waypoints.back()[j]));
+			Trace(teMOVE_BEGIN, Part.Joint->JointToMove, Final[j] - Part.Sent);
+		}
+
+		std::vector<double> Angles;
+		std::vector<int>    Targets(this->Joints.size());
+		std::vector<char>   Asked(this->Joints.size());
+		double Began = MonotonicSeconds();
+		bool   Done  = false;
+		try
+		{
+			for (int Step = 0; !Done; Step++)
+			{
+				SwitchPoller::SleepUntil(Ports, Began + Step * this->Period);
+				double Ahead = std::min((Step + 1) * this->Period, this->Duration);
+				this->AngleAt(Ahead, Angles);
+
+				PortBatch Batch(Ports);
+				Done = Ahead >= this->Duration;
+				// Every query this period goes out before any reply is read.
+				for (size_t j = 0; j < this->Joints.size(); j++)
+				{
+					Axis& Part = this->Joints[j];
+					Targets[j] = Ahead >= this->Duration ? Final[j]
+					           : Part.Joint->Round(Part.Joint->ConvertToTicks(Angles[j]));
+					Asked[j]   = this->Ask(Part, Targets[j]);
+				}
+				for (size_t j = 0; j < this->Joints.size(); j++)
+				{
+					this->Feed(this->Joints[j], Targets[j], Asked[j] != 0);
+					Done = Done && this->Joints[j].Sent == Final[j];
+				}
+			}
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			this->Unwind(Stall);
+			throw;
+		}
+
+		double Finished = MonotonicSeconds();
+		for (size_t j = 0; j < this->Joints.size(); j++)
+		{
+			JointMove& Joint = *this->Joints[j].Joint;
+			Trace(teMOVE_END, Joint.JointToMove, Final[j] - Joint.HomeDeviation);
+			TraceLatency(Joint.JointToMove, tmMOVE_DURATION, Finished - Began);
+			Joint.HomeDeviation   = Final[j];
+			Joint.CurrentPosition = this->Waypoints.back()[j];
+		}
+
+		this->Waypoints.clear();
+		return 0;
+	}
+}
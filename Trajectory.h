@@ -0,0 +1,110 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <vector>
+#include "JointMoveProto.h"
+
+/*************************************************************************************
+* Trajectory.h contains class Trajectory, which moves a set of joints through a
+* list of joint-space waypoints with limited velocity and acceleration:
+*
+* - void Add(JointMove* Joint, double MaxVelocity, double MaxAcceleration):
+*      Adds a joint, with its limits in radians per second and radians per second
+*      squared. Every joint must be added before the first waypoint.
+* - void AddWaypoint(const std::vector<double>& Angles):
+*      Adds a point to pass through, with one angle for each joint in the order
+*      they were added.
+*      Throws:        BoundaryViolationException, if an angle violates one of its
+*                     joint's boundaries, or the number of angles is wrong.
+* - double Plan(void):
+*      Works out the timing of the whole path from where the joints are now and
+*      returns its duration in seconds. Execute plans again from wherever the
+*      joints are when it is called.
+* - int Execute(void):
+*      Precondition:  Every joint added is connected to the robot.
+*      Postcondition: The joints have passed through every waypoint and stopped at
+*                     the last one. The waypoints are cleared; the joints stay.
+*      Throws:        StalledMovementException, if one of the joints stalls (see
+*                     JointMove::Move). That joint is stopped and the rest finish
+*                     the ticks already sent to them; each joint's position is
+*                     then where those ticks take it, and the waypoints are
+*                     cleared.
+*
+* The joints travel in a straight line between waypoints, all arriving together.
+* Along each line the speed follows a trapezoid: it accelerates, cruises and
+* decelerates within the tightest limit of the joints involved. Waypoints are
+* not stopped at unless the path turns sharply there: the speed through a
+* waypoint is the lower of the two segments' top speeds, scaled by the cosine of
+* the angle between them, and is lowered further if the segments either side are
+* too short to reach or shed it.
+*
+* Instead of whole groups, each joint is sent the ticks it should have covered
+* by the end of every Period, so the register holds only a little more than one
+* period's worth and the joint follows the profile. A joint whose register has
+* no room (GroupSize plus Replenish) for the next ticks is queried, as in Move,
+* and the ticks held over to the next period. All the queries due in a period
+* are sent before any reply is read. A joint's velocity limit is
+* lowered to its measured drain rate, if known, since it can go no faster.
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	class Trajectory
+	{
+		public:
+			// Period is the time between tick updates, in seconds.
+			Trajectory(double Period = 0.05);
+
+			void   Add        (JointMove* Joint, double MaxVelocity, double MaxAcceleration);
+			void   AddWaypoint(const std::vector<double>& Angles);
+			double Plan       (void);
+			int    Execute    (void);
+
+			int    ViewJointCount   (void) const { return int(this->Joints.size()); }
+			int    ViewWaypointCount(void) const { return int(this->Waypoints.size()); }
+		private:
+			struct Axis
+			{
+				JointMove* Joint;
+				double     MaxVelocity;
+				double     MaxAcceleration;
+				// Ticks from home sent so far during Execute.
+				int        Sent;
+				// '+' or '-', as the ticks last sent.
+				char       Direction;
+				char       QueryString[5];
+			};
+
+			// One straight line in joint space, timed as a trapezoid. Speeds
+			// and distances are along the line, in radians of joint space.
+			struct Segment
+			{
+				std::vector<double> From;
+				std::vector<double> Delta;
+				double Length;
+				double MaxSpeed;
+				double Acceleration;
+				double Entry;
+				double Exit;
+				double Peak;
+				double AccelerateTime;
+				double CruiseTime;
+				double DecelerateTime;
+				// Time from the start of the path to the start of this segment.
+				double Start;
+			};
+
+			double                             Period;
+			std::vector<Axis>                  Joints;
+			std::vector< std::vector<double> > Waypoints;
+			std::vector<Segment>               Segments;
+			double                             Duration;
+
+			void   Shape     (Segment& Part);
+			double Travelled (const Segment& Part, double Time) const;
+			void   AngleAt   (double Time, std::vector<double>& Angles) const;
+			bool   Ask       (Axis& Part, int Target);
+			void   Feed      (Axis& Part, int Target, bool Asked);
+			void   Unwind    (const StalledMovementException& Stall);
+	};
+}
+#endif
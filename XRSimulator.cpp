@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmath>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+#include <string.h>
+#include "FlowControl.h"
+#include "XRSimulator.h"
+
+namespace TLeyson_Robot
+{
+	SimulatedJoint::SimulatedJoint()
+	{
+		this->TickRate     = 150;
+		this->Position     = -100;
+		this->Register     = 0;
+		this->TripPosition = 0;
+		this->TripWidth    = 20;
+		this->Partial      = 0;
+		this->TicksMoved   = 0;
+	}
+
+	/********************************************************************
+	*                   XRController::XRController
+	* Baud is the emulated line speed; replies are held back for the
+	* time their bytes would take on the wire, and commands only take
+	* effect once their last byte would have arrived. A Baud of zero
+	* turns the line delay off.
+	********************************************************************/
+	XRController::XRController(int Baud)
+	{
+		this->CharTime      = Baud > 0 ? 11.0 / Baud : 0;
+		this->RxFree        = 0;
+		this->TxFree        = 0;
+		this->Clock         = 0;
+		this->PendingLength = 0;
+		this->Queries       = 0;
+		this->Commands      = 0;
+	}
+
+	/********************************************************************
+	*                   XRController::SwitchBits
+	* The byte the I command reports, before the offset of 32 is added.
+	********************************************************************/
+	unsigned char XRController::SwitchBits(void) const
+	{
+		unsigned char Bits = 0;
+		for (char Letter = 'C'; Letter <= 'H'; Letter++)
+		{
+			const SimulatedJoint& J = this->Joint(Letter);
+			bool Closed = J.Position >= J.TripPosition && J.Position < J.TripPosition + J.TripWidth;
+			if (!Closed)
+				Bits |= 1 << (Letter - 'C');
+		}
+		return Bits;
+	}
+
+	void XRController::Receive(const char* Data, int Length, double Now)
+	{
+		for (int k = 0; k < Length; k++)
+		{
+			double Arrival = (Now > this->RxFree ? Now : this->RxFree) + this->CharTime;
+			this->RxFree = Arrival;
+			TimedByte Byte = {Arrival, Data[k]};
+			this->Incoming.push_back(Byte);
+		}
+	}
+
+	void XRController::Advance(double Now)
+	{
+		while (!this->Incoming.empty() && this->Incoming.front().Time <= Now)
+		{
+			TimedByte Byte = this->Incoming.front();
+			this->Incoming.pop_front();
+			this->RunJoints(Byte.Time);
+			this->Parse(Byte.Byte, Byte.Time);
+		}
+		this->RunJoints(Now);
+	}
+
+	int XRController::TakeOutput(double Now, std::string& Out)
+	{
+		int Count = 0;
+		while (!this->Outgoing.empty() && this->Outgoing.front().Time <= Now)
+		{
+			Out += this->Outgoing.front().Byte;
+			this->Outgoing.pop_front();
+			Count++;
+		}
+		return Count;
+	}
+
+	double XRController::NextEvent(void) const
+	{
+		double Next = -1;
+		if (!this->Incoming.empty())
+			Next = this->Incoming.front().Time;
+		if (!this->Outgoing.empty() && (Next < 0 || this->Outgoing.front().Time < Next))
+			Next = this->Outgoing.front().Time;
+		return Next;
+	}
+
+	/********************************************************************
+	*                   XRController::RunJoints
+	* Drains every joint's register from the model's clock up to Until.
+	********************************************************************/
+	void XRController::RunJoints(double Until)
+	{
+		double Elapsed = Until - this->Clock;
+		if (Elapsed <= 0)
+			return;
+		this->Clock = Until;
+
+		for (int k = 0; k < 8; k++)
+		{
+			SimulatedJoint& J = this->Joints[k];
+			if (J.Register == 0)
+				continue;
+
+			J.Partial += Elapsed * J.TickRate;
+			int Steps = static_cast<int>(J.Partial);
+			if (Steps > abs(J.Register))
+				Steps = abs(J.Register);
+			J.Partial -= Steps;
+
+			int Direction = J.Register > 0 ? 1 : -1;
+			J.Position   += Direction * Steps;
+			J.Register   -= Direction * Steps;
+			J.TicksMoved += Steps;
+			if (J.Register == 0)
+				J.Partial = 0;
+		}
+	}
+
+	/********************************************************************
+	*                   XRController::Parse
+	* Feeds one byte to the command parser. Queries and stops take effect
+	* on their last character; a tick command ends at the first byte
+	* that is not a digit, which is then parsed as the start of the next
+	* command.
+	********************************************************************/
+	void XRController::Parse(char Byte, double When)
+	{
+		if (this->PendingLength == 0)
+		{
+			if (Byte == 'I')
+			{
+				this->Queries++;
+				this->Reply(char(this->SwitchBits() + 32), When);
+			}
+			else if (Byte >= 'A' && Byte <= 'H')
+				this->Pending[this->PendingLength++] = Byte;
+			return;
+		}
+
+		if (this->PendingLength == 1)
+		{
+			SimulatedJoint& J = this->Joint(this->Pending[0]);
+			this->PendingLength = 0;
+			switch (Byte)
+			{
+				case '?':
+				{
+					int Value = abs(J.Register);
+					this->Queries++;
+					this->Reply(char((Value > 95 ? 95 : Value) + 32), When);
+					return;
+				}
+				case 'X':
+					this->Commands++;
+					J.Register = 0;
+					J.Partial  = 0;
+					return;
+				case '+':
+				case '-':
+					this->Pending[this->PendingLength++] = this->Pending[0];
+					this->Pending[this->PendingLength++] = Byte;
+					return;
+			}
+			this->Parse(Byte, When);
+			return;
+		}
+
+		if (Byte >= '0' && Byte <= '9')
+		{
+			if (this->PendingLength < int(sizeof(this->Pending)) - 1)
+				this->Pending[this->PendingLength++] = Byte;
+			return;
+		}
+		this->Execute();
+		this->Parse(Byte, When);
+	}
+
+	void XRController::Execute(void)
+	{
+		this->Pending[this->PendingLength] = '\0';
+		int Ticks = atoi(this->Pending + 2);
+		SimulatedJoint& J = this->Joint(this->Pending[0]);
+		J.Register += this->Pending[1] == '+' ? Ticks : -Ticks;
+		this->PendingLength = 0;
+		this->Commands++;
+	}
+
+	void XRController::Reply(char Byte, double When)
+	{
+		double Done = (When > this->TxFree ? When : this->TxFree) + this->CharTime;
+		this->TxFree = Done;
+		TimedByte Out = {Done, Byte};
+		this->Outgoing.push_back(Out);
+	}
+
+	LoopbackPort::LoopbackPort(XRController& Model) : Model(Model)
+	{
+		this->Taken = 0;
+	}
+
+	void LoopbackPort::write(const char* Buffer, int Length)
+	{
+		std::lock_guard<std::mutex> Hold(this->Lock);
+		double Now = MonotonicSeconds();
+		this->Model.Advance(Now);
+		this->Model.Receive(Buffer, Length, Now);
+	}
+
+	/********************************************************************
+	*                   LoopbackPort::read
+	* Waits, on the MonotonicSeconds clock, for the model's next event
+	* until a reply byte has finished arriving or the time is up. With
+	* nothing on its way and no time limit, nothing will ever arrive.
+	********************************************************************/
+	int LoopbackPort::read(char* Buffer, int Length, int Timeout)
+	{
+		double Deadline = Timeout < 0 ? -1 : MonotonicSeconds() + Timeout / 1000.0;
+		for (;;)
+		{
+			double Next;
+			{
+				std::lock_guard<std::mutex> Hold(this->Lock);
+				int Ready = this->Collect(MonotonicSeconds());
+				if (Ready > 0)
+				{
+					int Count = Ready < Length ? Ready : Length;
+					memcpy(Buffer, this->Arrived.data() + this->Taken, Count);
+					this->Taken += Count;
+					if (this->Taken == this->Arrived.size())
+					{
+						this->Arrived.clear();
+						this->Taken = 0;
+					}
+					return Count;
+				}
+				Next = this->Model.NextEvent();
+			}
+
+			if (Timeout == 0)
+				return 0;
+			if (Next < 0 && Deadline < 0)
+				return -1;
+			if (Next < 0 || (Deadline >= 0 && Next > Deadline))
+			{
+				SleepUntil(Deadline);
+				return 0;
+			}
+			SleepUntil(Next);
+		}
+	}
+
+	int LoopbackPort::available(void)
+	{
+		std::lock_guard<std::mutex> Hold(this->Lock);
+		return this->Collect(MonotonicSeconds());
+	}
+
+	// Runs the model up to Now and takes the replies it has finished
+	// sending. Returns the number of bytes waiting to be read.
+	// Precondition:  The caller holds Lock.
+	int LoopbackPort::Collect(double Now)
+	{
+		this->Model.Advance(Now);
+		this->Model.TakeOutput(Now, this->Arrived);
+		return int(this->Arrived.size() - this->Taken);
+	}
+
+#ifndef _WIN32
+	namespace
+	{
+		double WallSeconds(void)
+		{
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return ts.tv_sec + ts.tv_nsec * 1e-9;
+		}
+	}
+
+	SimulatedPort::SimulatedPort(XRController& Model, double Speed) : Model(Model)
+	{
+		this->Speed  = Speed > 0 ? Speed : 1;
+		this->Start  = WallSeconds();
+		this->Master = -1;
+		this->Keeper = -1;
+		this->Echo   = 0;
+		this->Running.store(false);
+	}
+
+	SimulatedPort::~SimulatedPort()
+	{
+		if (this->Keeper != -1)
+			close(this->Keeper);
+		if (this->Master != -1)
+			close(this->Master);
+	}
+
+	double SimulatedPort::ModelTime(void) const
+	{
+		return (WallSeconds() - this->Start) * this->Speed;
+	}
+
+	/********************************************************************
+	*                   SimulatedPort::Open
+	* Creates the pseudo-terminal and puts the slave side in raw mode.
+	* Returns false, with errno set, if that fails.
+	********************************************************************/
+	bool SimulatedPort::Open(void)
+	{
+		this->Master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (this->Master == -1 || grantpt(this->Master) == -1 || unlockpt(this->Master) == -1)
+			return false;
+		this->SlaveName = ptsname(this->Master);
+
+		struct termios Raw;
+		this->Keeper = open(this->SlaveName.c_str(), O_RDWR | O_NOCTTY);
+		if (this->Keeper == -1 || tcgetattr(this->Keeper, &Raw) == -1)
+			return false;
+		cfmakeraw(&Raw);
+		tcsetattr(this->Keeper, TCSANOW, &Raw);
+		this->Running.store(true);
+		return true;
+	}
+
+	/********************************************************************
+	*                   SimulatedPort::Run
+	* Moves bytes between the pseudo-terminal and the model, sleeping in
+	* ppoll until the host writes or the model's next reply byte is due.
+	* ppoll takes a timespec, so replies are not held back to the next
+	* whole millisecond.
+	********************************************************************/
+	void SimulatedPort::Run(void)
+	{
+		struct pollfd Event;
+		Event.fd     = this->Master;
+		Event.events = POLLIN;
+
+		char        Buffer[512];
+		std::string Output;
+
+		while (this->Running.load())
+		{
+			double Now  = this->ModelTime();
+			double Next;
+			Output.clear();
+			{
+				std::lock_guard<std::mutex> Hold(this->Lock);
+				this->Model.Advance(Now);
+				this->Model.TakeOutput(Now, Output);
+				Next = this->Model.NextEvent();
+			}
+			if (!Output.empty() && write(this->Master, Output.data(), Output.size()) < 0 && errno != EAGAIN)
+				perror("SimulatedPort: write");
+
+			double Wait = 0.1;
+			if (Next >= 0)
+			{
+				Wait = (Next - Now) / this->Speed;
+				Wait = Wait < 0 ? 0 : Wait > 0.1 ? 0.1 : Wait;
+			}
+			struct timespec Timeout;
+			Timeout.tv_sec  = 0;
+			Timeout.tv_nsec = long(Wait * 1e9);
+			if (ppoll(&Event, 1, &Timeout, 0) == 1 && (Event.revents & POLLIN))
+			{
+				ssize_t n = read(this->Master, Buffer, sizeof(Buffer));
+				if (n > 0)
+				{
+					std::lock_guard<std::mutex> Hold(this->Lock);
+					this->Model.Receive(Buffer, int(n), this->ModelTime());
+					if (this->Echo)
+						fprintf(this->Echo, "%.*s", int(n), Buffer);
+				}
+			}
+		}
+	}
+#endif
+}
@@ -0,0 +1,170 @@
+#ifndef XRSIMULATOR_H
+#define XRSIMULATOR_H
+
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include "tserial.h"
+
+/*************************************************************************************
+* XRSimulator.h contains class XRController, a software model of the XR series
+* controller as JointMove sees it over the serial line:
+*
+* - "<joint>+<n>" / "<joint>-<n>" adds n ticks to the joint's register. The joint
+*   drains its register at TickRate ticks per second.
+* - "<joint>?" is answered with a single byte: the register value plus 32.
+* - "I" is answered with a single byte: the limit switch bits plus 32. Joint C is
+*   bit 0, D bit 1 and so on; a set bit means the switch is open.
+* - "<joint>X" empties the register, stopping the joint.
+* Newlines, carriage returns and ';' between commands are ignored.
+*
+* The model keeps no clock of its own. Every call takes the current time in
+* seconds, so the same model serves a pseudo-terminal driven by the wall clock
+* and anything driven by a virtual one.
+*
+* On POSIX systems, class SimulatedPort puts a model on a pseudo-terminal:
+* Open() creates it, Name() is the device to hand to Tserial::connect, and Run()
+* serves it on the calling thread until Stop() is called. The model's clock runs
+* Speed times faster than the wall clock. Hold ModelLock() to change the model
+* while Run() is going.
+*
+* Class LoopbackPort puts a model behind a Tserial in the same process, with no
+* device at all: pass it to Tserial::connect in place of a port name. It runs the
+* model on the MonotonicSeconds clock (see FlowControl.h). With a VirtualClock
+* installed, a read that has to wait for a reply moves the clock straight on to
+* when the reply would finish arriving, and a read that times out moves it on by
+* the timeout, so Move, Home and the rest run exactly as against the robot, line
+* delays included, as fast as they can compute:
+*
+*     XRController Model;
+*     LoopbackPort Loopback(Model);
+*     VirtualClock Virtual;
+*     Clock::Install(&Virtual);
+*     Tserial Port;
+*     Port.connect(&Loopback);
+*************************************************************************************/
+namespace TLeyson_Robot
+{
+	struct SimulatedJoint
+	{
+		// Ticks per second the joint drains from its register.
+		double TickRate;
+		// Absolute position, in ticks.
+		int    Position;
+		// Ticks still to be moved; the sign gives the direction.
+		int    Register;
+		// The switch is closed while TripPosition <= Position < TripPosition + TripWidth.
+		int    TripPosition;
+		int    TripWidth;
+		// Fraction of a tick already drained but not yet counted in Position.
+		double Partial;
+		// Ticks moved since the model was created.
+		long   TicksMoved;
+
+		SimulatedJoint();
+	};
+
+	class XRController
+	{
+		public:
+			XRController(int Baud = 9600);
+
+			// Hands bytes written by the host to the controller at time Now.
+			void Receive(const char* Data, int Length, double Now);
+			// Runs the model up to time Now: moves the joints and answers
+			// every command whose last byte has arrived.
+			void Advance(double Now);
+			// Moves the reply bytes that have finished transmitting by Now
+			// into Out. Returns the number of bytes moved.
+			int  TakeOutput(double Now, std::string& Out);
+			// The earliest time at which Advance or TakeOutput has work to do,
+			// or a negative number if the model is idle.
+			double NextEvent(void) const;
+
+			SimulatedJoint&       Joint      (char Letter)       { return this->Joints[Letter - 'A']; }
+			const SimulatedJoint& Joint      (char Letter) const { return this->Joints[Letter - 'A']; }
+			unsigned char         SwitchBits (void) const;
+			long                  QueriesAnswered(void) const { return this->Queries; }
+			long                  CommandsReceived(void) const { return this->Commands; }
+		private:
+			struct TimedByte { double Time; char Byte; };
+
+			SimulatedJoint Joints[8];
+			// Seconds the line takes for one 7E2 character (start, 7 data, parity, 2 stop).
+			double CharTime;
+			// Bytes in flight from the host, stamped with the time they finish arriving.
+			std::deque<TimedByte> Incoming;
+			// Reply bytes, stamped with the time they finish leaving.
+			std::deque<TimedByte> Outgoing;
+			double RxFree;
+			double TxFree;
+			double Clock;
+			// The command being parsed.
+			char   Pending[16];
+			int    PendingLength;
+			long   Queries;
+			long   Commands;
+
+			void RunJoints (double Until);
+			void Parse     (char Byte, double When);
+			void Execute   (void);
+			void Reply     (char Byte, double When);
+	};
+
+	class LoopbackPort : public serial_transport
+	{
+		public:
+			LoopbackPort(XRController& Model);
+
+			void        write    (const char* Buffer, int Length);
+			int         read     (char* Buffer, int Length, int Timeout);
+			int         available(void);
+			std::mutex& ModelLock(void) { return this->Lock; }
+		private:
+			LoopbackPort(const LoopbackPort&);
+			LoopbackPort& operator=(const LoopbackPort&);
+
+			XRController& Model;
+			std::mutex    Lock;
+			// Reply bytes taken from the model, of which the first Taken
+			// have been read.
+			std::string   Arrived;
+			size_t        Taken;
+
+			int Collect(double Now);
+	};
+
+#ifndef _WIN32
+	class SimulatedPort
+	{
+		public:
+			SimulatedPort(XRController& Model, double Speed = 1);
+			~SimulatedPort();
+
+			bool        Open     (void);
+			void        Run      (void);
+			void        Stop     (void) { this->Running.store(false); }
+			const char* Name     (void) const { return this->SlaveName.c_str(); }
+			std::mutex& ModelLock(void) { return this->Lock; }
+			// Copies every byte the host writes to Out, or stops if Out is 0.
+			void        EchoTo   (FILE* Out) { this->Echo = Out; }
+			// The model's current time, in its own (scaled) seconds.
+			double      ModelTime(void) const;
+		private:
+			XRController&     Model;
+			double            Speed;
+			double            Start;
+			int               Master;
+			// The slave side, held open so the master never sees a hangup
+			// when a client disconnects.
+			int               Keeper;
+			std::string       SlaveName;
+			std::atomic<bool> Running;
+			std::mutex        Lock;
+			FILE*             Echo;
+	};
+#endif
+}
+#endif
@@ -10,17 +10,27 @@ int MoveRobot(Tserial* ComPort, char Joint);
 int main(void)
 {
 	Tserial com;
+#ifdef _WIN32
 	com.connect(L"com1", 9600, spEVEN);
+#else
+	com.connect("/dev/ttyS0", 9600, spEVEN);
+#endif
 
 	try
 	{
 		
+		// Home the three together rather than one after another.
 		TLeyson_Robot::JointMove djoint('D', 5 * PI/12, -5 * PI/12, 
-			"H:\\C++_Examples\\MoveClass\\Prototypes\\JointMoveProto\\resolutions.txt", &com);
+			"H:\\C++_Examples\\MoveClass\\Prototypes\\JointMoveProto\\resolutions.txt", &com, false);
 		TLeyson_Robot::JointMove ejoint('E', PI/3, -PI/3, 
-			"H:\\C++_Examples\\MoveClass\\Prototypes\\JointMoveProto\\resolutions.txt", &com);
+			"H:\\C++_Examples\\MoveClass\\Prototypes\\JointMoveProto\\resolutions.txt", &com, false);
 		TLeyson_Robot::JointMove fjoint('F', PI/6, -PI/6, 
-			"H:\\C++_Examples\\MoveClass\\Prototypes\\JointMoveProto\\resolutions.txt", &com);
+			"H:\\C++_Examples\\MoveClass\\Prototypes\\JointMoveProto\\resolutions.txt", &com, false);
+		std::vector<TLeyson_Robot::JointMove*> Joints;
+		Joints.push_back(&djoint);
+		Joints.push_back(&ejoint);
+		Joints.push_back(&fjoint);
+		TLeyson_Robot::JointMove::HomeAll(Joints);
 		Sleep(1000);
 		djoint.Move(-PI/8);
 		djoint.Move(PI/12);
@@ -35,6 +45,10 @@ int main(void)
 		cout << "File not found." << endl;
 		cout << "File with name " << e.fname << " could not be located." << endl;
 	}
+	catch (TLeyson_Robot::MalformedConfigException m)
+	{
+		cout << "Line " << m.line << " of " << m.fname << " could not be read." << endl;
+	}
 	catch (TLeyson_Robot::ValueNotFoundException f)
 	{
 		cout << "The value could not be found in " << f.fname << endl;
@@ -33,13 +33,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
 #include <process.h>
 #include <conio.h>
 #include <windows.h>
 //#include <widechar.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#endif
 
 #include "tserial.h"
 
+#ifdef _WIN32
+
 /* -------------------------------------------------------------------- */
 /* -------------------------    Tserial   ----------------------------- */
 /* -------------------------------------------------------------------- */
@@ -49,6 +61,17 @@ Tserial::Tserial()
     port[0]          = 0;
     rate             = 0;
     serial_handle    = INVALID_HANDLE_VALUE;
+    tx_length        = 0;
+    batch_depth      = 0;
+    trace_hook       = 0;
+    trace_context    = 0;
+    next_ticket      = 0;
+    next_reply       = 0;
+    reply_held       = 0;
+    late_replies     = 0;
+    read_timeout     = 0;
+    timed_out        = 0;
+    transport        = 0;
 }
 
 /* -------------------------------------------------------------------- */
@@ -56,6 +79,7 @@ Tserial::Tserial()
 /* -------------------------------------------------------------------- */
 Tserial::~Tserial()
 {
+    flush();
     if (serial_handle!=INVALID_HANDLE_VALUE)
         CloseHandle(serial_handle);
     serial_handle = INVALID_HANDLE_VALUE;
@@ -65,9 +89,13 @@ Tserial::~Tserial()
 /* -------------------------------------------------------------------- */
 void Tserial::disconnect(void)
 {
+    flush();
     if (serial_handle!=INVALID_HANDLE_VALUE)
         CloseHandle(serial_handle);
     serial_handle = INVALID_HANDLE_VALUE;
+    transport     = 0;
+    // nothing more will be answered on this line
+    next_reply = next_ticket;
 }
 /* -------------------------------------------------------------------- */
 /* --------------------------    connect      ------------------------- */
@@ -76,12 +104,13 @@ int  Tserial::connect          (wchar_t *port_arg, int rate_arg, serial_parity p
 {
     int erreur;
     DCB  dcb;
-    COMMTIMEOUTS cto = { 0, 0, 0, 0, 0 };
+    COMMTIMEOUTS cto = { 0, 0, (DWORD) read_timeout, 0, 0 };
 
     /* --------------------------------------------- */
     if (serial_handle!=INVALID_HANDLE_VALUE)
         CloseHandle(serial_handle);
     serial_handle = INVALID_HANDLE_VALUE;
+    transport     = 0;
 
     erreur = 0;
 
@@ -177,24 +206,17 @@ int  Tserial::connect          (wchar_t *port_arg, int rate_arg, serial_parity p
 
 
 /* -------------------------------------------------------------------- */
-/* --------------------------    sendChar     ------------------------- */
-/* -------------------------------------------------------------------- */
-void Tserial::sendChar(char data)
-{
-    sendArray(&data, 1);
-}
-
-/* -------------------------------------------------------------------- */
-/* --------------------------    sendArray    ------------------------- */
+/* --------------------------    writeRaw     ------------------------- */
 /* -------------------------------------------------------------------- */
-void Tserial::sendArray(char *buffer, int len)
+void Tserial::writeRaw(const char *buffer, int len)
 {
     unsigned long result;
 	
-    if (serial_handle!=INVALID_HANDLE_VALUE)
+    if (transport!=0)
+        transport->write(buffer, len);
+    else if (serial_handle!=INVALID_HANDLE_VALUE)
 	{
        WriteFile(serial_handle, buffer, len, &result, NULL);
-	   std::cout << buffer << " " << len << std::endl;
 	}
 }
 
@@ -214,12 +236,33 @@ char Tserial::getChar(void)
 int  Tserial::getArray         (char *buffer, int len)
 {
     unsigned long read_nbr;
+    int           n;
 
-    read_nbr = 0;
-    if (serial_handle!=INVALID_HANDLE_VALUE)
+    flush();
+    read_nbr  = 0;
+    timed_out = 0;
+    if (transport!=0)
+    {
+        while ((int) read_nbr < len)
+        {
+            n = transport->read(buffer + read_nbr, len - (int) read_nbr,
+                                read_timeout > 0 ? read_timeout : -1);
+            if (n == 0)
+                timed_out = 1;
+            if (n <= 0)
+                break;
+            read_nbr += n;
+        }
+    }
+    else if (serial_handle!=INVALID_HANDLE_VALUE)
     {
         ReadFile(serial_handle, buffer, len, &read_nbr, NULL);
+        // ReadFile only comes back short when the timeout ran out
+        if (read_timeout > 0 && (int) read_nbr < len)
+            timed_out = 1;
     }
+    if (trace_hook!=0 && read_nbr>0)
+        trace_hook(trace_context, sdRECEIVED, buffer, (int) read_nbr);
     return((int) read_nbr);
 }
 /* -------------------------------------------------------------------- */
@@ -231,9 +274,12 @@ int Tserial::getNbrOfBytes    (void)
     int             n;
     unsigned long   etat;
 
+    flush();
     n = 0;
 
-    if (serial_handle!=INVALID_HANDLE_VALUE)
+    if (transport!=0)
+        n = transport->available();
+    else if (serial_handle!=INVALID_HANDLE_VALUE)
     {
         ClearCommError(serial_handle, &etat, &status);
         n = status.cbInQue;
@@ -243,6 +289,687 @@ int Tserial::getNbrOfBytes    (void)
     return(n);
 }
 
+/* -------------------------------------------------------------------- */
+/* --------------------------    discardInput ------------------------- */
+/* -------------------------------------------------------------------- */
+// Throws away whatever has arrived and not been read.
+void Tserial::discardInput     (void)
+{
+    char scrap[64];
+
+    if (transport!=0)
+        while (transport->read(scrap, sizeof(scrap), 0) > 0)
+            ;
+    else if (serial_handle!=INVALID_HANDLE_VALUE)
+        PurgeComm(serial_handle, PURGE_RXCLEAR);
+}
+
+#else // POSIX: termios, O_NONBLOCK and epoll
+
+/* -------------------------------------------------------------------- */
+/* -------------------------    Tserial   ----------------------------- */
+/* -------------------------------------------------------------------- */
+Tserial::Tserial()
+{
+    parityMode       = spNONE;
+    port[0]          = 0;
+    rate             = 0;
+    serial_fd        = -1;
+    epoll_fd         = -1;
+    rx_head          = 0;
+    rx_tail          = 0;
+    tx_length        = 0;
+    batch_depth      = 0;
+    trace_hook       = 0;
+    trace_context    = 0;
+    next_ticket      = 0;
+    next_reply       = 0;
+    reply_held       = 0;
+    late_replies     = 0;
+    read_timeout     = 0;
+    timed_out        = 0;
+    transport        = 0;
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    ~Tserial     ------------------------- */
+/* -------------------------------------------------------------------- */
+Tserial::~Tserial()
+{
+    disconnect();
+}
+/* -------------------------------------------------------------------- */
+/* --------------------------    disconnect   ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::disconnect(void)
+{
+    flush();
+    if (epoll_fd!=-1)
+        close(epoll_fd);
+    if (serial_fd!=-1)
+        close(serial_fd);
+    epoll_fd  = -1;
+    serial_fd = -1;
+    transport = 0;
+    rx_head   = 0;
+    rx_tail   = 0;
+    // nothing more will be answered on this line
+    next_reply = next_ticket;
+}
+/* -------------------------------------------------------------------- */
+/* --------------------------    baudConstant ------------------------- */
+/* -------------------------------------------------------------------- */
+static speed_t baudConstant(int rate)
+{
+    switch (rate)
+    {
+    case 300:    return B300;
+    case 600:    return B600;
+    case 1200:   return B1200;
+    case 2400:   return B2400;
+    case 4800:   return B4800;
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    }
+    return B0;
+}
+/* -------------------------------------------------------------------- */
+/* --------------------------    connect      ------------------------- */
+/* -------------------------------------------------------------------- */
+int  Tserial::connect          (const char *port_arg, int rate_arg, serial_parity parity_arg)
+{
+    int erreur;
+    struct termios     tio;
+    struct epoll_event ev;
+
+    /* --------------------------------------------- */
+    disconnect();
+
+    erreur = 0;
+
+    if (port_arg!=0)
+    {
+        strncpy(port, port_arg, sizeof(port) - 1);
+        port[sizeof(port) - 1] = 0;
+        rate      = rate_arg;
+        parityMode= parity_arg;
+
+        // opening serial port
+        serial_fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+        if (serial_fd != -1)
+        {
+            /* ---------- Serial Port Config ------- */
+            // Same line settings as the Win32 DCB: 7 data bits, two stop
+            // bits, no flow control of any kind, raw bytes.
+            if (tcgetattr(serial_fd, &tio) == -1)
+                erreur = 4;
+            else
+            {
+                cfmakeraw(&tio);
+                tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CRTSCTS);
+                tio.c_cflag |= CS7 | CSTOPB | CLOCAL | CREAD;
+                tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+                switch (parityMode)
+                {
+                case spNONE:
+                    break;
+                case spEVEN:
+                    tio.c_cflag |= PARENB;
+                    break;
+                case spODD:
+                    tio.c_cflag |= PARENB | PARODD;
+                    break;
+                }
+
+                // The descriptor is non-blocking, so VMIN/VTIME only
+                // matter to other openers of the device.
+                tio.c_cc[VMIN]  = 1;
+                tio.c_cc[VTIME] = 0;
+
+                // A pseudo-terminal has no line speed; only insist on
+                // the rate being one termios knows.
+                speed_t speed = baudConstant(rate);
+                if (speed == B0)
+                    erreur = 4;
+                else
+                {
+                    cfsetispeed(&tio, speed);
+                    cfsetospeed(&tio, speed);
+                    if (tcsetattr(serial_fd, TCSANOW, &tio) == -1)
+                        erreur = 4;
+                }
+            }
+
+            // readiness notification instead of blocking reads
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            memset(&ev, 0, sizeof(ev));
+            ev.events  = EPOLLIN;
+            ev.data.fd = serial_fd;
+            if (epoll_fd == -1
+                || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, serial_fd, &ev) == -1)
+                erreur = 2;
+        }
+        else
+            erreur = 8;
+    }
+    else
+        erreur = 16;
+
+
+    /* --------------------------------------------- */
+    if (erreur!=0)
+        disconnect();
+    return(erreur);
+}
+
+int  Tserial::connect          (const wchar_t *port_arg, int rate_arg, serial_parity parity_arg)
+{
+    char narrow[sizeof(port)];
+
+    if (port_arg==0)
+        return connect((const char *) 0, rate_arg, parity_arg);
+    if (wcstombs(narrow, port_arg, sizeof(narrow)) == (size_t) -1)
+        return(16);
+    narrow[sizeof(narrow) - 1] = 0;
+    return connect(narrow, rate_arg, parity_arg);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    waitFor      ------------------------- */
+/* -------------------------------------------------------------------- */
+// Blocks in epoll_wait until serial_fd reports one of the given events,
+// for at most timeout milliseconds (-1 for ever). Returns 0 when ready,
+// 1 if the time ran out, -1 if the port is gone.
+int  Tserial::waitFor          (unsigned int events, int timeout)
+{
+    struct epoll_event ev;
+    int n;
+
+    if (events & EPOLLOUT)
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = EPOLLIN | EPOLLOUT;
+        ev.data.fd = serial_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, serial_fd, &ev);
+    }
+
+    do
+    {
+        n = epoll_wait(epoll_fd, &ev, 1, timeout);
+    }
+    while ((n == -1 && errno == EINTR) || (n == 1 && !(ev.events & (events | EPOLLERR | EPOLLHUP))));
+
+    if (events & EPOLLOUT)
+    {
+        struct epoll_event in;
+        memset(&in, 0, sizeof(in));
+        in.events  = EPOLLIN;
+        in.data.fd = serial_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, serial_fd, &in);
+    }
+
+    if (n == 0)
+        return(1);
+    if (n != 1 || (ev.events & EPOLLERR))
+        return(-1);
+    return(0);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    fillRxBuffer ------------------------- */
+/* -------------------------------------------------------------------- */
+// Waits for the tty to become readable, then moves everything the driver
+// holds into rx_buffer with a single read(). Returns the number of bytes
+// now buffered, or 0 if the port failed.
+int  Tserial::fillRxBuffer     (void)
+{
+    ssize_t n;
+
+    if (rx_head == rx_tail)
+        rx_head = rx_tail = 0;
+
+    if (transport!=0)
+    {
+        n = transport->read(rx_buffer + rx_tail, sizeof(rx_buffer) - rx_tail,
+                            read_timeout > 0 ? read_timeout : -1);
+        if (n == 0)
+            timed_out = 1;
+        if (n <= 0)
+            return(0);
+        rx_tail += (int) n;
+        return(rx_tail - rx_head);
+    }
+
+    for (;;)
+    {
+        n = read(serial_fd, rx_buffer + rx_tail, sizeof(rx_buffer) - rx_tail);
+        if (n > 0)
+        {
+            rx_tail += (int) n;
+            break;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == 0 || errno != EAGAIN)
+            return(0);
+        // nothing there yet: sleep in epoll until the line has data
+        switch (waitFor(EPOLLIN, read_timeout > 0 ? read_timeout : -1))
+        {
+            case 0:
+                break;
+            case 1:
+                timed_out = 1;
+                return(0);
+            default:
+                return(0);
+        }
+    }
+    return(rx_tail - rx_head);
+}
+
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    writeRaw     ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::writeRaw(const char *buffer, int len)
+{
+    int     sent;
+    ssize_t n;
+
+    if (transport!=0)
+        transport->write(buffer, len);
+    else if (serial_fd!=-1)
+    {
+        sent = 0;
+        while (sent < len)
+        {
+            n = write(serial_fd, buffer + sent, len - sent);
+            if (n > 0)
+                sent += (int) n;
+            else if (n == -1 && errno == EINTR)
+                continue;
+            else if (n == -1 && errno == EAGAIN)
+            {
+                if (waitFor(EPOLLOUT, -1) == -1)
+                    break;
+            }
+            else
+                break;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    getChar      ------------------------- */
+/* -------------------------------------------------------------------- */
+char Tserial::getChar(void)
+{
+    char c;
+
+    c = 0;
+    getArray(&c, 1);
+    return(c);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    getArray     ------------------------- */
+/* -------------------------------------------------------------------- */
+// Like the Win32 version, blocks until len bytes have arrived, or the
+// timeout, if one is set, runs out while waiting for one of them.
+int  Tserial::getArray         (char *buffer, int len)
+{
+    int read_nbr;
+    int chunk;
+
+    flush();
+    read_nbr  = 0;
+    timed_out = 0;
+    if (serial_fd!=-1 || transport!=0)
+    {
+        while (read_nbr < len)
+        {
+            if (rx_head == rx_tail && fillRxBuffer() == 0)
+                break;
+            chunk = rx_tail - rx_head;
+            if (chunk > len - read_nbr)
+                chunk = len - read_nbr;
+            memcpy(buffer + read_nbr, rx_buffer + rx_head, chunk);
+            rx_head  += chunk;
+            read_nbr += chunk;
+        }
+    }
+    if (trace_hook!=0 && read_nbr>0)
+        trace_hook(trace_context, sdRECEIVED, buffer, read_nbr);
+    return(read_nbr);
+}
+/* -------------------------------------------------------------------- */
+/* --------------------------    receiveReplies ----------------------- */
+/* -------------------------------------------------------------------- */
+// One non-blocking read(), then as many buffered bytes as there are
+// outstanding queries are handed to them. Anything beyond that stays in
+// rx_buffer for getChar().
+int  Tserial::receiveReplies   (void)
+{
+    ssize_t n;
+    int     start;
+
+    flush();
+    if (serial_fd==-1 && transport==0)
+        return(0);
+
+    if (rx_head == rx_tail)
+        rx_head = rx_tail = 0;
+    else if (rx_tail == (int) sizeof(rx_buffer))
+    {
+        memmove(rx_buffer, rx_buffer + rx_head, rx_tail - rx_head);
+        rx_tail -= rx_head;
+        rx_head  = 0;
+    }
+    if (rx_tail < (int) sizeof(rx_buffer))
+    {
+        if (transport!=0)
+            n = transport->read(rx_buffer + rx_tail, sizeof(rx_buffer) - rx_tail, 0);
+        else
+            do
+                n = read(serial_fd, rx_buffer + rx_tail, sizeof(rx_buffer) - rx_tail);
+            while (n == -1 && errno == EINTR);
+        if (n > 0)
+            rx_tail += (int) n;
+    }
+
+    start = rx_head;
+    while (rx_head < rx_tail && next_reply != next_ticket)
+    {
+        reply_ring[next_reply % REPLY_DEPTH] = rx_buffer[rx_head++];
+        reply_held |= 1u << (next_reply % REPLY_DEPTH);
+        next_reply++;
+    }
+    if (trace_hook!=0 && rx_head > start)
+        trace_hook(trace_context, sdRECEIVED, rx_buffer + start, rx_head - start);
+    return(rx_head - start);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    awaitReplies ------------------------- */
+/* -------------------------------------------------------------------- */
+int  Tserial::awaitReplies     (int timeout)
+{
+    ssize_t n;
+
+    flush();
+    if (rx_head == rx_tail && next_reply != next_ticket)
+    {
+        if (transport!=0)
+        {
+            rx_head = rx_tail = 0;
+            n = transport->read(rx_buffer, sizeof(rx_buffer), timeout);
+            if (n > 0)
+                rx_tail = (int) n;
+        }
+        else if (serial_fd!=-1)
+            waitFor(EPOLLIN, timeout);
+    }
+    return(receiveReplies());
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    getNbrOfBytes ------------------------ */
+/* -------------------------------------------------------------------- */
+int Tserial::getNbrOfBytes    (void)
+{
+    int n;
+    int queued;
+
+    flush();
+    n = 0;
+
+    if (transport!=0)
+        n = rx_tail - rx_head + transport->available();
+    else if (serial_fd!=-1)
+    {
+        n = rx_tail - rx_head;
+        if (ioctl(serial_fd, FIONREAD, &queued) == 0)
+            n += queued;
+    }
+
+
+    return(n);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    discardInput ------------------------- */
+/* -------------------------------------------------------------------- */
+// Throws away rx_buffer and whatever the driver holds, without waiting.
+void Tserial::discardInput     (void)
+{
+    rx_head = rx_tail = 0;
+    if (transport!=0)
+        while (transport->read(rx_buffer, sizeof(rx_buffer), 0) > 0)
+            ;
+    else if (serial_fd!=-1)
+        tcflush(serial_fd, TCIFLUSH);
+}
+
+#endif // _WIN32
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    connect      ------------------------- */
+/* -------------------------------------------------------------------- */
+int  Tserial::connect          (serial_transport *transport_arg)
+{
+    disconnect();
+    if (transport_arg==0)
+        return(16);
+    transport = transport_arg;
+    return(0);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    sendChar     ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::sendChar(char data)
+{
+    sendArray(&data, 1);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    sendArray    ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::sendArray(char *buffer, int len)
+{
+    if (len > (int) sizeof(tx_buffer) - tx_length)
+        flush();
+
+    if (len > (int) sizeof(tx_buffer))
+    {
+        // too big to ever fit: goes out on its own
+        if (trace_hook!=0)
+            trace_hook(trace_context, sdSENT, buffer, len);
+        writeRaw(buffer, len);
+        return;
+    }
+
+    memcpy(tx_buffer + tx_length, buffer, len);
+    tx_length += len;
+    if (batch_depth == 0)
+        flush();
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    reserveFrame ------------------------- */
+/* -------------------------------------------------------------------- */
+char *Tserial::reserveFrame(int len)
+{
+    if (len > (int) sizeof(tx_buffer) - tx_length)
+        flush();
+    return(tx_buffer + tx_length);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    commitFrame  ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::commitFrame(int len)
+{
+    tx_length += len;
+    if (batch_depth == 0)
+        flush();
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    flush        ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::flush(void)
+{
+    if (tx_length > 0)
+    {
+        if (trace_hook!=0)
+            trace_hook(trace_context, sdSENT, tx_buffer, tx_length);
+        writeRaw(tx_buffer, tx_length);
+        tx_length = 0;
+    }
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    sendQuery    ------------------------- */
+/* -------------------------------------------------------------------- */
+// Sends the query like sendArray(), so inside a batch it goes out with the
+// rest of the batch. Late replies to abandoned queries are thrown away
+// first, while nothing else is outstanding to be mistaken for them.
+unsigned int Tserial::sendQuery(char *command, int len)
+{
+    if (late_replies && next_reply == next_ticket)
+    {
+        discardInput();
+        late_replies = 0;
+    }
+    sendArray(command, len);
+    reply_held &= ~(1u << (next_ticket % REPLY_DEPTH));
+    return(next_ticket++);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    getReply     ------------------------- */
+/* -------------------------------------------------------------------- */
+char Tserial::getReply(unsigned int ticket)
+{
+    timed_out = 0;
+    // unsigned differences, so the tickets may wrap around
+    if (replyLost(ticket))
+    {
+        timed_out = 1;
+        return(0);
+    }
+    while ((int) (ticket - next_reply) >= 0)
+    {
+        reply_ring[next_reply % REPLY_DEPTH] = getChar();
+        if (timed_out)
+        {
+            abandonReplies();
+            return(0);
+        }
+        reply_held |= 1u << (next_reply % REPLY_DEPTH);
+        next_reply++;
+    }
+    return(reply_ring[ticket % REPLY_DEPTH]);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    hasReply     ------------------------- */
+/* -------------------------------------------------------------------- */
+int Tserial::hasReply(unsigned int ticket)
+{
+    return((int) (next_reply - ticket) > 0 || replyLost(ticket));
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    replyLost    ------------------------- */
+/* -------------------------------------------------------------------- */
+// A ticket REPLY_DEPTH or more queries older than the newest has given
+// its slot in reply_ring to a later one, whether or not either reply has
+// arrived yet. A younger one is lost if it was abandoned, read past
+// without its reply.
+int Tserial::replyLost(unsigned int ticket)
+{
+    if ((int) (next_ticket - ticket) > REPLY_DEPTH)
+        return(1);
+    return((int) (next_reply - ticket) > 0
+           && (reply_held & (1u << (ticket % REPLY_DEPTH))) == 0);
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    query        ------------------------- */
+/* -------------------------------------------------------------------- */
+char Tserial::query(char *command, int len)
+{
+    return(getReply(sendQuery(command, len)));
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    pendingReplies ----------------------- */
+/* -------------------------------------------------------------------- */
+// Queries sent whose replies have not been read off the line yet.
+int Tserial::pendingReplies(void)
+{
+    return((int) (next_ticket - next_reply));
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    abandonReplies ----------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::abandonReplies(void)
+{
+    if (next_reply != next_ticket)
+        late_replies = 1;
+    next_reply = next_ticket;
+    discardInput();
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    beginBatch   ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::beginBatch(void)
+{
+    batch_depth++;
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    endBatch     ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::endBatch(void)
+{
+    if (batch_depth > 0 && --batch_depth == 0)
+        flush();
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    setTimeout   ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::setTimeout(int ms)
+{
+    read_timeout = ms > 0 ? ms : 0;
+#ifdef _WIN32
+    if (serial_handle!=INVALID_HANDLE_VALUE)
+    {
+        COMMTIMEOUTS cto = { 0, 0, (DWORD) read_timeout, 0, 0 };
+        SetCommTimeouts(serial_handle, &cto);
+    }
+#endif
+}
+
+/* -------------------------------------------------------------------- */
+/* --------------------------    setTrace     ------------------------- */
+/* -------------------------------------------------------------------- */
+void Tserial::setTrace(serial_trace hook, void *context)
+{
+    trace_hook    = hook;
+    trace_context = context;
+}
+
 void operator << (Tserial& stream, char c)
 {
     stream.sendArray(&c, 1);
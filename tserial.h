@@ -35,10 +35,57 @@
 #include <ostream>
 #include <stdio.h>
 #include <iostream>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
 using namespace std;
 
 enum serial_parity  { spNONE,    spODD, spEVEN };
+enum serial_direction { sdSENT, sdRECEIVED };
+
+// Called with every chunk of bytes that goes out on, or comes in from, the
+// line. Runs on the caller's thread, so it should only hand the bytes off.
+typedef void (*serial_trace)(void *context, serial_direction direction,
+                             const char *data, int len);
+
+#ifndef _WIN32
+/* -------------------------------------------------------------------- */
+/* Win32's Sleep(), so that code pacing the robot in milliseconds       */
+/* builds unchanged on the POSIX backend.                               */
+/* -------------------------------------------------------------------- */
+inline void Sleep(unsigned long ms)
+{
+    struct timespec ts;
+    ts.tv_sec  = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+#endif
+
+/* -------------------------------------------------------------------- */
+/* A transport carries Tserial's bytes in place of the serial port, for */
+/* instance to an in-process model of the robot (see LoopbackPort in    */
+/* XRSimulator.h). Tserial keeps its buffering, batching, query         */
+/* pipeline and tracing in front of it.                                 */
+/* -------------------------------------------------------------------- */
+class serial_transport
+{
+public:
+    virtual ~serial_transport() {}
+    // Takes len bytes for the line.
+    virtual void  write            (const char *buffer, int len) = 0;
+    // Copies up to len bytes that have arrived into buffer, waiting up to
+    // timeout milliseconds (-1 for ever, 0 not at all) for the first of
+    // them. Returns the number copied, 0 if the time ran out, or -1 if
+    // nothing can ever arrive.
+    virtual int   read             (char *buffer, int len, int timeout) = 0;
+    // The number of bytes read() would return without waiting.
+    virtual int   available        (void) = 0;
+};
 
 
 /* -------------------------------------------------------------------- */
@@ -49,10 +96,57 @@ class Tserial
 
     // -------------------------------------------------------- //
 protected:
-	wchar_t           port[10];                      // port name "com1",...
     int               rate;                          // baudrate
     serial_parity     parityMode;
+    // Outgoing bytes are collected here and written with one syscall when
+    // flushed: after each sendArray() outside a batch, at endBatch(), when
+    // the buffer fills, and before anything is read.
+    char              tx_buffer[256];
+    int               tx_length;
+    int               batch_depth;
+    serial_trace      trace_hook;
+    void             *trace_context;
+    // Queries whose one-byte replies are still to be handed out. The robot
+    // answers in the order it was asked, so the reply to ticket t is the
+    // byte after the reply to ticket t-1. Replies read ahead for a later
+    // ticket wait in reply_ring until their owner collects them.
+    enum { REPLY_DEPTH = 32 };
+    char              reply_ring[REPLY_DEPTH];
+    unsigned int      next_ticket;                   // handed to the next query
+    unsigned int      next_reply;                    // whose reply is next on the line
+    // One bit per slot of reply_ring, set once the slot holds the reply to
+    // the ticket it was last handed to. A ticket read past without one was
+    // abandoned.
+    unsigned int      reply_held;
+    // Queries were abandoned with their replies perhaps still to come.
+    int               late_replies;
+    // Milliseconds a read waits for the line before giving up, 0 for ever,
+    // and whether the last read gave up.
+    int               read_timeout;
+    int               timed_out;
+    // Carries the bytes instead of the port when connected to one.
+    serial_transport *transport;
+
+    void          writeRaw         (const char *buffer, int len);
+    int           replyLost        (unsigned int ticket);
+    void          discardInput     (void);
+#ifdef _WIN32
+	wchar_t           port[10];                      // port name "com1",...
     HANDLE            serial_handle;                 // ...
+#else
+    char              port[64];                      // device "/dev/ttyS0",...
+    int               serial_fd;                     // non-blocking tty
+    int               epoll_fd;                      // readiness of serial_fd
+    // Bytes already read off the tty but not yet handed to the caller.
+    // One read() drains everything the driver holds, so getChar() only
+    // costs a syscall when this buffer runs dry.
+    char              rx_buffer[256];
+    int               rx_head;
+    int               rx_tail;
+
+    int           waitFor          (unsigned int events, int timeout);
+    int           fillRxBuffer     (void);
+#endif
 
     // ++++++++++++++++++++++++++++++++++++++++++++++
     // .................. EXTERNAL VIEW .............
@@ -64,12 +158,77 @@ public:
     friend void operator << (Tserial& stream, char *ptr);
     friend void operator >> (Tserial& stream, char &c);
     friend void operator >> (Tserial& stream, char *ptr);
+#ifdef _WIN32
     int           connect          (wchar_t *port_arg, int rate_arg,
                                     serial_parity parity_arg);
+#else
+    int           connect          (const char *port_arg, int rate_arg,
+                                    serial_parity parity_arg);
+    int           connect          (const wchar_t *port_arg, int rate_arg,
+                                    serial_parity parity_arg);
+#endif
+    // Talks through transport_arg until disconnected. The caller keeps
+    // the transport.
+    int           connect          (serial_transport *transport_arg);
     // sendChar and sendArray are used to send commands to the serial
     // port.
     void          sendChar         (char c);
     void          sendArray        (char *buffer, int len);
+    // reserveFrame() returns room for len bytes at the end of the output
+    // buffer, flushing it first if it is too full; the caller writes the
+    // frame there and passes its actual length to commitFrame(), which
+    // sends it as sendArray() would. len must be at most 256.
+    char         *reserveFrame     (int len);
+    void          commitFrame      (int len);
+    // Between beginBatch() and the matching endBatch(), sends are only
+    // buffered, so several command frames go out in a single write.
+    void          beginBatch       (void);
+    void          endBatch         (void);
+    void          flush            (void);
+    // Query pipeline. sendQuery() sends a command that the robot answers
+    // with one byte and returns a ticket for the answer, without waiting
+    // for it; getReply() returns that answer, reading and keeping any
+    // answers to earlier tickets on the way. Several queries can be on
+    // the line at once, up to REPLY_DEPTH not yet collected. A ticket
+    // REPLY_DEPTH or more queries older than the newest has lost its
+    // answer to a later query's: getReply() gives up on it at once, as on
+    // a timeout, without abandoning the rest, and hasReply() is true for
+    // it so that nobody waits for it. While any are outstanding, replies
+    // must only be read through getReply().
+    // abandonReplies() gives up on every query still outstanding, as a
+    // getReply() that times out does, for callers that stop waiting on a
+    // clock of their own: their tickets are lost, and whatever has already
+    // arrived for them is thrown away, as is anything still arriving by
+    // the time the next query goes out with nothing else outstanding.
+    unsigned int  sendQuery        (char *command, int len);
+    char          getReply         (unsigned int ticket);
+    char          query            (char *command, int len);
+    int           pendingReplies   (void);
+    void          abandonReplies   (void);
+    // True once the reply to ticket has been read off the line, so that
+    // getReply() returns it without waiting.
+    int           hasReply         (unsigned int ticket);
+#ifndef _WIN32
+    // For event loops: the tty to watch for readability (-1 with a
+    // transport), and a read of whatever replies have already arrived,
+    // without waiting for more. Returns the number of replies taken.
+    // awaitReplies() is receiveReplies() for a loop with nothing else to
+    // watch: if nothing is buffered while a query is outstanding, it
+    // first waits up to timeout milliseconds (-1 for ever) for the line.
+    int           descriptor       (void) { return serial_fd; }
+    int           receiveReplies   (void);
+    int           awaitReplies     (int timeout);
+#endif
+    // With a timeout set, getChar(), getArray() and getReply() wait at
+    // most that many milliseconds for the line, and timedOut() says
+    // whether the last of them gave up. A getReply() that gives up
+    // abandons every query still outstanding with abandonReplies(), since
+    // any late replies can no longer be matched to them, and returns 0.
+    void          setTimeout       (int ms);
+    int           getTimeout       (void) { return read_timeout; }
+    int           timedOut         (void) { return timed_out; }
+    // Tracing is off until a hook is set; pass 0 to turn it off again.
+    void          setTrace         (serial_trace hook, void *context);
     // *buffer is a string that lists the command to the robot
     char          getChar          (void);
     int           getArray         (char *buffer, int len);
@@ -80,6 +239,6 @@ public:
 };
 /* -------------------------------------------------------------------- */
 
-#endif TSERIAL_H
+#endif // TSERIAL_H
 
 
@@ -0,0 +1,361 @@
+// xrbench: throughput and latency of JointMove and Tserial against the
+// simulated controller, printed as one JSON object for release gating.
+//
+//     xrbench --speed 10 --flow predictive > bench.json
+//
+// Options:
+//     --baud N          line speed the simulator emulates          (9600)
+//     --rate R          ticks per second each joint drains          (150)
+//     --speed S         run the simulator S times faster than real    (10)
+//     --flow MODE       polled or predictive                      (polled)
+//     --samples N       round trips timed per query type            (200)
+//     --resolutions F   joint resolution file            (resolutions.txt)
+//     --loopback        drive the model in-process on a virtual clock
+//
+// Every duration is wall-clock time on this host; multiply by the speed in
+// the "config" section to get the time the robot itself would take. With
+// --loopback there is no pseudo-terminal: the model sits behind a
+// LoopbackPort and time only passes when the library waits, so every
+// duration is the robot's own and "wall_s" is how long the run really took.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "JointMoveProto.h"
+#include "MotionQueue.h"
+#include "MotionTrace.h"
+#include "XRSimulator.h"
+
+using namespace TLeyson_Robot;
+
+namespace
+{
+	struct Settings
+	{
+		int          Baud;
+		double       Rate;
+		double       Speed;
+		flow_control Flow;
+		int          Samples;
+		std::string  Resolutions;
+		bool         Loopback;
+	};
+
+	void Usage(const char* Name)
+	{
+		fprintf(stderr, "usage: %s [--baud N] [--rate R] [--speed S] [--flow polled|predictive]\n"
+		                "          [--samples N] [--resolutions FILE] [--loopback]\n", Name);
+		exit(2);
+	}
+
+	// Reads the joint letters listed in the resolution file, in file order.
+	std::vector<char> JointsIn(const std::string& Filename)
+	{
+		std::vector<char> Joints;
+		std::ifstream     In(Filename.c_str());
+		std::string       Line;
+		while (std::getline(In, Line))
+			if (!Line.empty() && Line[0] >= 'A' && Line[0] <= 'H')
+				Joints.push_back(Line[0]);
+		return Joints;
+	}
+
+	// Waits until the joint's register is empty, so a timing includes the
+	// motion still queued in the controller when Move returns.
+	void AwaitStopped(Tserial& Port, char Joint)
+	{
+		char Query[] = {Joint, '?', 0x0A, 0x0D, '\0'};
+		for (;;)
+		{
+			Port << Query;
+			if (Port.getChar() - 32 <= 0)
+				return;
+			SleepUntil(MonotonicSeconds() + 0.002);
+		}
+	}
+
+	void PrintHistogram(const char* Name, const LatencyHistogram& H, bool Last)
+	{
+		printf("    \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+		       "\"p99\": %llu, \"max\": %llu}%s\n", Name, (unsigned long long) H.Count(), H.Mean(),
+		       (unsigned long long) H.Percentile(0.5), (unsigned long long) H.Percentile(0.9),
+		       (unsigned long long) H.Percentile(0.99), (unsigned long long) H.Max(), Last ? "" : ",");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings Config;
+	Config.Baud        = 9600;
+	Config.Rate        = 150;
+	Config.Speed       = 10;
+	Config.Flow        = POLLED;
+	Config.Samples     = 200;
+	Config.Resolutions = "resolutions.txt";
+	Config.Loopback    = false;
+
+	for (int k = 1; k < argc; k++)
+	{
+		if (!strcmp(argv[k], "--loopback"))
+			Config.Loopback = true;
+		else if (k + 1 >= argc)
+			Usage(argv[0]);
+		else if (!strcmp(argv[k], "--baud"))
+			Config.Baud = atoi(argv[++k]);
+		else if (!strcmp(argv[k], "--rate"))
+			Config.Rate = atof(argv[++k]);
+		else if (!strcmp(argv[k], "--speed"))
+			Config.Speed = atof(argv[++k]);
+		else if (!strcmp(argv[k], "--samples"))
+			Config.Samples = atoi(argv[++k]);
+		else if (!strcmp(argv[k], "--resolutions"))
+			Config.Resolutions = argv[++k];
+		else if (!strcmp(argv[k], "--flow"))
+		{
+			k++;
+			if (!strcmp(argv[k], "polled"))
+				Config.Flow = POLLED;
+			else if (!strcmp(argv[k], "predictive"))
+				Config.Flow = PREDICTIVE;
+			else
+				Usage(argv[0]);
+		}
+		else
+			Usage(argv[0]);
+	}
+	if (Config.Speed <= 0 || Config.Rate <= 0 || Config.Samples <= 0)
+		Usage(argv[0]);
+
+	std::vector<char> Joints = JointsIn(Config.Resolutions);
+	if (Joints.empty())
+	{
+		fprintf(stderr, "xrbench: no joints in %s\n", Config.Resolutions.c_str());
+		return 1;
+	}
+	std::vector<char> Filename(Config.Resolutions.begin(), Config.Resolutions.end());
+	Filename.push_back('\0');
+
+	XRController Robot(Config.Baud);
+	for (char J = 'A'; J <= 'H'; J++)
+		Robot.Joint(J).TickRate = Config.Rate;
+	SimulatedPort Simulator(Robot, Config.Speed);
+	LoopbackPort  Loopback(Robot);
+	VirtualClock  Virtual;
+	std::thread   Serving;
+	std::mutex&   ModelLock = Config.Loopback ? Loopback.ModelLock() : Simulator.ModelLock();
+	std::chrono::steady_clock::time_point WallStart = std::chrono::steady_clock::now();
+
+	Tserial Port;
+	if (Config.Loopback)
+	{
+		Clock::Install(&Virtual);
+		Port.connect(&Loopback);
+	}
+	else
+	{
+		if (!Simulator.Open())
+		{
+			perror("xrbench: pseudo-terminal");
+			return 1;
+		}
+		Serving = std::thread(&SimulatedPort::Run, &Simulator);
+		if (Port.connect(Simulator.Name(), Config.Baud > 0 ? Config.Baud : 9600, spEVEN) != 0)
+		{
+			fprintf(stderr, "xrbench: cannot open %s\n", Simulator.Name());
+			Simulator.Stop();
+			Serving.join();
+			return 1;
+		}
+	}
+
+	// 1. Raw command throughput through sendArray. A stop command leaves
+	// the model's state alone.
+	char   Stop[] = {'H', 'X', 0x0A, 0x0D, '\0'};
+	int    Frames = Config.Samples * 10;
+	double Began  = MonotonicSeconds();
+	for (int k = 0; k < Frames; k++)
+		Port << Stop;
+	double CommandsPerSecond = Frames / (MonotonicSeconds() - Began);
+
+	// 2. Query round trips, once the stop commands have cleared the line.
+	LatencyHistogram RegisterQuery, SwitchQuery;
+	char Query[] = {'D', '?', 0x0A, 0x0D, '\0'};
+	Port << Query;
+	Port.getChar();
+	for (int k = 0; k < Config.Samples; k++)
+	{
+		double Asked = MonotonicSeconds();
+		Port << Query;
+		Port.getChar();
+		RegisterQuery.Record(uint64_t((MonotonicSeconds() - Asked) * 1e6));
+
+		Asked = MonotonicSeconds();
+		Port << 'I';
+		Port.getChar();
+		SwitchQuery.Record(uint64_t((MonotonicSeconds() - Asked) * 1e6));
+	}
+
+	// 2b. Every joint's register read once, one joint at a time and then
+	// with every query on the line at once.
+	std::vector< std::vector<char> > Queries;
+	for (size_t j = 0; j < Joints.size(); j++)
+	{
+		char Each[] = {Joints[j], '?', 0x0A, 0x0D};
+		Queries.push_back(std::vector<char>(Each, Each + sizeof(Each)));
+	}
+	std::vector<unsigned int> Tickets(Joints.size());
+	double Serial = MonotonicSeconds();
+	for (int k = 0; k < Config.Samples; k++)
+		for (size_t j = 0; j < Joints.size(); j++)
+			Port.query(&Queries[j][0], int(Queries[j].size()));
+	Serial = MonotonicSeconds() - Serial;
+	double Pipelined = MonotonicSeconds();
+	for (int k = 0; k < Config.Samples; k++)
+	{
+		Port.beginBatch();
+		for (size_t j = 0; j < Joints.size(); j++)
+			Tickets[j] = Port.sendQuery(&Queries[j][0], int(Queries[j].size()));
+		Port.endBatch();
+		for (size_t j = 0; j < Joints.size(); j++)
+			Port.getReply(Tickets[j]);
+	}
+	Pipelined = MonotonicSeconds() - Pipelined;
+	double Sampled = double(Config.Samples) * Joints.size();
+
+	// A configuration that can't be read fails the run, so a gate on it fails.
+	int Status = 0;
+	try
+	{
+		// 3. One radian out and back on every joint, including the drain.
+		std::vector<double> PerRadian;
+		for (size_t j = 0; j < Joints.size(); j++)
+		{
+			JointMove Joint(Joints[j], 4, -4, &Filename[0], &Port, false);
+			Joint.SetFlowControl(Config.Flow);
+			double Start = MonotonicSeconds();
+			Joint.Move(1);
+			Joint.Move(0);
+			AwaitStopped(Port, Joints[j]);
+			PerRadian.push_back((MonotonicSeconds() - Start) / 2);
+		}
+
+		// 4. Homing D from 100 ticks below its switch.
+		{
+			std::lock_guard<std::mutex> Hold(ModelLock);
+			Robot.Joint('D').Position = Robot.Joint('D').TripPosition - 100;
+			Robot.Joint('D').Register = 0;
+		}
+		double HomeStart = MonotonicSeconds();
+		JointMove Homed('D', 5 * PI/12, -5 * PI/12, &Filename[0], &Port, true);
+		double HomeSeconds = MonotonicSeconds() - HomeStart;
+
+		// 5. Homing D, E and F together, each from 100 ticks below its switch.
+		{
+			std::lock_guard<std::mutex> Hold(ModelLock);
+			for (char J = 'D'; J <= 'F'; J++)
+			{
+				Robot.Joint(J).Position = Robot.Joint(J).TripPosition - 100;
+				Robot.Joint(J).Register = 0;
+			}
+		}
+		JointMove HomeD('D', Homed.ViewUpperBound(), Homed.ViewLowerBound(), &Filename[0], &Port, false);
+		JointMove HomeE('E', PI/3, -PI/3, &Filename[0], &Port, false);
+		JointMove HomeF('F', PI/6, -PI/6, &Filename[0], &Port, false);
+		std::vector<JointMove*> Together;
+		Together.push_back(&HomeD);
+		Together.push_back(&HomeE);
+		Together.push_back(&HomeF);
+		double HomeAllStart = MonotonicSeconds();
+		JointMove::HomeAll(Together);
+		double HomeAllSeconds = MonotonicSeconds() - HomeAllStart;
+
+		// 6. The jointtest.cpp pose sequence.
+		JointMove djoint('D', 5 * PI/12, -5 * PI/12, &Filename[0], &Port, false);
+		JointMove ejoint('E', PI/3, -PI/3, &Filename[0], &Port, false);
+		JointMove fjoint('F', PI/6, -PI/6, &Filename[0], &Port, false);
+		djoint.SetFlowControl(Config.Flow);
+		ejoint.SetFlowControl(Config.Flow);
+		fjoint.SetFlowControl(Config.Flow);
+		double PoseStart = MonotonicSeconds();
+		djoint.Move(-PI/8);
+		djoint.Move(PI/12);
+		fjoint.Move(PI/8);
+		djoint.Move(-PI/12);
+		fjoint.Move(-PI/12);
+		ejoint.Move(-PI/8);
+		AwaitStopped(Port, 'D');
+		AwaitStopped(Port, 'E');
+		AwaitStopped(Port, 'F');
+		double PoseSeconds = MonotonicSeconds() - PoseStart;
+
+		// 7. The same sequence from the same start, through a MotionQueue.
+		djoint.Move(0);
+		ejoint.Move(0);
+		fjoint.Move(0);
+		AwaitStopped(Port, 'D');
+		AwaitStopped(Port, 'E');
+		AwaitStopped(Port, 'F');
+		double QueuedStart = MonotonicSeconds();
+		MotionQueue Queue;
+		Queue.Move(&djoint, -PI/8);
+		Queue.Move(&djoint, PI/12);
+		Queue.Move(&fjoint, PI/8);
+		Queue.Move(&djoint, -PI/12);
+		Queue.Move(&fjoint, -PI/12);
+		Queue.Move(&ejoint, -PI/8);
+		Queue.Flush();
+		AwaitStopped(Port, 'D');
+		AwaitStopped(Port, 'E');
+		AwaitStopped(Port, 'F');
+		double QueuedSeconds = MonotonicSeconds() - QueuedStart;
+
+		double WallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - WallStart).count();
+		printf("{\n  \"config\": {\"baud\": %d, \"drain_rate\": %g, \"speed\": %g, \"flow\": \"%s\", \"samples\": %d, "
+		       "\"loopback\": %s},\n", Config.Baud, Config.Rate, Config.Loopback ? 1 : Config.Speed,
+		       Config.Flow == PREDICTIVE ? "predictive" : "polled", Config.Samples, Config.Loopback ? "true" : "false");
+		// Writes take no virtual time, so a loopback run has no send rate.
+		if (Config.Loopback)
+			printf("  \"send_commands_per_s\": null,\n");
+		else
+			printf("  \"send_commands_per_s\": %.1f,\n", CommandsPerSecond);
+		printf("  \"query_round_trip_us\": {\n");
+		PrintHistogram("register", RegisterQuery, false);
+		PrintHistogram("switch", SwitchQuery, true);
+		printf("  },\n  \"register_reads_per_s\": {\"serial\": %.1f, \"pipelined\": %.1f},\n",
+		       Sampled / Serial, Sampled / Pipelined);
+		printf("  \"move_s_per_rad\": {");
+		for (size_t j = 0; j < Joints.size(); j++)
+			printf("%s\"%c\": %.4f", j ? ", " : "", Joints[j], PerRadian[j]);
+		printf("},\n  \"home_s\": %.4f,\n  \"home_all_s\": %.4f,\n  \"pose_sequence_s\": %.4f,\n"
+		       "  \"pose_sequence_queued_s\": %.4f,\n  \"wall_s\": %.4f\n}\n",
+		       HomeSeconds, HomeAllSeconds, PoseSeconds, QueuedSeconds, WallSeconds);
+	}
+	catch (const FileNotFoundException&)
+	{
+		fprintf(stderr, "xrbench: cannot open %s\n", Config.Resolutions.c_str());
+		Status = 1;
+	}
+	catch (const MalformedConfigException& Bad)
+	{
+		fprintf(stderr, "xrbench: line %d of %s is malformed\n", Bad.line, Bad.fname);
+		Status = 1;
+	}
+	catch (const ValueNotFoundException&)
+	{
+		fprintf(stderr, "xrbench: joint missing from %s\n", Config.Resolutions.c_str());
+		Status = 1;
+	}
+
+	Port.disconnect();
+	if (Serving.joinable())
+	{
+		Simulator.Stop();
+		Serving.join();
+	}
+	Clock::Install(0);
+	return Status;
+}
@@ -0,0 +1,102 @@
+// xrcalibrate: measures every joint in a configuration file and writes the
+// group size and replenish level that suit it back into the file.
+//
+//     xrcalibrate /dev/ttyS0 resolutions.txt
+//     xrcalibrate --joints DEF com1 resolutions.txt
+//
+// Each joint moves CALIBRATION_TICKS forward and back (see
+// JointMove::Calibrate), so the arm must have room to do that. Joints that
+// fail to calibrate, stall or stop answering keep their old settings.
+// --dry-run prints the results without saving them.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "JointMoveProto.h"
+
+using namespace TLeyson_Robot;
+
+static void Usage(const char* Name)
+{
+	fprintf(stderr, "usage: %s [--joints LETTERS] [--baud N] [--dry-run] PORT CONFIG\n", Name);
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	std::string Only;
+	int         Baud   = 9600;
+	bool        DryRun = false;
+	int         k      = 1;
+
+	for (; k < argc && argv[k][0] == '-'; k++)
+	{
+		if (!strcmp(argv[k], "--dry-run"))
+			DryRun = true;
+		else if (!strcmp(argv[k], "--joints") && k + 1 < argc)
+			Only = argv[++k];
+		else if (!strcmp(argv[k], "--baud") && k + 1 < argc)
+			Baud = atoi(argv[++k]);
+		else
+			Usage(argv[0]);
+	}
+	if (argc - k != 2)
+		Usage(argv[0]);
+	char* PortName = argv[k];
+	char* Filename = argv[k + 1];
+
+	try
+	{
+		RobotConfig Config(Filename);
+
+		Tserial Port;
+		if (Port.connect(PortName, Baud, spEVEN) != 0)
+		{
+			fprintf(stderr, "xrcalibrate: cannot open %s\n", PortName);
+			return 1;
+		}
+
+		int Failures = 0;
+		for (char J = 'A'; J <= 'H'; J++)
+		{
+			if (!Config.Has(J) || (!Only.empty() && Only.find(J) == std::string::npos))
+				continue;
+
+			JointMove Joint(J, Config, &Port, false);
+			try
+			{
+				JointConfig Settings = Joint.Calibrate();
+				printf("%c: group=%u replenish=%u\n", J, Settings.GroupSize, Settings.Replenish);
+				Config.Set(J, Settings);
+			}
+			catch (CalibrationFailedException)
+			{
+				fprintf(stderr, "xrcalibrate: joint %c could not be calibrated\n", J);
+				Failures++;
+			}
+			catch (StalledMovementException Stall)
+			{
+				if (Stall.Register < 0)
+					fprintf(stderr, "xrcalibrate: joint %c stopped answering during calibration\n", J);
+				else
+					fprintf(stderr, "xrcalibrate: joint %c stalled during calibration\n", J);
+				Failures++;
+			}
+		}
+		Port.disconnect();
+
+		if (!DryRun)
+			Config.Save(Filename);
+		return Failures ? 1 : 0;
+	}
+	catch (FileNotFoundException Missing)
+	{
+		fprintf(stderr, "xrcalibrate: cannot open %s\n", Missing.fname);
+	}
+	catch (MalformedConfigException Bad)
+	{
+		fprintf(stderr, "xrcalibrate: line %d of %s is malformed\n", Bad.line, Bad.fname);
+	}
+	return 1;
+}
@@ -0,0 +1,62 @@
+// xrcompile: compiles a motion program (see MotionProgram.h) against a
+// configuration file, so that MotionReplay can send it without working
+// anything out.
+//
+//     xrcompile poses.txt poses.xrp
+//     xrcompile --config arm.txt poses.txt poses.xrp
+//
+// The configuration must be the one the arm will run with: the group
+// sizes and replenish levels are built into the compiled program.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MotionProgram.h"
+
+using namespace TLeyson_Robot;
+
+static void Usage(const char* Name)
+{
+	fprintf(stderr, "usage: %s [--config FILE] PROGRAM OUTPUT\n", Name);
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	char ConfigName[] = "resolutions.txt";
+	char* Filename = ConfigName;
+	int   k        = 1;
+
+	for (; k < argc && argv[k][0] == '-'; k++)
+	{
+		if (!strcmp(argv[k], "--config") && k + 1 < argc)
+			Filename = argv[++k];
+		else
+			Usage(argv[0]);
+	}
+	if (argc - k != 2)
+		Usage(argv[0]);
+
+	try
+	{
+		RobotConfig    Config(Filename);
+		MotionCompiler Compiler(Config);
+		Compiler.Compile(argv[k], argv[k + 1]);
+
+		MotionReplay Compiled(argv[k + 1]);
+		printf("%s: %d joints, %d steps\n", argv[k + 1], Compiled.ViewJointCount(), Compiled.ViewStepCount());
+		return 0;
+	}
+	catch (FileNotFoundException Missing)
+	{
+		fprintf(stderr, "xrcompile: cannot open %s\n", Missing.fname);
+	}
+	catch (MalformedConfigException Bad)
+	{
+		fprintf(stderr, "xrcompile: line %d of %s is malformed\n", Bad.line, Bad.fname);
+	}
+	catch (ValueNotFoundException Missing)
+	{
+		fprintf(stderr, "xrcompile: a joint is missing from %s\n", Missing.fname);
+	}
+	return 1;
+}
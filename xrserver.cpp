@@ -0,0 +1,130 @@
+// xrserver: owns the robot's serial port and moves its joints for any
+// number of other processes, which send requests over a Unix domain socket
+// (see MotionServer.h).
+//
+//     xrserver /dev/ttyS0
+//     xrserver --config arm.txt --socket /tmp/xr.sock --home /dev/ttyS0
+//     xrserver --state /xr-arm /dev/ttyS0
+//
+// --home homes every joint that has a switch before serving. --state
+// publishes every joint's position and velocity as it moves to a shared
+// memory board of that name, for other processes to read with
+// JointStateBoard::Open (see StateEstimator.h). The server
+// runs until it is sent SIGINT or SIGTERM, and removes its socket on the
+// way out.
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "MotionServer.h"
+
+using namespace TLeyson_Robot;
+
+static MotionServer* Serving = 0;
+
+static void Finish(int)
+{
+	if (Serving)
+		Serving->Stop();
+}
+
+static void Usage(const char* Name)
+{
+	fprintf(stderr, "usage: %s [--config FILE] [--socket PATH] [--state NAME] [--baud N] [--home] PORT\n", Name);
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	char        ConfigName[] = "resolutions.txt";
+	char*       Filename     = ConfigName;
+	const char* SocketPath   = "/tmp/xrserver.sock";
+	const char* StateName    = 0;
+	int         Baud         = 9600;
+	bool        Home         = false;
+	int         k            = 1;
+
+	for (; k < argc && argv[k][0] == '-'; k++)
+	{
+		if (!strcmp(argv[k], "--config") && k + 1 < argc)
+			Filename = argv[++k];
+		else if (!strcmp(argv[k], "--socket") && k + 1 < argc)
+			SocketPath = argv[++k];
+		else if (!strcmp(argv[k], "--state") && k + 1 < argc)
+			StateName = argv[++k];
+		else if (!strcmp(argv[k], "--baud") && k + 1 < argc)
+			Baud = atoi(argv[++k]);
+		else if (!strcmp(argv[k], "--home"))
+			Home = true;
+		else
+			Usage(argv[0]);
+	}
+	if (argc - k != 1)
+		Usage(argv[0]);
+	char* PortName = argv[k];
+
+	try
+	{
+		RobotConfig Config(Filename);
+
+		Tserial Port;
+		if (Port.connect(PortName, Baud, spEVEN) != 0)
+		{
+			fprintf(stderr, "xrserver: cannot open %s\n", PortName);
+			return 1;
+		}
+
+		// The board outlives the joints publishing to it.
+		JointStateBoard Board;
+		if (StateName && !Board.Create(StateName))
+		{
+			fprintf(stderr, "xrserver: cannot create %s\n", StateName);
+			Port.disconnect();
+			return 1;
+		}
+
+		int Status = 0;
+		{
+			MotionServer Server(Config, &Port);
+			for (char J = 'A'; J <= 'H'; J++)
+				if (StateName && Server.ViewJoint(J))
+					Server.ViewJoint(J)->PublishTo(Board);
+			if (Home)
+			{
+				std::vector<JointMove*> Joints;
+				for (char J = 'A'; J <= 'H'; J++)
+					if (Server.ViewJoint(J))
+						Joints.push_back(Server.ViewJoint(J));
+				JointMove::HomeAll(Joints);
+			}
+
+			if (!Server.Listen(SocketPath))
+			{
+				fprintf(stderr, "xrserver: cannot listen on %s\n", SocketPath);
+				Status = 1;
+			}
+			else
+			{
+				Serving = &Server;
+				signal(SIGINT, Finish);
+				signal(SIGTERM, Finish);
+				Server.Run();
+				Serving = 0;
+			}
+			if (StateName)
+				JointStateBoard::Remove(StateName);
+		}
+		Port.disconnect();
+		return Status;
+	}
+	catch (FileNotFoundException Missing)
+	{
+		fprintf(stderr, "xrserver: cannot open %s\n", Missing.fname);
+	}
+	catch (MalformedConfigException Bad)
+	{
+		fprintf(stderr, "xrserver: line %d of %s is malformed\n", Bad.line, Bad.fname);
+	}
+	return 1;
+}
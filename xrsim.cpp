@@ -0,0 +1,140 @@
+// xrsim: an XR series controller on a pseudo-terminal.
+//
+// Prints the name of the slave side, which JointMove programs open in place
+// of the robot's serial port:
+//
+//     xrsim --speed 10 --rate D=200 --trip D=0 --link /tmp/xr
+//
+// Options (a joint letter followed by '=' applies a setting to one joint,
+// a bare number to all of them):
+//     --baud N        line speed to emulate, 0 for none        (9600)
+//     --rate [J=]R    ticks per second drained from a register (150)
+//     --start [J=]P   starting position in ticks              (-100)
+//     --trip [J=]P    position where the limit switch closes      (0)
+//     --width [J=]W   ticks over which the switch stays closed   (20)
+//     --speed S       run the model S times faster than real time (1)
+//     --link PATH     also make PATH a symlink to the slave
+//     --verbose       echo every command to stderr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "XRSimulator.h"
+
+using TLeyson_Robot::XRController;
+using TLeyson_Robot::SimulatedJoint;
+using TLeyson_Robot::SimulatedPort;
+
+static SimulatedPort* Serving = 0;
+
+static void StopRunning(int)
+{
+	if (Serving)
+		Serving->Stop();
+}
+
+// Applies "J=value" to joint J, or "value" to every joint.
+static void SetJoints(XRController& Robot, const char* Arg, double SimulatedJoint::* Field)
+{
+	if (Arg[0] >= 'A' && Arg[0] <= 'H' && Arg[1] == '=')
+	{
+		Robot.Joint(Arg[0]).*Field = atof(Arg + 2);
+		return;
+	}
+	for (char J = 'A'; J <= 'H'; J++)
+		Robot.Joint(J).*Field = atof(Arg);
+}
+
+static void SetJoints(XRController& Robot, const char* Arg, int SimulatedJoint::* Field)
+{
+	if (Arg[0] >= 'A' && Arg[0] <= 'H' && Arg[1] == '=')
+	{
+		Robot.Joint(Arg[0]).*Field = atoi(Arg + 2);
+		return;
+	}
+	for (char J = 'A'; J <= 'H'; J++)
+		Robot.Joint(J).*Field = atoi(Arg);
+}
+
+static void Usage(const char* Name)
+{
+	fprintf(stderr, "usage: %s [--baud N] [--rate [J=]R] [--start [J=]P] [--trip [J=]P]\n"
+	                "          [--width [J=]W] [--speed S] [--link PATH] [--verbose]\n", Name);
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	int         Baud    = 9600;
+	double      Speed   = 1;
+	const char* Link    = 0;
+	bool        Verbose = false;
+
+	for (int k = 1; k < argc; k++)
+	{
+		if (!strcmp(argv[k], "--baud") && k + 1 < argc)
+			Baud = atoi(argv[++k]);
+		else if (!strcmp(argv[k], "--speed") && k + 1 < argc)
+			Speed = atof(argv[++k]);
+		else if (!strcmp(argv[k], "--link") && k + 1 < argc)
+			Link = argv[++k];
+		else if (!strcmp(argv[k], "--verbose"))
+			Verbose = true;
+		else if (!strcmp(argv[k], "--rate") || !strcmp(argv[k], "--start")
+		      || !strcmp(argv[k], "--trip") || !strcmp(argv[k], "--width"))
+			k++;
+		else
+			Usage(argv[0]);
+	}
+	if (Speed <= 0)
+		Usage(argv[0]);
+
+	// The line delay is in model time, so it scales with --speed as well.
+	XRController Robot(Baud);
+	for (int k = 1; k + 1 < argc; k++)
+	{
+		if (!strcmp(argv[k], "--rate"))
+			SetJoints(Robot, argv[++k], &SimulatedJoint::TickRate);
+		else if (!strcmp(argv[k], "--start"))
+			SetJoints(Robot, argv[++k], &SimulatedJoint::Position);
+		else if (!strcmp(argv[k], "--trip"))
+			SetJoints(Robot, argv[++k], &SimulatedJoint::TripPosition);
+		else if (!strcmp(argv[k], "--width"))
+			SetJoints(Robot, argv[++k], &SimulatedJoint::TripWidth);
+	}
+
+	SimulatedPort Port(Robot, Speed);
+	if (!Port.Open())
+	{
+		perror("xrsim: pseudo-terminal");
+		return 1;
+	}
+	if (Verbose)
+		Port.EchoTo(stderr);
+
+	if (Link)
+	{
+		unlink(Link);
+		if (symlink(Port.Name(), Link) == -1)
+			perror("xrsim: link");
+	}
+	printf("%s\n", Port.Name());
+	fflush(stdout);
+
+	Serving = &Port;
+	signal(SIGINT,  StopRunning);
+	signal(SIGTERM, StopRunning);
+	Port.Run();
+
+	fprintf(stderr, "xrsim: %ld commands, %ld queries\n", Robot.CommandsReceived(), Robot.QueriesAnswered());
+	for (char J = 'B'; J <= 'H'; J++)
+	{
+		const SimulatedJoint& Joint = Robot.Joint(J);
+		if (Joint.TicksMoved)
+			fprintf(stderr, "xrsim: %c at %d, moved %ld ticks\n", J, Joint.Position, Joint.TicksMoved);
+	}
+	if (Link)
+		unlink(Link);
+	return 0;
+}
@@ -0,0 +1,693 @@
+// xrtest: checks the library against the simulated controller, in-process
+// behind a LoopbackPort on a virtual clock, so a check takes milliseconds
+// however long its motion would take on the robot.
+//
+//     xrtest [check ...]
+//
+// With no arguments every check runs, otherwise only those named. Each one
+// gets a fresh model and port, prints "ok" or "FAIL" with what went wrong,
+// and the exit status is 1 if any failed. Joints C to F are set up as in
+// resolutions.txt, so no configuration is read, and D once more as a
+// Fixed::JointMove. The scheduler check needs C++20 and is left out
+// without it, as MotionScheduler is.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cmath>
+#include <future>
+#include <vector>
+#include "CoordinatedMove.h"
+#include "FixedJointMove.h"
+#include "JointMoveProto.h"
+#include "MotionProgram.h"
+#include "MotionQueue.h"
+#include "MotionScheduler.h"
+#include "Trajectory.h"
+#include "XRSimulator.h"
+
+using namespace TLeyson_Robot;
+
+namespace
+{
+	constexpr double RESOLUTION = 0.00209439510239;
+
+	int Failures = 0;
+
+	// Records a failed expectation; the check carries on, so one run
+	// reports everything that is wrong with it.
+	void Expect(bool Passed, const char* What)
+	{
+		if (Passed)
+			return;
+		printf("    expected %s\n", What);
+		Failures++;
+	}
+
+	/********************************************************************
+	* Rig: one model of the controller behind a loopback port, with the
+	* virtual clock installed for as long as it lives.
+	********************************************************************/
+	class Rig
+	{
+		public:
+			XRController Model;
+			LoopbackPort Loopback;
+			VirtualClock Virtual;
+			Tserial      Port;
+			RobotConfig  Config;
+
+			Rig(void) : Loopback(Model)
+			{
+				Clock::Install(&this->Virtual);
+				this->Port.connect(&this->Loopback);
+				for (char J = 'C'; J <= 'F'; J++)
+				{
+					JointConfig Settings;
+					Settings.Resolution = RESOLUTION;
+					Settings.LowerBound = -PI / 3;
+					Settings.UpperBound =  PI / 3;
+					Settings.SwitchMask = char(1 << (J - 'C'));
+					this->Config.Set(J, Settings);
+					this->Start[J - 'A'] = this->Model.Joint(J).Position;
+				}
+			}
+
+			~Rig()
+			{
+				PortWorker::Release(&this->Port);
+				SwitchPoller::Release(&this->Port);
+				this->Port.disconnect();
+				Clock::Install(0);
+			}
+
+			// Stops the joint draining its register, as a jammed axis would.
+			void Jam(char Joint)
+			{
+				std::lock_guard<std::mutex> Hold(this->Loopback.ModelLock());
+				this->Model.Joint(Joint).TickRate = 0;
+			}
+
+			// Lets Seconds pass, long enough by default for anything sent to
+			// arrive and run out, and runs the model up to then.
+			void Settle(double Seconds = 5)
+			{
+				SleepUntil(MonotonicSeconds() + Seconds);
+				std::lock_guard<std::mutex> Hold(this->Loopback.ModelLock());
+				this->Model.Advance(MonotonicSeconds());
+			}
+
+			// Ticks the joint has moved since the rig was made.
+			int Moved(char Joint)
+			{
+				std::lock_guard<std::mutex> Hold(this->Loopback.ModelLock());
+				return this->Model.Joint(Joint).Position - this->Start[Joint - 'A'];
+			}
+
+			int Register(char Joint)
+			{
+				std::lock_guard<std::mutex> Hold(this->Loopback.ModelLock());
+				this->Model.Advance(MonotonicSeconds());
+				return this->Model.Joint(Joint).Register;
+			}
+		private:
+			int Start[8];
+	};
+
+	// The ticks Move sends to take a joint from home to Angle.
+	int Ticks(double Angle)
+	{
+		return int(std::lround(Angle / RESOLUTION));
+	}
+
+	/********************************************************************
+	* Checks. Each builds its own Rig.
+	********************************************************************/
+	void CheckPipeline(void)
+	{
+		Rig  Robot;
+		char Loads[][6] = {"C+10\n", "D+20\n", "E+30\n", "F+40\n"};
+		char Queries[][4] = {"C?\n", "D?\n", "E?\n", "F?\n"};
+		unsigned int Tickets[4];
+
+		for (char J = 'C'; J <= 'F'; J++)
+			Robot.Jam(J);
+		for (int j = 0; j < 4; j++)
+			Robot.Port.sendArray(Loads[j], 5);
+		Robot.Port.beginBatch();
+		for (int j = 0; j < 4; j++)
+			Tickets[j] = Robot.Port.sendQuery(Queries[j], 3);
+		Robot.Port.endBatch();
+		Expect(Robot.Port.pendingReplies() == 4, "four replies outstanding");
+
+		// Collected last first, so the earlier replies wait in the ring.
+		for (int j = 3; j >= 0; j--)
+			Expect(Robot.Port.getReply(Tickets[j]) - 32 == 10 * (j + 1), "each reply to match its query");
+		Expect(Robot.Port.pendingReplies() == 0, "no replies outstanding");
+		Expect(Robot.Model.QueriesAnswered() == 4, "one query per joint on the line");
+
+		// One more query than the ring holds: the first ticket's answer is
+		// lost to the last's, and collecting it fails instead of
+		// returning the wrong byte.
+		const int Depth = 33;
+		unsigned int Deep[Depth];
+		Robot.Port.beginBatch();
+		for (int k = 0; k < Depth; k++)
+			Deep[k] = Robot.Port.sendQuery(Queries[k % 4], 3);
+		Robot.Port.endBatch();
+		Expect(Robot.Port.hasReply(Deep[0]), "the lost ticket not to be waited for");
+		Robot.Port.getReply(Deep[0]);
+		Expect(Robot.Port.timedOut() != 0, "the lost ticket to give up");
+		Expect(Robot.Port.getReply(Deep[Depth - 1]) - 32 == 10, "the newest reply to match its query");
+		Expect(!Robot.Port.timedOut(), "the newest reply to be there");
+		Expect(Robot.Port.getReply(Deep[1]) - 32 == 20, "the oldest kept reply to match its query");
+		Expect(Robot.Port.pendingReplies() == 0, "no replies outstanding");
+	}
+
+	// A reply given up on abandons the line; the replies that come late
+	// are thrown away, not taken for the next query's.
+	void CheckAbandon(void)
+	{
+		Rig  Robot;
+		char Loads[][6] = {"C+10\n", "D+20\n", "E+30\n"};
+		char Queries[][4] = {"C?\n", "D?\n", "E?\n"};
+
+		for (char J = 'C'; J <= 'E'; J++)
+			Robot.Jam(J);
+		for (int j = 0; j < 3; j++)
+			Robot.Port.sendArray(Loads[j], 5);
+		Robot.Port.setTimeout(1);
+		Robot.Port.beginBatch();
+		unsigned int First  = Robot.Port.sendQuery(Queries[0], 3);
+		unsigned int Second = Robot.Port.sendQuery(Queries[1], 3);
+		Robot.Port.endBatch();
+		Robot.Port.getReply(First);
+		Expect(Robot.Port.timedOut() != 0, "a reply not yet on the line to time out");
+		Expect(Robot.Port.hasReply(Second), "the abandoned ticket not to be waited for");
+		Robot.Port.getReply(Second);
+		Expect(Robot.Port.timedOut() != 0, "the abandoned ticket to give up");
+
+		Robot.Settle(1);
+		Robot.Port.setTimeout(1000);
+		Expect(Robot.Port.query(Queries[2], 3) - 32 == 30, "the next reply to match its query");
+		Expect(!Robot.Port.timedOut(), "the next reply to be there");
+
+		Robot.Port.beginBatch();
+		First  = Robot.Port.sendQuery(Queries[0], 3);
+		Second = Robot.Port.sendQuery(Queries[1], 3);
+		Robot.Port.endBatch();
+		Robot.Port.abandonReplies();
+		Expect(Robot.Port.hasReply(First) && Robot.Port.hasReply(Second), "abandoned tickets not to be waited for");
+		Robot.Settle(1);
+		Expect(Robot.Port.query(Queries[2], 3) - 32 == 30, "a reply after abandonReplies to match its query");
+		Expect(Robot.Port.pendingReplies() == 0, "no replies outstanding");
+	}
+
+	void CheckMove(void)
+	{
+		Rig       Robot;
+		JointMove Elbow('D', Robot.Config, &Robot.Port, false);
+		JointMove Wrist('C', Robot.Config, &Robot.Port, false);
+
+		Elbow.Move(0.3);
+		Wrist.SetFlowControl(PREDICTIVE);
+		Wrist.Move(-0.4);
+		Wrist.Move(0.2);
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(0.3), "D at 0.3 rad");
+		Expect(Robot.Moved('C') == Ticks(0.2), "C at 0.2 rad");
+		Expect(Elbow.ViewCurrentPosition() == 0.3, "D's position to be where it was sent");
+	}
+
+	void CheckEstimate(void)
+	{
+		Rig       Robot;
+		JointMove Elbow('D', Robot.Config, &Robot.Port, false);
+
+		Elbow.Move(0.3);
+		JointEstimate Moving = Elbow.ViewEstimate();
+		Expect(std::fabs(Moving.Target - 0.3) < RESOLUTION, "the estimate's target to be 0.3 rad");
+		Expect(Moving.Velocity > 0, "the joint to be moving when Move returns");
+
+		Robot.Settle();
+		JointEstimate Stopped = Elbow.ViewEstimate();
+		Expect(std::fabs(Stopped.Position - 0.3) < RESOLUTION, "the estimate to end at 0.3 rad");
+		Expect(Stopped.Velocity == 0, "the estimate to end at rest");
+	}
+
+	void CheckStall(void)
+	{
+		Rig       Robot;
+		JointMove Elbow('D', Robot.Config, &Robot.Port, false);
+		JointMove Shoulder('E', Robot.Config, &Robot.Port, false);
+
+		Robot.Jam('E');
+		bool Stalled = false;
+		try
+		{
+			Shoulder.Move(0.3);
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = true;
+			Expect(Stall.Joint == 'E', "the stall to name E");
+			Expect(Stall.Register > 0, "the stall to report the stuck register");
+		}
+		Expect(Stalled, "a jammed joint's Move to stall");
+		Robot.Settle(0.1);
+		Expect(Robot.Register('E') == 0, "the jammed joint to be stopped");
+
+		Elbow.Move(0.3);
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(0.3), "D to move normally after E stalled");
+	}
+
+	// A stall in the middle of a batch still stops the joint: the X goes
+	// out with the batch as the exception leaves it.
+	void CheckCoordinated(void)
+	{
+		Rig             Robot;
+		JointMove       Elbow('D', Robot.Config, &Robot.Port, false);
+		JointMove       Shoulder('E', Robot.Config, &Robot.Port, false);
+		CoordinatedMove Together;
+
+		Together.Add(&Elbow, 0.3);
+		Together.Add(&Shoulder, -0.3);
+		Together.Execute();
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(0.3), "D at 0.3 rad");
+		Expect(Robot.Moved('E') == Ticks(-0.3), "E at -0.3 rad");
+
+		Robot.Jam('E');
+		Together.Add(&Elbow, 0);
+		Together.Add(&Shoulder, 0);
+		bool Stalled = false;
+		try
+		{
+			Together.Execute();
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = true;
+			Expect(Stall.Joint == 'E', "the stall to name E");
+		}
+		Expect(Stalled, "a jammed joint to stall the coordinated move");
+		Robot.Settle(0.1);
+		Expect(Robot.Register('E') == 0, "the jammed joint to be stopped");
+
+		// The joint that didn't stall finishes what it was sent, and is
+		// known to be there; nothing is left to send again.
+		Robot.Settle();
+		Expect(Together.ViewJointCount() == 0, "the stalled move's joints to be let go");
+		Expect(Robot.Moved('D') == Ticks(Elbow.ViewCurrentPosition()), "D's position to be where its ticks took it");
+		Elbow.Move(0.1);
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(0.1), "D at 0.1 rad after the stall");
+
+		// The same for a trajectory. A fresh E has no drain rate to trust,
+		// so the path reads its register back and finds it stuck.
+		JointMove  Stuck('E', Robot.Config, &Robot.Port, false);
+		Trajectory Path;
+		Path.Add(&Elbow, 1, 4);
+		Path.Add(&Stuck, 1, 4);
+		Path.AddWaypoint(std::vector<double>{-0.3, 0.3});
+		Stalled = false;
+		try
+		{
+			Path.Execute();
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = Stall.Joint == 'E';
+		}
+		Expect(Stalled, "a jammed joint to stall the trajectory");
+		Robot.Settle();
+		Expect(Path.ViewWaypointCount() == 0, "the stalled path's waypoints to be cleared");
+		Expect(Robot.Moved('D') == Ticks(Elbow.ViewCurrentPosition()), "D's position to be where the path took it");
+		Elbow.Move(0.1);
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(0.1), "D at 0.1 rad after the stalled path");
+	}
+
+	// Homing ends on the switch's edge, and a switch that never opens
+	// again stops the search instead of backing off for ever.
+	void CheckHome(void)
+	{
+		Rig Robot;
+		int Edge;
+		{
+			std::lock_guard<std::mutex> Hold(Robot.Loopback.ModelLock());
+			SimulatedJoint& Elbow = Robot.Model.Joint('D');
+			Edge           = Elbow.TripPosition;
+			Elbow.Position = Edge - 100;
+			SimulatedJoint& Shoulder = Robot.Model.Joint('E');
+			Shoulder.TripPosition = Shoulder.Position - 1000;
+			Shoulder.TripWidth    = 1 << 20;
+		}
+		JointMove Elbow('D', Robot.Config, &Robot.Port, false);
+		JointMove Shoulder('E', Robot.Config, &Robot.Port, false);
+
+		Elbow.Home();
+		Robot.Settle();
+		{
+			std::lock_guard<std::mutex> Hold(Robot.Loopback.ModelLock());
+			int Position = Robot.Model.Joint('D').Position;
+			Expect(Position >= Edge && Position <= Edge + 2, "D to end on its switch's edge");
+		}
+
+		bool Stalled = false;
+		try
+		{
+			Shoulder.Home();
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = true;
+			Expect(Stall.Joint == 'E', "the stall to name E");
+		}
+		Expect(Stalled, "a switch that never opens to stop homing");
+		Robot.Settle(0.1);
+		Expect(Robot.Register('E') == 0, "E to be stopped");
+	}
+
+	void CheckAsync(void)
+	{
+		Rig       Robot;
+		JointMove Elbow('D', Robot.Config, &Robot.Port, false);
+
+		std::future<int> Moved = Elbow.MoveAsync(0.3);
+		Expect(Moved.get() == 0, "MoveAsync to return 0");
+
+		std::future<int> Refused = Elbow.MoveAsync(2.0);
+		bool Violated = false;
+		try
+		{
+			Refused.get();
+		}
+		catch (const BoundaryViolationException&)
+		{
+			Violated = true;
+		}
+		Expect(Violated, "MoveAsync out of bounds to throw through the future");
+
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(0.3), "D at 0.3 rad");
+	}
+
+	void CheckQueue(void)
+	{
+		Rig       Robot;
+		JointMove Elbow('D', Robot.Config, &Robot.Port, false);
+		JointMove Shoulder('E', Robot.Config, &Robot.Port, false);
+		JointMove Waist('F', Robot.Config, &Robot.Port, false);
+		MotionQueue Queue(1.0);
+
+		// The jointtest.cpp sequence: three moves of D, two of F, one of E.
+		Queue.Move(&Elbow, -PI / 8);
+		Queue.Move(&Elbow, PI / 12);
+		Queue.Move(&Waist, PI / 8);
+		Queue.Move(&Elbow, -PI / 12);
+		Queue.Move(&Waist, -PI / 12);
+		Queue.Move(&Shoulder, -PI / 8);
+		Expect(Queue.ViewPendingCount() == 3, "one request held per joint");
+		Expect(Queue.ViewMerged() == 3, "three requests merged");
+		Expect(Robot.Model.CommandsReceived() == 0, "nothing sent before the flush");
+
+		Queue.Flush();
+		Expect(Queue.ViewPendingCount() == 0, "nothing held after the flush");
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(-PI / 12), "D at -PI/12");
+		Expect(Robot.Moved('E') == Ticks(-PI / 8), "E at -PI/8");
+		Expect(Robot.Moved('F') == Ticks(-PI / 12), "F at -PI/12");
+
+		bool Violated = false;
+		try
+		{
+			Queue.Move(&Waist, 2.0);
+		}
+		catch (const BoundaryViolationException&)
+		{
+			Violated = true;
+		}
+		Expect(Violated && Queue.ViewPendingCount() == 0, "a bad angle refused at once and nothing held");
+
+		// Held past the window until the next call, which sends it.
+		Queue.Move(&Elbow, 0.1);
+		Queue.Poll();
+		Expect(Queue.ViewPendingCount() == 1, "a poll within the window to send nothing");
+		Robot.Settle(Queue.ViewDeadline() - MonotonicSeconds());
+		Queue.Poll();
+		Expect(Queue.ViewPendingCount() == 0, "a poll at the deadline to flush");
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(0.1), "D at 0.1 rad");
+	}
+
+	void CheckReplay(void)
+	{
+		Rig  Robot;
+		char Source[]   = "/tmp/xrtest-program-XXXXXX";
+		char Compiled[] = "/tmp/xrtest-compiled-XXXXXX";
+		close(mkstemp(Compiled));
+		FILE* Program = fdopen(mkstemp(Source), "w");
+		fprintf(Program, "D 0.3\nE -0.2\nD -0.1\n");
+		fclose(Program);
+
+		MotionCompiler(Robot.Config).Compile(Source, Compiled);
+		MotionReplay Replay(Compiled);
+		unlink(Source);
+		unlink(Compiled);
+
+		JointMove Elbow('D', Robot.Config, &Robot.Port, false);
+		JointMove Shoulder('E', Robot.Config, &Robot.Port, false);
+		Tserial   Elsewhere;
+		JointMove Stray('F', Robot.Config, &Elsewhere, false);
+
+		std::vector<JointMove*> Joints;
+		Joints.push_back(&Elbow);
+		Joints.push_back(&Stray);
+		Joints.push_back(&Shoulder);
+		bool Mismatched = false;
+		try
+		{
+			Replay.Play(Joints);
+		}
+		catch (const PortMismatchException&)
+		{
+			Mismatched = true;
+		}
+		Expect(Mismatched, "joints on two ports to be refused");
+		Expect(Robot.Model.CommandsReceived() == 0, "nothing sent for them");
+
+		Joints.erase(Joints.begin() + 1);
+		Replay.Play(Joints);
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(-0.1), "D at -0.1 rad");
+		Expect(Robot.Moved('E') == Ticks(-0.2), "E at -0.2 rad");
+		Expect(Elbow.ViewCurrentPosition() == -0.1, "D's position to be the program's last");
+
+		// A jammed joint stops the replay instead of being waited for.
+		Robot.Jam('E');
+		bool Stalled = false;
+		try
+		{
+			Replay.Play(&Robot.Port);
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = Stall.Joint == 'E';
+		}
+		Expect(Stalled, "a jammed joint to stall the replay");
+		Robot.Settle(0.1);
+		Expect(Robot.Register('E') == 0, "the jammed joint to be stopped");
+	}
+
+	// The rig's settings for D, as Fixed::JointMove takes them.
+	struct Elbow
+	{
+		static constexpr double       Resolution   = RESOLUTION;
+		static constexpr double       LowerBound   = -PI / 3;
+		static constexpr double       UpperBound   =  PI / 3;
+		static constexpr double       HomePosition = 0;
+		static constexpr unsigned int GroupSize    = 50;
+		static constexpr unsigned int Replenish    = 15;
+	};
+
+	void CheckFixed(void)
+	{
+		Rig                        Robot;
+		Fixed::JointMove<D, Elbow> Joint(&Robot.Port, false);
+
+		Joint.Move(0.3);
+		Joint.Move(-0.2);
+		Robot.Settle();
+		Expect(Robot.Moved('D') == Ticks(-0.2), "D at -0.2 rad");
+
+		// Homing after a move starts the joint's position over.
+		Joint.Home();
+		Robot.Settle();
+		int Home = Robot.Moved('D');
+		Expect(Joint.ViewCurrentPosition() == Elbow::HomePosition, "D's position to be home after Home");
+		Joint.Move(0.1);
+		Robot.Settle();
+		Expect(Robot.Moved('D') - Home == Ticks(0.1), "D 0.1 rad from its switch");
+
+		Robot.Jam('D');
+		bool Stalled = false;
+		try
+		{
+			Joint.Move(0.3);
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = Stall.Joint == 'D';
+		}
+		Expect(Stalled, "a jammed joint's Move to stall");
+		Robot.Settle(0.1);
+		Expect(Robot.Register('D') == 0, "the jammed joint to be stopped");
+
+		Stalled = false;
+		try
+		{
+			Joint.Home();
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = Stall.Joint == 'D';
+		}
+		Expect(Stalled, "a jammed joint's Home to stall");
+		Robot.Settle(0.1);
+		Expect(Robot.Register('D') == 0, "the jammed joint to be stopped again");
+
+		// A switch reading that never comes would read as every switch
+		// closed; it must stop the search instead, and not be published.
+		SwitchState Before = SwitchPoller::For(&Robot.Port).Latest();
+		Robot.Port.setTimeout(1);
+		Stalled = false;
+		try
+		{
+			Joint.Home();
+		}
+		catch (const StalledMovementException& Stall)
+		{
+			Stalled = Stall.Joint == 'D' && Stall.Register == -1;
+		}
+		Expect(Stalled, "a lost switch reading to stall Home");
+		SwitchState After = SwitchPoller::For(&Robot.Port).Latest();
+		Expect(After.Time == Before.Time && After.Bits == Before.Bits, "the lost reading not to be published");
+	}
+
+#if !defined(_WIN32) && defined(__cpp_impl_coroutine)
+	void CheckScheduler(void)
+	{
+		Rig Robot;
+		std::vector<JointMove*> Joints;
+		for (char J = 'C'; J <= 'F'; J++)
+			Joints.push_back(new JointMove(J, Robot.Config, &Robot.Port, false));
+
+		Robot.Jam('E');
+		{
+			MotionScheduler Scheduler(&Robot.Port);
+			std::vector< std::future<int> > Moves;
+			for (size_t j = 0; j < Joints.size(); j++)
+				Moves.push_back(Scheduler.Move(Joints[j], 0.3));
+			// Asked after the first, so it waits for it.
+			Moves.push_back(Scheduler.Move(Joints[1], -0.2));
+
+			for (size_t j = 0; j < Moves.size(); j++)
+			{
+				bool Stalled = false;
+				try
+				{
+					Moves[j].get();
+				}
+				catch (const StalledMovementException& Stall)
+				{
+					Stalled = Stall.Joint == 'E';
+				}
+				Expect(Stalled == (j == 2), "only E's move to stall");
+			}
+		}
+		Robot.Settle();
+		Expect(Robot.Moved('C') == Ticks(0.3), "C at 0.3 rad");
+		Expect(Robot.Moved('D') == Ticks(-0.2), "D at -0.2 rad, after its first move");
+		Expect(Robot.Moved('F') == Ticks(0.3), "F at 0.3 rad");
+		Expect(Robot.Register('E') == 0, "the jammed joint to be stopped");
+
+		// Homing with a switch that never opens again stalls, as HomeAll does.
+		{
+			std::lock_guard<std::mutex> Hold(Robot.Loopback.ModelLock());
+			SimulatedJoint& Wrist = Robot.Model.Joint('F');
+			Wrist.TripPosition = Wrist.Position - 1000;
+			Wrist.TripWidth    = 1 << 20;
+		}
+		{
+			MotionScheduler Scheduler(&Robot.Port);
+			std::future<int> Homed = Scheduler.Home(Joints[3]);
+			bool Stalled = false;
+			try
+			{
+				Homed.get();
+			}
+			catch (const StalledMovementException& Stall)
+			{
+				Stalled = Stall.Joint == 'F';
+			}
+			Expect(Stalled, "F's homing to stall");
+		}
+
+		for (size_t j = 0; j < Joints.size(); j++)
+			delete Joints[j];
+	}
+#endif
+
+	struct Check
+	{
+		const char* Name;
+		void      (*Run)(void);
+	};
+
+	const Check Checks[] =
+	{
+		{"pipeline",    CheckPipeline},
+		{"abandon",     CheckAbandon},
+		{"move",        CheckMove},
+		{"estimate",    CheckEstimate},
+		{"stall",       CheckStall},
+		{"coordinated", CheckCoordinated},
+		{"home",        CheckHome},
+		{"async",       CheckAsync},
+		{"queue",       CheckQueue},
+		{"replay",      CheckReplay},
+		{"fixed",       CheckFixed},
+#if !defined(_WIN32) && defined(__cpp_impl_coroutine)
+		{"scheduler",   CheckScheduler},
+#endif
+	};
+}
+
+int main(int argc, char** argv)
+{
+	int Failed = 0;
+	for (size_t c = 0; c < sizeof(Checks) / sizeof(Checks[0]); c++)
+	{
+		bool Wanted = argc < 2;
+		for (int k = 1; k < argc; k++)
+			Wanted = Wanted || !strcmp(argv[k], Checks[c].Name);
+		if (!Wanted)
+			continue;
+
+		Failures = 0;
+		try
+		{
+			Checks[c].Run();
+		}
+		catch (...)
+		{
+			printf("    unexpected exception\n");
+			Failures++;
+		}
+		printf("%s %s\n", Failures ? "FAIL" : "ok  ", Checks[c].Name);
+		Failed += Failures > 0;
+	}
+	return Failed ? 1 : 0;
+}